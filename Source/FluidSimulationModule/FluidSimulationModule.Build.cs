@@ -14,6 +14,9 @@
 // OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
 // OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
+using System;
+using System.Diagnostics;
+using System.IO;
 using UnrealBuildTool;
 
 public class FluidSimulationModule : ModuleRules
@@ -27,5 +30,58 @@ public class FluidSimulationModule : ModuleRules
               "InputCore"
             });
         PCHUsage = PCHUsageMode.UseExplicitOrSharedPCHs;
+
+        // The ISPC kernels are optional, they are built when the ISPC environment variable names the compiler.
+        // Otherwise the C++ kernels run everywhere
+        var ispc = Environment.GetEnvironmentVariable("ISPC");
+        var isX64 = Target.Platform == UnrealTargetPlatform.Win64 || Target.Platform == UnrealTargetPlatform.Linux;
+        if(isX64 && !String.IsNullOrEmpty(ispc) && File.Exists(ispc))
+        {
+            BuildIspcKernels(ispc);
+            Definitions.Add("WITH_ATMOS_ISPC=1");
+        }
+        else
+        {
+            Definitions.Add("WITH_ATMOS_ISPC=0");
+        }
+    }
+
+    // Compiles Private/FluidKernels.ispc for every target in IspcTargets. ISPC adds a dispatch object that picks the
+    // widest target the CPU supports at runtime
+    private void BuildIspcKernels(string ispc)
+    {
+        const string IspcTargets = "sse4-i32x4,avx2-i32x8,avx512skx-i32x16";
+        var source = Path.Combine(ModuleDirectory, "Private", "FluidKernels.ispc");
+        var outputDirectory =
+            Path.Combine(ModuleDirectory, "..", "..", "Intermediate", "ISPC", Target.Platform.ToString());
+        var objectExtension = Target.Platform == UnrealTargetPlatform.Win64 ? ".obj" : ".o";
+        var output = Path.Combine(outputDirectory, "FluidKernels" + objectExtension);
+        var header = Path.Combine(outputDirectory, "FluidKernels_ispc.h");
+
+        Directory.CreateDirectory(outputDirectory);
+        if(!File.Exists(output) || !File.Exists(header) ||
+           File.GetLastWriteTimeUtc(source) > File.GetLastWriteTimeUtc(output))
+        {
+            var arguments = String.Format("\"{0}\" -O2 --arch=x86-64 --target={1} --pic -o \"{2}\" -h \"{3}\"",
+                                          source, IspcTargets, output, header);
+            var startInfo = new ProcessStartInfo(ispc, arguments);
+            startInfo.UseShellExecute = false;
+            startInfo.RedirectStandardError = true;
+            using(var process = Process.Start(startInfo))
+            {
+                var errors = process.StandardError.ReadToEnd();
+                process.WaitForExit();
+                if(process.ExitCode != 0)
+                {
+                    throw new BuildException("ISPC failed to compile {0}:\n{1}", source, errors);
+                }
+            }
+        }
+
+        PrivateIncludePaths.Add(outputDirectory);
+        foreach(var kernelObject in Directory.GetFiles(outputDirectory, "FluidKernels*" + objectExtension))
+        {
+            PublicAdditionalLibraries.Add(kernelObject);
+        }
     }
 }
\ No newline at end of file
@@ -0,0 +1,93 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "AtmoGasQueue.h"
+
+namespace {
+// Signed distance from position b to position a, correct across the wrap of the positions
+int32 distance(int32 a, int32 b)
+{
+    return static_cast<int32>(static_cast<uint32>(a) - static_cast<uint32>(b));
+}
+} // namespace
+
+AtmoGasQueue::AtmoGasQueue(int32 capacity)
+  : m_mask(FMath::RoundUpToPowerOfTwo(FMath::Max(capacity, 2)) - 1)
+  , m_tail(0)
+  , m_head(0)
+{
+    m_slots.SetNum(m_mask + 1);
+    for(auto i = 0; i < m_slots.Num(); ++i)
+    {
+        m_slots[i].sequence.Set(i);
+    }
+}
+
+bool AtmoGasQueue::push(const FAtmoGasCommand& command)
+{
+    auto position = m_tail;
+    for(;;)
+    {
+        auto& slot = m_slots[position & m_mask];
+        const auto lag = distance(slot.sequence.GetValue(), position);
+        if(lag == 0)
+        {
+            // The slot is free for this position, claim it unless another producer was faster
+            const auto claimed = FPlatformAtomics::InterlockedCompareExchange(&m_tail, position + 1, position);
+            if(claimed == position)
+            {
+                slot.command = command;
+                // Publishes the command, Set() is a full barrier
+                slot.sequence.Set(position + 1);
+                return true;
+            }
+            position = claimed;
+        }
+        else if(lag < 0)
+        {
+            // The slot still holds the command of the previous lap
+            m_dropped.Increment();
+            return false;
+        }
+        else
+        {
+            position = m_tail;
+        }
+    }
+}
+
+int32 AtmoGasQueue::drain(TArray<FAtmoGasCommand>& commands)
+{
+    auto count = 0;
+    for(; count < m_slots.Num(); ++count, ++m_head)
+    {
+        auto& slot = m_slots[m_head & m_mask];
+        if(distance(slot.sequence.GetValue(), m_head + 1) != 0)
+        {
+            return count;
+        }
+        // Reads the command only after seeing it was published
+        FPlatformMisc::MemoryBarrier();
+        commands.Add(slot.command);
+        slot.sequence.Set(m_head + m_slots.Num());
+    }
+    return count;
+}
+
+bool AtmoGasQueue::isEmpty() const
+{
+    return distance(m_slots[m_head & m_mask].sequence.GetValue(), m_head + 1) != 0;
+}
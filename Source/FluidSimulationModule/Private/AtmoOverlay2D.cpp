@@ -0,0 +1,132 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#include "AtmoOverlay2D.h"
+
+#include "Misc/ScopeLock.h"
+
+AtmoOverlay2D::AtmoOverlay2D()
+  : m_field(EAtmoOverlayField::Pressure)
+  , m_level(1)
+  , m_range(500.0f)
+  , m_settingsChanged(true)
+  , m_sizeX(0)
+  , m_sizeY(0)
+  , m_tilesX(0)
+  , m_tilesY(0)
+{
+}
+
+void AtmoOverlay2D::settings(EAtmoOverlayField field, int32 level, float range)
+{
+    FScopeLock lock(&m_lock);
+    m_settingsChanged = m_settingsChanged || field != m_field || level != m_level || range != m_range;
+    m_field = field;
+    m_level = level;
+    m_range = range;
+}
+
+void AtmoOverlay2D::capture(const AtmoSnapshot3D& snapshot)
+{
+    FScopeLock lock(&m_lock);
+    if(snapshot.sizeX() != m_sizeX || snapshot.sizeY() != m_sizeY)
+    {
+        m_sizeX = snapshot.sizeX();
+        m_sizeY = snapshot.sizeY();
+        m_tilesX = snapshot.chunksX();
+        m_tilesY = snapshot.chunksY();
+        m_texels.Init(FColor::Black, m_sizeX * m_sizeY);
+        m_dirty.Init(true, snapshot.numChunks());
+        m_settingsChanged = true;
+    }
+    if(m_settingsChanged)
+    {
+        m_revisions.Init(0, snapshot.numChunks());
+        m_settingsChanged = false;
+    }
+
+    const auto level = FMath::Clamp(m_level, 0, snapshot.sizeZ() - 1);
+    for(auto tile = 0; tile < snapshot.numChunks(); ++tile)
+    {
+        if(snapshot.revision(tile) == m_revisions[tile])
+        {
+            continue;
+        }
+        m_revisions[tile] = snapshot.revision(tile);
+
+        const auto* values = snapshot.chunk(tile);
+        const auto x0 = (tile % m_tilesX) * TileSize;
+        const auto y0 = (tile / m_tilesX) * TileSize;
+        for(auto y = y0; y < FMath::Min(y0 + TileSize, m_sizeY); ++y)
+        {
+            for(auto x = x0; x < FMath::Min(x0 + TileSize, m_sizeX); ++x)
+            {
+                const auto* cell = values + snapshot.chunkOffset(x, y, level, EGasType::O2);
+                const auto quantized = m_field == EAtmoOverlayField::Pressure
+                                         ? cell[EGasType::O2] + cell[EGasType::N2] + cell[EGasType::CO2] +
+                                             cell[EGasType::Toxin]
+                                         : cell[static_cast<int32>(m_field) - 1];
+                const auto texel = heat(quantized * snapshot.quantum());
+                auto& current = m_texels[x + y * m_sizeX];
+                if(current != texel)
+                {
+                    current = texel;
+                    m_dirty[tile] = true;
+                }
+            }
+        }
+    }
+}
+
+bool AtmoOverlay2D::takeDirty(TArray<FIntRect>& tiles, TArray<FColor>& data)
+{
+    tiles.Reset();
+    data.Reset();
+    FScopeLock lock(&m_lock);
+    for(auto tile = 0; tile < m_dirty.Num(); ++tile)
+    {
+        if(!m_dirty[tile])
+        {
+            continue;
+        }
+        m_dirty[tile] = false;
+
+        const auto x0 = (tile % m_tilesX) * TileSize;
+        const auto y0 = (tile / m_tilesX) * TileSize;
+        const FIntRect rect(x0, y0, FMath::Min(x0 + TileSize, m_sizeX), FMath::Min(y0 + TileSize, m_sizeY));
+        tiles.Add(rect);
+
+        const auto offset = data.Num();
+        data.AddZeroed(TileSize * TileSize);
+        for(auto y = rect.Min.Y; y < rect.Max.Y; ++y)
+        {
+            FMemory::Memcpy(&data[offset + (y - y0) * TileSize],
+                            &m_texels[rect.Min.X + y * m_sizeX],
+                            rect.Width() * sizeof(FColor));
+        }
+    }
+    return tiles.Num() > 0;
+}
+
+FColor AtmoOverlay2D::heat(float value) const
+{
+    // Blue for empty, through green to red at the top of the range. Alpha keeps the plain value for materials
+    const auto t = FMath::Clamp(value / m_range, 0.0f, 1.0f);
+    const auto level = static_cast<uint8>(FMath::RoundToInt(t * 255.0f));
+    const auto red = static_cast<uint8>(FMath::RoundToInt(FMath::Clamp(2.0f * t - 1.0f, 0.0f, 1.0f) * 255.0f));
+    const auto blue = static_cast<uint8>(FMath::RoundToInt(FMath::Clamp(1.0f - 2.0f * t, 0.0f, 1.0f) * 255.0f));
+    const auto green = static_cast<uint8>(255 - red - blue);
+    return FColor(red, green, blue, level);
+}
@@ -16,9 +16,9 @@
 
 #include "AtmoPkg3D.h"
 
-AtmoPkg3D::AtmoPkg3D(int32 x, int32 y, int32 z)
+AtmoPkg3D::AtmoPkg3D(int32 x, int32 y, int32 z, const FArray3DPolicy& policy)
 {
-    m_data.Init({x, y, z}, EGasType::GasTypeCount);
+    m_data.Init({x, y, z, policy}, EGasType::GasTypeCount);
 }
 
 void AtmoPkg3D::swap()
@@ -36,3 +36,21 @@ void AtmoPkg3D::reset(float value)
         m_data[i].reset(value);
     }
 }
+
+void AtmoPkg3D::properties(const FluidProperties& value)
+{
+    for(int i = 0; i < m_data.Num(); ++i)
+    {
+        m_data[i].properties() = value;
+    }
+}
+
+SIZE_T AtmoPkg3D::allocatedSize() const
+{
+    SIZE_T size = 0;
+    for(int i = 0; i < m_data.Num(); ++i)
+    {
+        size += m_data[i].allocatedSize();
+    }
+    return size;
+}
@@ -0,0 +1,84 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#include "AtmoReplica3D.h"
+
+#include "Misc/Compression.h"
+#include "Serialization/MemoryReader.h"
+
+// Grids and payloads beyond this are taken as corrupt packets rather than allocated
+static const int32 MaxCells = 64 * 1024 * 1024;
+static const int32 MaxPayloadBytes = 64 * 1024 * 1024;
+
+int32 AtmoReplica3D::receive(const TArray<uint8>& packet)
+{
+    FMemoryReader reader(packet);
+    int32 sequence, sizeX, sizeY, sizeZ, payloadSize;
+    float quantum;
+    TArray<uint8> compressed;
+    reader << sequence << sizeX << sizeY << sizeZ << quantum << payloadSize << compressed;
+    if(reader.IsError() || sizeX <= 0 || sizeY <= 0 || sizeZ <= 0 || quantum <= 0.0f ||
+       static_cast<int64>(sizeX) * sizeY * sizeZ > MaxCells || payloadSize <= 0 || payloadSize > MaxPayloadBytes)
+    {
+        return INDEX_NONE;
+    }
+
+    TArray<uint8> payload;
+    payload.SetNumUninitialized(payloadSize);
+    if(!FCompression::UncompressMemory(
+         COMPRESS_ZLIB, payload.GetData(), payloadSize, compressed.GetData(), compressed.Num()))
+    {
+        return INDEX_NONE;
+    }
+
+    if(m_values.sizeX() != sizeX || m_values.sizeY() != sizeY || m_values.sizeZ() != sizeZ ||
+       m_values.quantum() != quantum)
+    {
+        m_values = AtmoSnapshot3D(sizeX, sizeY, sizeZ, quantum);
+        m_sequences.Init(0, m_values.numChunks());
+    }
+
+    FMemoryReader payloadReader(payload);
+    int32 chunks;
+    payloadReader << chunks;
+    const auto values = m_values.chunkValues();
+    TArray<uint16> filtered;
+    filtered.SetNumUninitialized(values);
+    for(auto i = 0; i < chunks; ++i)
+    {
+        int32 index;
+        payloadReader << index;
+        payloadReader.Serialize(filtered.GetData(), values * sizeof(uint16));
+        if(payloadReader.IsError() || index < 0 || index >= m_values.numChunks())
+        {
+            return INDEX_NONE;
+        }
+        if(m_sequences[index] >= sequence)
+        {
+            continue;
+        }
+        m_sequences[index] = sequence;
+
+        // Undo the differences to the previous cell
+        auto* chunk = m_values.chunk(index);
+        for(auto value = 0; value < values; ++value)
+        {
+            const auto previous = value >= EGasType::GasTypeCount ? chunk[value - EGasType::GasTypeCount] : 0;
+            chunk[value] = static_cast<uint16>(filtered[value] + previous);
+        }
+        m_values.touch(index);
+    }
+    return sequence;
+}
@@ -0,0 +1,205 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#include "AtmoReplicator.h"
+
+#include "Misc/Compression.h"
+#include "Serialization/MemoryWriter.h"
+
+// A chunk that was not acknowledged after this many packets is considered lost and sent again
+static const int32 ResendAfter = 8;
+// Packets older than this are forgotten, late acknowledgements for them are ignored
+static const int32 MaxInFlight = 32;
+
+AtmoReplicator::AtmoReplicator()
+  : m_threshold(0.5f)
+  , m_maxPacketBytes(16 * 1024)
+{
+}
+
+bool AtmoReplicator::buildPacket(uint32 id,
+                                 const AtmoSnapshot3D& snapshot,
+                                 const FIntVector& focus,
+                                 TArray<uint8>& packet)
+{
+    auto& client = m_clients.FindOrAdd(id);
+    if(client.acknowledged.sizeX() != snapshot.sizeX() || client.acknowledged.sizeY() != snapshot.sizeY() ||
+       client.acknowledged.sizeZ() != snapshot.sizeZ() || client.acknowledged.quantum() != snapshot.quantum())
+    {
+        resetClient(client, snapshot);
+    }
+
+    const auto sequence = client.sequence + 1;
+    const auto values = snapshot.chunkValues();
+    const auto limit = FMath::FloorToInt(m_threshold / snapshot.quantum());
+    const auto focusX = focus.X / AtmoSnapshot3D::ChunkSize;
+    const auto focusY = focus.Y / AtmoSnapshot3D::ChunkSize;
+
+    // Changed chunks ordered by distance to the focus, chunks left out before move up so none starves
+    TArray<TPair<float, int32>> candidates;
+    for(auto index = 0; index < snapshot.numChunks(); ++index)
+    {
+        if(snapshot.revision(index) == client.revisions[index])
+        {
+            continue;
+        }
+        if(client.sentSequences[index] != INDEX_NONE && sequence - client.sentSequences[index] < ResendAfter)
+        {
+            continue;
+        }
+
+        const auto* current = snapshot.chunk(index);
+        const auto* known = client.acknowledged.chunk(index);
+        auto changed = false;
+        for(auto i = 0; i < values && !changed; ++i)
+        {
+            changed = FMath::Abs(current[i] - known[i]) > limit;
+        }
+        if(!changed)
+        {
+            // Small changes add up against the acknowledged values, so only the comparison is skipped next time
+            client.revisions[index] = snapshot.revision(index);
+            continue;
+        }
+
+        const auto distance = FMath::Max(FMath::Abs(index % snapshot.chunksX() - focusX),
+                                         FMath::Abs(index / snapshot.chunksX() - focusY));
+        candidates.Emplace(static_cast<float>(distance) / (1 + client.waiting[index]), index);
+    }
+    if(candidates.Num() == 0)
+    {
+        return false;
+    }
+    candidates.Sort([](const TPair<float, int32>& a, const TPair<float, int32>& b) {
+        return a.Key < b.Key || (a.Key == b.Key && a.Value < b.Value);
+    });
+
+    const auto chunkBytes = static_cast<int32>(sizeof(int32) + values * sizeof(uint16));
+    const auto count = FMath::Clamp(m_maxPacketBytes / chunkBytes, 1, candidates.Num());
+    for(auto i = count; i < candidates.Num(); ++i)
+    {
+        ++client.waiting[candidates[i].Value];
+    }
+
+    FSentPacket sent;
+    sent.sequence = sequence;
+    sent.values.SetNumUninitialized(count * values);
+
+    // Values become differences to the previous cell, which are mostly 0 and compress well
+    TArray<uint8> payload;
+    FMemoryWriter payloadWriter(payload);
+    auto chunks = count;
+    payloadWriter << chunks;
+    TArray<uint16> filtered;
+    filtered.SetNumUninitialized(values);
+    for(auto i = 0; i < count; ++i)
+    {
+        auto index = candidates[i].Value;
+        const auto* current = snapshot.chunk(index);
+        FMemory::Memcpy(sent.values.GetData() + i * values, current, values * sizeof(uint16));
+        sent.chunks.Add(index);
+        sent.revisions.Add(snapshot.revision(index));
+        client.sentSequences[index] = sequence;
+        client.waiting[index] = 0;
+
+        for(auto value = 0; value < values; ++value)
+        {
+            const auto previous = value >= EGasType::GasTypeCount ? current[value - EGasType::GasTypeCount] : 0;
+            filtered[value] = static_cast<uint16>(current[value] - previous);
+        }
+        payloadWriter << index;
+        payloadWriter.Serialize(filtered.GetData(), values * sizeof(uint16));
+    }
+
+    auto compressedSize = FCompression::CompressMemoryBound(COMPRESS_ZLIB, payload.Num());
+    TArray<uint8> compressed;
+    compressed.SetNumUninitialized(compressedSize);
+    if(!FCompression::CompressMemory(
+         COMPRESS_ZLIB, compressed.GetData(), compressedSize, payload.GetData(), payload.Num()))
+    {
+        return false;
+    }
+    compressed.SetNum(compressedSize, false);
+
+    packet.Reset();
+    FMemoryWriter writer(packet);
+    auto sizeX = snapshot.sizeX();
+    auto sizeY = snapshot.sizeY();
+    auto sizeZ = snapshot.sizeZ();
+    auto quantum = snapshot.quantum();
+    auto payloadSize = payload.Num();
+    auto packetSequence = sequence;
+    writer << packetSequence << sizeX << sizeY << sizeZ << quantum << payloadSize << compressed;
+
+    client.sequence = sequence;
+    client.inFlight.Add(MoveTemp(sent));
+    if(client.inFlight.Num() > MaxInFlight)
+    {
+        client.inFlight.RemoveAt(0);
+    }
+    return true;
+}
+
+void AtmoReplicator::acknowledge(uint32 id, int32 sequence)
+{
+    auto* client = m_clients.Find(id);
+    if(client == nullptr)
+    {
+        return;
+    }
+    const auto packet =
+      client->inFlight.IndexOfByPredicate([sequence](const FSentPacket& sent) { return sent.sequence == sequence; });
+    if(packet == INDEX_NONE)
+    {
+        return;
+    }
+
+    const auto& sent = client->inFlight[packet];
+    const auto values = client->acknowledged.chunkValues();
+    for(auto i = 0; i < sent.chunks.Num(); ++i)
+    {
+        const auto index = sent.chunks[i];
+        if(client->sentSequences[index] == sequence)
+        {
+            client->sentSequences[index] = INDEX_NONE;
+        }
+        if(client->ackedSequences[index] >= sequence)
+        {
+            continue;
+        }
+        FMemory::Memcpy(
+          client->acknowledged.chunk(index), sent.values.GetData() + i * values, values * sizeof(uint16));
+        client->revisions[index] = sent.revisions[i];
+        client->ackedSequences[index] = sequence;
+    }
+    client->inFlight.RemoveAt(packet);
+}
+
+void AtmoReplicator::removeClient(uint32 id)
+{
+    m_clients.Remove(id);
+}
+
+void AtmoReplicator::resetClient(FClient& client, const AtmoSnapshot3D& snapshot) const
+{
+    // A new client holds zeros everywhere, just like AtmoReplica3D before the first packet
+    client.acknowledged = AtmoSnapshot3D(snapshot.sizeX(), snapshot.sizeY(), snapshot.sizeZ(), snapshot.quantum());
+    client.revisions.Init(0, snapshot.numChunks());
+    client.ackedSequences.Init(0, snapshot.numChunks());
+    client.sentSequences.Init(INDEX_NONE, snapshot.numChunks());
+    client.waiting.Init(0, snapshot.numChunks());
+    client.inFlight.Reset();
+    client.sequence = 0;
+}
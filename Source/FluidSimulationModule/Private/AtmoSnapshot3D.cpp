@@ -0,0 +1,90 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#include "AtmoSnapshot3D.h"
+
+AtmoSnapshot3D::AtmoSnapshot3D()
+  : m_quantum(1.0f)
+  , m_sizeX(0)
+  , m_sizeY(0)
+  , m_sizeZ(0)
+  , m_chunksX(0)
+  , m_chunksY(0)
+{
+}
+
+AtmoSnapshot3D::AtmoSnapshot3D(int32 xSize, int32 ySize, int32 zSize, float quantum)
+  : m_quantum(quantum)
+  , m_sizeX(xSize)
+  , m_sizeY(ySize)
+  , m_sizeZ(zSize)
+  , m_chunksX(FMath::DivideAndRoundUp(xSize, ChunkSize))
+  , m_chunksY(FMath::DivideAndRoundUp(ySize, ChunkSize))
+{
+    m_values.SetNumZeroed(numChunks() * chunkValues());
+    m_revisions.SetNumZeroed(numChunks());
+}
+
+void AtmoSnapshot3D::capture(AtmoPkg3D& pressure, const AtmoSnapshot3D* previous)
+{
+    const auto scale = 1.0f / m_quantum;
+    for(auto gas = 0; gas < EGasType::GasTypeCount; ++gas)
+    {
+        const auto& source = pressure.gas(static_cast<EGasType::Type>(gas)).source();
+        for(auto z = 0; z < m_sizeZ; ++z)
+        {
+            for(auto y = 0; y < m_sizeY; ++y)
+            {
+                for(auto x = 0; x < m_sizeX; ++x)
+                {
+                    const auto value = FMath::Clamp(FMath::RoundToInt(source.element(x, y, z) * scale), 0, 0xFFFF);
+                    m_values[chunkIndex(x, y) * chunkValues() + chunkOffset(x, y, z, EGasType::Type(gas))] =
+                      static_cast<uint16>(value);
+                }
+            }
+        }
+    }
+
+    // A chunk gets a new revision when any of its values differ from the previous capture
+    const auto sameLayout = previous != nullptr && previous->m_sizeX == m_sizeX && previous->m_sizeY == m_sizeY &&
+                            previous->m_sizeZ == m_sizeZ;
+    for(auto index = 0; index < numChunks(); ++index)
+    {
+        if(!sameLayout)
+        {
+            m_revisions[index] = 1;
+            continue;
+        }
+        const auto changed =
+          FMemory::Memcmp(chunk(index), previous->chunk(index), chunkValues() * sizeof(uint16)) != 0;
+        m_revisions[index] = previous->m_revisions[index] + (changed ? 1 : 0);
+    }
+}
+
+FAtmoStruct AtmoSnapshot3D::getPressure(int32 x, int32 y, int32 z) const
+{
+    if(x < 0 || x >= m_sizeX || y < 0 || y >= m_sizeY || z < 0 || z >= m_sizeZ)
+    {
+        return {};
+    }
+
+    const auto* values = chunk(chunkIndex(x, y));
+    FAtmoStruct atmo;
+    atmo.O2 = values[chunkOffset(x, y, z, EGasType::O2)] * m_quantum;
+    atmo.N2 = values[chunkOffset(x, y, z, EGasType::N2)] * m_quantum;
+    atmo.CO2 = values[chunkOffset(x, y, z, EGasType::CO2)] * m_quantum;
+    atmo.Toxin = values[chunkOffset(x, y, z, EGasType::Toxin)] * m_quantum;
+    return atmo;
+}
@@ -0,0 +1,126 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "AtmoSubscriptions.h"
+#include "FluidSimulation3D.h"
+#include "FluidSimulationModule.h"
+#include "Misc/ScopeLock.h"
+
+DECLARE_CYCLE_STAT(TEXT("Atmos subscriptions"), STAT_AtmosSubscriptions, STATGROUP_AtmosStats)
+
+AtmoSubscriptions::AtmoSubscriptions()
+  : m_nextHandle(0)
+  , m_pending(false)
+{
+}
+
+int32 AtmoSubscriptions::add(const FAtmoSubscription& subscription)
+{
+    FScopeLock lock(&m_lock);
+    const auto handle = m_nextHandle++;
+    m_entries.Add({handle, subscription, false});
+    m_pending = true;
+    return handle;
+}
+
+void AtmoSubscriptions::remove(int32 handle)
+{
+    FScopeLock lock(&m_lock);
+    m_entries.RemoveAll([handle](const FEntry& entry) { return entry.handle == handle; });
+}
+
+void AtmoSubscriptions::move(const FIntVector& offset)
+{
+    FScopeLock lock(&m_lock);
+    for(auto& entry : m_entries)
+    {
+        entry.subscription.min += offset;
+        entry.subscription.max += offset;
+    }
+}
+
+bool AtmoSubscriptions::hasPending() const
+{
+    FScopeLock lock(&m_lock);
+    return m_pending;
+}
+
+void AtmoSubscriptions::evaluate(FluidSimulation3D& sim)
+{
+    SCOPE_CYCLE_COUNTER(STAT_AtmosSubscriptions)
+    auto& pressure = sim.pressure();
+    const auto grid = [&](EAtmoOverlayField field) -> const Fluid3D& {
+        switch(field)
+        {
+        case EAtmoOverlayField::O2: return pressure.gas(EGasType::O2).source();
+        case EAtmoOverlayField::N2: return pressure.gas(EGasType::N2).source();
+        case EAtmoOverlayField::CO2: return pressure.gas(EGasType::CO2).source();
+        case EAtmoOverlayField::Toxin: return pressure.gas(EGasType::Toxin).source();
+        default: return sim.totalPressure();
+        }
+    };
+
+    FScopeLock lock(&m_lock);
+    m_pending = false;
+    for(auto& entry : m_entries)
+    {
+        const auto& subscription = entry.subscription;
+        const auto& values = grid(subscription.field);
+        const auto min = FIntVector(FMath::Max(subscription.min.X, 0),
+                                    FMath::Max(subscription.min.Y, 0),
+                                    FMath::Max(subscription.min.Z, 0));
+        const auto max = FIntVector(FMath::Min(subscription.max.X, values.getX() - 1),
+                                    FMath::Min(subscription.max.Y, values.getY() - 1),
+                                    FMath::Min(subscription.max.Z, values.getZ() - 1));
+        if(min.X > max.X || min.Y > max.Y || min.Z > max.Z)
+        {
+            continue;
+        }
+
+        auto sum = 0.0f;
+        for(auto z = min.Z; z <= max.Z; ++z)
+        {
+            for(auto y = min.Y; y <= max.Y; ++y)
+            {
+                for(auto x = min.X; x <= max.X; ++x)
+                {
+                    sum += values.element(x, y, z);
+                }
+            }
+        }
+        const auto value = sum / ((max.X - min.X + 1) * (max.Y - min.Y + 1) * (max.Z - min.Z + 1));
+
+        // Past the threshold triggers, the hysteresis has to be crossed back as well to clear
+        const auto below = subscription.comparison == EAtmoThresholdComparison::Below;
+        const auto triggered =
+          entry.triggered ? (below ? value <= subscription.threshold + subscription.hysteresis
+                                   : value >= subscription.threshold - subscription.hysteresis)
+                          : (below ? value < subscription.threshold : value > subscription.threshold);
+        if(triggered != entry.triggered)
+        {
+            entry.triggered = triggered;
+            m_events.Add({entry.handle, triggered, value});
+        }
+    }
+}
+
+bool AtmoSubscriptions::takeEvents(TArray<FAtmoThresholdEvent>& events)
+{
+    FScopeLock lock(&m_lock);
+    events = MoveTemp(m_events);
+    m_events.Reset();
+    return events.Num() > 0;
+}
@@ -16,7 +16,7 @@
 
 #include "Fluid3D.h"
 
-Fluid3D::Fluid3D(int32 x, int32 y, int32 z) : TArray3D(x, y, z){};
+Fluid3D::Fluid3D(int32 x, int32 y, int32 z, const FArray3DPolicy& policy) : TArray3D(x, y, z, policy){};
 
 // Distribute a value to the 8 grid points surrounding the floating point coordinates
 // x,y,z must be 1 less than their associated max values (dimensions of array)
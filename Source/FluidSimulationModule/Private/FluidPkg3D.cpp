@@ -18,7 +18,10 @@
 
 FluidPkg3D::FluidPkg3D() : m_sourceBuffer(0) {}
 
-FluidPkg3D::FluidPkg3D(int32 x, int32 y, int32 z) : m_data{{x, y, z}, {x, y, z}}, m_sourceBuffer(0) {}
+FluidPkg3D::FluidPkg3D(int32 x, int32 y, int32 z, const FArray3DPolicy& policy)
+  : m_data{{x, y, z, policy}, {x, y, z, policy}}, m_sourceBuffer(0)
+{
+}
 
 void FluidPkg3D::swap()
 {
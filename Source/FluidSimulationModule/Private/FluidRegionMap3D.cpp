@@ -0,0 +1,177 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "FluidRegionMap3D.h"
+
+FluidRegionMap3D::FluidRegionMap3D()
+  : m_regionsX(0)
+  , m_coarseRegions(0)
+  , m_inactiveRegions(0)
+  , m_activeCoarseRegions(0)
+  , m_tick(0)
+  , m_sizeX(0)
+  , m_sizeY(0)
+  , m_sizeZ(0)
+{
+}
+
+FluidRegionMap3D::FluidRegionMap3D(int32 xSize, int32 ySize, int32 zSize)
+  : m_regionsX(FMath::DivideAndRoundUp(xSize, RegionSize))
+  , m_coarseRegions(0)
+  , m_inactiveRegions(0)
+  , m_activeCoarseRegions(0)
+  , m_tick(0)
+  , m_sizeX(xSize)
+  , m_sizeY(ySize)
+  , m_sizeZ(zSize)
+{
+    const auto count = m_regionsX * FMath::DivideAndRoundUp(ySize, RegionSize);
+    m_detail.Init(ERegionDetail::Full, count);
+    m_period.Init(1, count);
+    m_pendingPeriod.Init(1, count);
+    m_active.Init(true, count);
+}
+
+void FluidRegionMap3D::updateDetail(const TArray<FIntVector>& focus, int32 radius)
+{
+    for(auto region = 0; region < m_detail.Num(); ++region)
+    {
+        auto& detail = m_detail[region];
+        if(radius <= 0)
+        {
+            detail = ERegionDetail::Full;
+            continue;
+        }
+
+        const auto regionDistance = distance(region, focus);
+        if(regionDistance <= radius)
+        {
+            detail = ERegionDetail::Full;
+        }
+        else if(regionDistance > radius + RegionSize)
+        {
+            detail = ERegionDetail::Coarse;
+        }
+    }
+    updateCounts();
+}
+
+void FluidRegionMap3D::updateSchedule(const TArray<FIntVector>& focus, int32 radius)
+{
+    for(auto region = 0; region < m_detail.Num(); ++region)
+    {
+        auto period = 1;
+        if(radius > 0)
+        {
+            // 1 within radius, 2 within 2 * radius, 4 within 4 * radius
+            const auto regionDistance = distance(region, focus);
+            while(period < MaxPeriod && regionDistance > radius * period)
+            {
+                period *= 2;
+            }
+        }
+        m_pendingPeriod[region] = period;
+    }
+}
+
+void FluidRegionMap3D::endTick()
+{
+    // Every period has just been updated, so the schedule can change without skipping or repeating time
+    if(isDue(MaxPeriod))
+    {
+        m_period = m_pendingPeriod;
+    }
+    m_tick = (m_tick + 1) % MaxPeriod;
+}
+
+bool FluidRegionMap3D::beginPass(int32 period)
+{
+    if(!isDue(period))
+    {
+        return false;
+    }
+    auto any = false;
+    for(auto region = 0; region < m_detail.Num(); ++region)
+    {
+        m_active[region] = m_period[region] == period;
+        any |= m_active[region];
+    }
+    updateCounts();
+    return any;
+}
+
+void FluidRegionMap3D::endPass()
+{
+    for(auto region = 0; region < m_active.Num(); ++region)
+    {
+        m_active[region] = true;
+    }
+    updateCounts();
+}
+
+int32 FluidRegionMap3D::simulatedCells() const
+{
+    auto result = 0;
+    for(auto region = 0; region < m_detail.Num(); ++region)
+    {
+        if(m_active[region] && m_detail[region] == ERegionDetail::Full)
+        {
+            int32 x0, y0, x1, y1;
+            bounds(region, x0, y0, x1, y1);
+            result += (x1 - x0) * (y1 - y0) * m_sizeZ;
+        }
+    }
+    return result;
+}
+
+int32 FluidRegionMap3D::regionsWithPeriod(int32 period) const
+{
+    auto result = 0;
+    for(const auto value : m_period)
+    {
+        result += value == period ? 1 : 0;
+    }
+    return result;
+}
+
+int32 FluidRegionMap3D::distance(int32 region, const TArray<FIntVector>& focus) const
+{
+    int32 x0, y0, x1, y1;
+    bounds(region, x0, y0, x1, y1);
+
+    auto result = MAX_int32;
+    for(const auto& point : focus)
+    {
+        const auto dx = FMath::Max3(x0 - point.X, point.X - (x1 - 1), 0);
+        const auto dy = FMath::Max3(y0 - point.Y, point.Y - (y1 - 1), 0);
+        result = FMath::Min(result, FMath::Max(dx, dy));
+    }
+    return result;
+}
+
+void FluidRegionMap3D::updateCounts()
+{
+    m_coarseRegions = 0;
+    m_inactiveRegions = 0;
+    m_activeCoarseRegions = 0;
+    for(auto region = 0; region < m_detail.Num(); ++region)
+    {
+        const auto coarse = m_detail[region] == ERegionDetail::Coarse;
+        m_coarseRegions += coarse ? 1 : 0;
+        m_inactiveRegions += m_active[region] ? 0 : 1;
+        m_activeCoarseRegions += coarse && m_active[region] ? 1 : 0;
+    }
+}
@@ -26,6 +26,27 @@
 #include "FluidSimulation3D.h"
 #include "FluidSimulationModule.h"
 
+#if WITH_ATMOS_ISPC
+#include "FluidKernels_ispc.h"
+
+namespace
+{
+// Describes the storage of a linear layout grid to the ISPC kernels
+template <typename T>
+ispc::Grid ispcGrid(const TArray3D<T>& grid)
+{
+    ispc::Grid result;
+    result.sizeX = grid.getX();
+    result.sizeY = grid.getY();
+    result.sizeZ = grid.getZ();
+    result.origin = grid.index(0, 0, 0);
+    result.rowPitch = grid.rowPitch();
+    result.slicePitch = grid.slicePitch();
+    return result;
+}
+} // namespace
+#endif
+
 DECLARE_CYCLE_STAT(TEXT("Fluid simulation update"), STAT_AtmosphericsUpdate, STATGROUP_AtmosStats)
 DECLARE_CYCLE_STAT(TEXT("Fluid simulation update: diffusion"), STAT_UpdateDiffusion, STATGROUP_AtmosStats)
 DECLARE_CYCLE_STAT(TEXT("Fluid simulation update: forces"), STAT_UpdateForces, STATGROUP_AtmosStats)
@@ -33,20 +54,54 @@ DECLARE_CYCLE_STAT(TEXT("Fluid simulation update: advection"), STAT_UpdateAdvect
 DECLARE_CYCLE_STAT(TEXT("Stable diffusion"), STAT_StableDiffusion, STATGROUP_AtmosStats)
 DECLARE_CYCLE_STAT(TEXT("Transfer pressure"), STAT_TransferPressure, STATGROUP_AtmosStats)
 DECLARE_CYCLE_STAT(TEXT("Check blocked solids"), STAT_CheckBlocked, STATGROUP_AtmosStats)
-
-FluidSimulation3D::FluidSimulation3D(int32 xSize, int32 ySize, int32 zSize, float dt)
-  : m_solids(xSize - 1, ySize - 1, zSize - 1)
-  , m_curl(xSize, ySize, zSize)
-  , m_velocity(xSize, ySize, zSize)
-  , m_pressure(xSize, ySize, zSize)
+DECLARE_CYCLE_STAT(TEXT("Coarse diffusion"), STAT_CoarseDiffusion, STATGROUP_AtmosStats)
+DECLARE_CYCLE_STAT(TEXT("Venting"), STAT_Venting, STATGROUP_AtmosStats)
+DECLARE_CYCLE_STAT(TEXT("Total pressure"), STAT_TotalPressure, STATGROUP_AtmosStats)
+DECLARE_DWORD_COUNTER_STAT(TEXT("Atmos breach zones"), STAT_AtmosBreachZones, STATGROUP_AtmosStats)
+DECLARE_DWORD_COUNTER_STAT(TEXT("Atmos coarse regions"), STAT_AtmosCoarseRegions, STATGROUP_AtmosStats)
+DECLARE_DWORD_COUNTER_STAT(TEXT("Atmos cells updated"), STAT_AtmosCellsUpdated, STATGROUP_AtmosStats)
+DECLARE_DWORD_COUNTER_STAT(TEXT("Atmos regions every tick"), STAT_AtmosRegionsPeriod1, STATGROUP_AtmosStats)
+DECLARE_DWORD_COUNTER_STAT(TEXT("Atmos regions every 2nd tick"), STAT_AtmosRegionsPeriod2, STATGROUP_AtmosStats)
+DECLARE_DWORD_COUNTER_STAT(TEXT("Atmos regions every 4th tick"), STAT_AtmosRegionsPeriod4, STATGROUP_AtmosStats)
+DECLARE_DWORD_COUNTER_STAT(TEXT("Atmos regions every 8th tick"), STAT_AtmosRegionsPeriod8, STATGROUP_AtmosStats)
+
+FluidSimulation3D::FluidSimulation3D(int32 xSize, int32 ySize, int32 zSize, float dt, const FArray3DPolicy& policy)
+  : m_solids(xSize - 1, ySize - 1, zSize - 1, policy)
+  , m_curl(xSize, ySize, zSize, policy)
+  , m_totalPressure(xSize, ySize, zSize, policy)
+  , m_totalPressureValid(false)
+  , m_velocity(xSize, ySize, zSize, policy)
+  , m_pressure(xSize, ySize, zSize, policy)
   , m_diffusionIter(1)
   , m_vorticity(0.0)
   , m_pressureAccel(0.0)
   , m_dt(dt)
+  , m_maxVelocity(0.0f)
+  , m_advectionScheme(EAdvectionScheme::Conservative)
+  , m_parallelAdvection(false)
+  , m_ispcKernels(false)
+  , m_deterministic(false)
+  , m_diffusionBlocking(true)
+  , m_detailRadius(0)
+  , m_scheduleRadius(0)
+  , m_coarseFactor(0)
+  , m_maxBreachZone(4096)
+  , m_ventRate(1.0f)
+  , m_vented(0.0f)
+  , m_maxPressureDelta(0.0f)
+  , m_steadyVelocity(0.01f)
+  , m_steadyPressure(0.01f)
+  , m_steadyTicks(30)
+  , m_quietTicks(0)
+  , m_peakTransientBytes(0)
   , m_sizeX(xSize)
   , m_sizeY(ySize)
   , m_sizeZ(zSize)
 {
+    m_regions = FluidRegionMap3D(xSize, ySize, zSize);
+    coarseFactor(2);
+    m_passTime.Init(0.0f, FluidRegionMap3D::Periods);
+    diffusionBlocking(true);
     reset();
 }
 
@@ -55,9 +110,571 @@ FluidSimulation3D::FluidSimulation3D(int32 xSize, int32 ySize, int32 zSize, floa
 void FluidSimulation3D::update()
 {
     SCOPE_CYCLE_COUNTER(STAT_AtmosphericsUpdate)
-    updateDiffusion();
-    updateForces();
-    updateAdvection();
+    if(m_regions.coarseRegions() > 0)
+    {
+        classifyCoarseBlocks();
+    }
+
+    // Regions updated every period ticks run together, over the time that passed since their last update
+    const auto dt = m_dt;
+    m_maxPressureDelta = 0.0f;
+    if(!m_totalPressureValid)
+    {
+        updateTotalPressure(false);
+    }
+    // Passes which catch up on several ticks split their time into steps no longer than a tick or the stable step
+    const auto maxStep = FMath::Max(dt, stableTimeStep(1.0f));
+    auto cells = 0;
+    for(auto pass = 0; pass < FluidRegionMap3D::Periods; ++pass)
+    {
+        const auto period = 1 << pass;
+        m_passTime[pass] += dt;
+        if(!m_regions.isDue(period))
+        {
+            continue;
+        }
+        const auto passTime = m_passTime[pass];
+        m_passTime[pass] = 0.0f;
+        if(!m_regions.beginPass(period))
+        {
+            continue;
+        }
+
+        const auto steps = FMath::Max(FMath::CeilToInt(passTime / maxStep), 1);
+        m_dt = passTime / steps;
+        for(auto step = 0; step < steps; ++step)
+        {
+            updateDiffusion();
+            updateForces();
+            updateAdvection();
+            updateVacuum();
+            updateTotalPressure(true);
+            cells += m_regions.simulatedCells();
+        }
+    }
+    m_regions.endPass();
+    m_regions.endTick();
+    m_dt = dt;
+
+    updateMaxVelocity();
+    if(m_maxVelocity <= m_steadyVelocity && m_maxPressureDelta <= m_steadyPressure)
+    {
+        m_quietTicks = FMath::Min(m_quietTicks + 1, m_steadyTicks);
+    }
+    else
+    {
+        m_quietTicks = 0;
+    }
+
+    SET_DWORD_STAT(STAT_AtmosCellsUpdated, cells);
+    SET_DWORD_STAT(STAT_AtmosRegionsPeriod1, m_regions.regionsWithPeriod(1));
+    SET_DWORD_STAT(STAT_AtmosRegionsPeriod2, m_regions.regionsWithPeriod(2));
+    SET_DWORD_STAT(STAT_AtmosRegionsPeriod4, m_regions.regionsWithPeriod(4));
+    SET_DWORD_STAT(STAT_AtmosRegionsPeriod8, m_regions.regionsWithPeriod(8));
+}
+
+void FluidSimulation3D::focus(const TArray<FIntVector>& points)
+{
+    m_regions.updateDetail(points, m_detailRadius);
+    m_regions.updateSchedule(points, m_scheduleRadius);
+    SET_DWORD_STAT(STAT_AtmosCoarseRegions, m_regions.coarseRegions());
+}
+
+void FluidSimulation3D::breach(int32 x, int32 y, int32 z, EFlowDirection face)
+{
+    if(x < 1 || y < 1 || z < 1 || x >= m_sizeX - 1 || y >= m_sizeY - 1 || z >= m_sizeZ - 1)
+    {
+        return;
+    }
+    auto& flags = m_solids.element(x, y, z);
+    flags &= ~face;
+    flags |= vacuumFace(face);
+    m_breaches.AddUnique(FIntVector(x, y, z));
+    updateBreachZones();
+    wake();
+}
+
+void FluidSimulation3D::seal(int32 x, int32 y, int32 z, EFlowDirection face)
+{
+    if(x < 1 || y < 1 || z < 1 || x >= m_sizeX - 1 || y >= m_sizeY - 1 || z >= m_sizeZ - 1)
+    {
+        return;
+    }
+    auto& flags = m_solids.element(x, y, z);
+    flags |= face;
+    flags &= ~vacuumFace(face);
+    updateBreachZones();
+    wake();
+}
+
+void FluidSimulation3D::vacuum(int32 x, int32 y, int32 z, bool value)
+{
+    if(x < 1 || y < 1 || z < 1 || x >= m_sizeX - 1 || y >= m_sizeY - 1 || z >= m_sizeZ - 1)
+    {
+        return;
+    }
+
+    // Every neighbour gets a vacuum face towards the cell
+    const auto mark = [&](int32 nx, int32 ny, int32 nz, EFlowDirection towards) {
+        if(nx < 1 || ny < 1 || nz < 1 || nx >= m_sizeX - 1 || ny >= m_sizeY - 1 || nz >= m_sizeZ - 1)
+        {
+            return;
+        }
+        auto& flags = m_solids.element(nx, ny, nz);
+        if(value)
+        {
+            flags |= vacuumFace(towards);
+            m_breaches.AddUnique(FIntVector(nx, ny, nz));
+        }
+        else
+        {
+            flags &= ~vacuumFace(towards);
+        }
+    };
+
+    auto& flags = m_solids.element(x, y, z);
+    flags = value ? flags | EFlowDirection::Vacuum : flags & ~EFlowDirection::Vacuum;
+    if(value)
+    {
+        // Whatever the cell held is lost to space at once
+        for(auto gas = 0; gas < EGasType::GasTypeCount; ++gas)
+        {
+            auto& cell = m_pressure.gas(static_cast<EGasType::Type>(gas)).source().element(x, y, z);
+            m_vented += cell;
+            cell = 0.0f;
+        }
+    }
+    mark(x + 1, y, z, EFlowDirection::XMinus);
+    mark(x - 1, y, z, EFlowDirection::XPlus);
+    mark(x, y + 1, z, EFlowDirection::YMinus);
+    mark(x, y - 1, z, EFlowDirection::YPlus);
+    mark(x, y, z + 1, EFlowDirection::ZMinus);
+    mark(x, y, z - 1, EFlowDirection::ZPlus);
+    updateBreachZones();
+    wake();
+}
+
+float FluidSimulation3D::addGas(int32 x, int32 y, int32 z, EGasType::Type type, float amount)
+{
+    if(x < 1 || y < 1 || z < 1 || x >= m_sizeX - 1 || y >= m_sizeY - 1 || z >= m_sizeZ - 1)
+    {
+        return 0.0f;
+    }
+    auto& cell = m_pressure.gas(type).source().element(x, y, z);
+    const auto before = cell;
+    cell = FMath::Max(cell + amount, 0.0f);
+    gasWritten(x, y, z);
+    return cell - before;
+}
+
+void FluidSimulation3D::distributeGas(const FVector& point, EGasType::Type type, float amount)
+{
+    // The 8 cells around the point stay inside the grid, the ones on the border get no share
+    const auto x = FMath::Clamp(point.X, 1.0f, m_sizeX - 2.0f);
+    const auto y = FMath::Clamp(point.Y, 1.0f, m_sizeY - 2.0f);
+    const auto z = FMath::Clamp(point.Z, 1.0f, m_sizeZ - 2.0f);
+    auto& grid = m_pressure.gas(type).source();
+    grid.distributeFloatingPoint(x, y, z, amount);
+    // Cells with less gas than their share give up what they have
+    const auto ix = FMath::FloorToInt(x);
+    const auto iy = FMath::FloorToInt(y);
+    const auto iz = FMath::FloorToInt(z);
+    for(auto k = iz; k <= iz + 1; ++k)
+    {
+        for(auto j = iy; j <= iy + 1; ++j)
+        {
+            for(auto i = ix; i <= ix + 1; ++i)
+            {
+                if(amount < 0.0f)
+                {
+                    grid.element(i, j, k) = FMath::Max(grid.element(i, j, k), 0.0f);
+                }
+                gasWritten(i, j, k);
+            }
+        }
+    }
+}
+
+void FluidSimulation3D::distributeGas(const FIntVector& min, const FIntVector& max, EGasType::Type type, float amount)
+{
+    const FIntVector from(FMath::Max(min.X, 1), FMath::Max(min.Y, 1), FMath::Max(min.Z, 1));
+    const FIntVector to(FMath::Min(max.X, m_sizeX - 2), FMath::Min(max.Y, m_sizeY - 2), FMath::Min(max.Z, m_sizeZ - 2));
+    if(to.X < from.X || to.Y < from.Y || to.Z < from.Z)
+    {
+        return;
+    }
+    const auto share = amount / ((to.X - from.X + 1) * (to.Y - from.Y + 1) * (to.Z - from.Z + 1));
+    auto& grid = m_pressure.gas(type).source();
+    for(auto z = from.Z; z <= to.Z; ++z)
+    {
+        for(auto y = from.Y; y <= to.Y; ++y)
+        {
+            for(auto x = from.X; x <= to.X; ++x)
+            {
+                auto& cell = grid.element(x, y, z);
+                cell = FMath::Max(cell + share, 0.0f);
+                gasWritten(x, y, z);
+            }
+        }
+    }
+}
+
+void FluidSimulation3D::gasWritten(int32 x, int32 y, int32 z)
+{
+    keepAwake();
+    if(m_totalPressureValid)
+    {
+        m_totalPressure.element(x, y, z) = m_pressure.oxigen().source().element(x, y, z) +
+                                           m_pressure.nitrogen().source().element(x, y, z) +
+                                           m_pressure.carbonDioxide().source().element(x, y, z) +
+                                           m_pressure.toxin().source().element(x, y, z);
+    }
+}
+
+void FluidSimulation3D::reactions(const TArray<FAtmoReaction>& value)
+{
+    m_reactions = value;
+    wake();
+}
+
+void FluidSimulation3D::updateBreachZones()
+{
+    const auto& grid = m_pressure.oxigen().source();
+    m_breaches.RemoveAll([this](const FIntVector& cell) { return ventFaces(cell.X, cell.Y, cell.Z) == 0; });
+    m_breachZones.Reset();
+    m_breachCells.Reset();
+
+    // Flood the room behind every breach, a zone that grows too large is open to most of the station and vents
+    // through its faces only
+    for(const auto& breachCell : m_breaches)
+    {
+        if(m_breachCells.Contains(grid.index(breachCell.X, breachCell.Y, breachCell.Z)))
+        {
+            continue;
+        }
+
+        FBreachZone zone;
+        zone.ventFaces = 0;
+        TSet<int32> visited;
+        TArray<FIntVector> queue;
+        queue.Add(breachCell);
+        visited.Add(grid.index(breachCell.X, breachCell.Y, breachCell.Z));
+        for(auto next = 0; next < queue.Num() && zone.cells.Num() <= m_maxBreachZone; ++next)
+        {
+            const auto cell = queue[next];
+            zone.cells.Add(grid.index(cell.X, cell.Y, cell.Z));
+            zone.ventFaces += ventFaces(cell.X, cell.Y, cell.Z);
+
+            const auto flood = [&](int32 nx, int32 ny, int32 nz, EFlowDirection dir) {
+                if(!isBlocked(cell.X, cell.Y, cell.Z, dir) && !isBlocked(nx, ny, nz, EFlowDirection::Self) &&
+                   !visited.Contains(grid.index(nx, ny, nz)))
+                {
+                    visited.Add(grid.index(nx, ny, nz));
+                    queue.Add(FIntVector(nx, ny, nz));
+                }
+            };
+            flood(cell.X + 1, cell.Y, cell.Z, EFlowDirection::XPlus);
+            flood(cell.X - 1, cell.Y, cell.Z, EFlowDirection::XMinus);
+            flood(cell.X, cell.Y + 1, cell.Z, EFlowDirection::YPlus);
+            flood(cell.X, cell.Y - 1, cell.Z, EFlowDirection::YMinus);
+            flood(cell.X, cell.Y, cell.Z + 1, EFlowDirection::ZPlus);
+            flood(cell.X, cell.Y, cell.Z - 1, EFlowDirection::ZMinus);
+        }
+
+        if(zone.cells.Num() <= m_maxBreachZone)
+        {
+            m_breachCells.Append(zone.cells);
+            m_breachZones.Add(MoveTemp(zone));
+        }
+    }
+    SET_DWORD_STAT(STAT_AtmosBreachZones, m_breachZones.Num());
+}
+
+void FluidSimulation3D::coarseFactor(int32 value)
+{
+    // Blocks must not straddle regions
+    check(FluidRegionMap3D::RegionSize % value == 0);
+    m_coarseFactor = value;
+
+    const auto x = FMath::DivideAndRoundUp(m_sizeX, value);
+    const auto y = FMath::DivideAndRoundUp(m_sizeY, value);
+    const auto z = FMath::DivideAndRoundUp(m_sizeZ, value);
+
+    // Unpadded, so that one index addresses all of the coarse arrays
+    const FArray3DPolicy policy(0, false);
+    m_coarseCells = TArray3D<float>(x, y, z, 0.0f, policy);
+    m_coarseFaces = TArray3D<FVector>(x, y, z, FVector::ZeroVector, policy);
+    m_coarseMass = TArray3D<float>(x, y, z, policy);
+    m_coarseFlux = TArray3D<float>(x, y, z, policy);
+}
+
+template <typename TFunc>
+void FluidSimulation3D::forEachSimulatedCell(const Fluid3D& grid, TFunc&& func) const
+{
+    // Storage order is the fastest when every region is at full detail
+    if(m_regions.isUniform())
+    {
+        grid.forEachCell(func, 1);
+        return;
+    }
+    m_regions.forEachSimulatedCell(func, 1, 1);
+}
+
+template <typename TFunc>
+void FluidSimulation3D::forEachScatterCell(const Fluid3D& grid, TFunc&& func) const
+{
+    if(!m_parallelAdvection && !m_deterministic)
+    {
+        forEachSimulatedCell(grid, func);
+        return;
+    }
+
+    // Slabs of the same round are ScatterSlabRows apart, so their writes never reach the same row. Within a slab
+    // cells run in the serial order. The slabs do not depend on the number of workers, so a row always sums its
+    // contributions in the same order and running them on one thread gives the same result
+    const auto uniform = m_regions.isUniform();
+    const auto slabs = FMath::DivideAndRoundUp(m_sizeY - 2, ScatterSlabRows);
+    for(auto round = 0; round < 2; ++round)
+    {
+        const auto runSlab = [&](int32 task) {
+            const auto y0 = 1 + (task * 2 + round) * ScatterSlabRows;
+            const auto y1 = FMath::Min(y0 + ScatterSlabRows, m_sizeY - 1);
+            for(auto z = 1; z < m_sizeZ - 1; ++z)
+            {
+                for(auto y = y0; y < y1; ++y)
+                {
+                    for(auto x = 1; x < m_sizeX - 1; ++x)
+                    {
+                        if(uniform || m_regions.isSimulated(x, y))
+                        {
+                            func(x, y, z);
+                        }
+                    }
+                }
+            }
+        };
+        ParallelFor((slabs - round + 1) / 2, runSlab, !m_parallelAdvection);
+    }
+}
+
+bool FluidSimulation3D::useIspc() const
+{
+#if WITH_ATMOS_ISPC
+    return m_ispcKernels && !m_deterministic && m_regions.isUniform() &&
+           m_curl.policy().layout == EArray3DLayout::Linear;
+#else
+    return false;
+#endif
+}
+
+void FluidSimulation3D::advectionScheme(EAdvectionScheme value)
+{
+    m_advectionScheme = value;
+    if(m_advectionScheme == EAdvectionScheme::MacCormack)
+    {
+        m_advectionScratch = Fluid3D(m_sizeX, m_sizeY, m_sizeZ, m_curl.policy());
+    }
+    else
+    {
+        m_advectionScratch = Fluid3D();
+    }
+}
+
+float FluidSimulation3D::stableTimeStep(float cfl) const
+{
+    auto result = MAX_flt;
+
+    // Every diffusion iteration is explicit and stays stable while dt * diffusion / iterations <= 1/6
+    auto advection = m_velocity.properties().advection;
+    const auto limitDiffusion = [&](const FluidProperties& properties) {
+        if(properties.diffusion > SMALL_NUMBER)
+        {
+            result = FMath::Min(result, diffusionIterationsOf(properties) / (6.0f * properties.diffusion));
+        }
+    };
+    limitDiffusion(m_velocity.properties());
+    for(auto gas = 0; gas < EGasType::GasTypeCount; ++gas)
+    {
+        const auto& properties = m_pressure.gas(static_cast<EGasType::Type>(gas)).properties();
+        advection = FMath::Max(advection, properties.advection);
+        limitDiffusion(properties);
+    }
+
+    // Advection moves a cell by velocity * dt * advection scale
+    const auto speed = m_maxVelocity * advection * advectionScale();
+    if(speed > SMALL_NUMBER)
+    {
+        result = FMath::Min(result, cfl / speed);
+    }
+    return result;
+}
+
+void FluidSimulation3D::updateMaxVelocity()
+{
+    const auto& vx = m_velocity.sourceX();
+    const auto& vy = m_velocity.sourceY();
+    const auto& vz = m_velocity.sourceZ();
+
+    auto result = 0.0f;
+    const auto count = vx.num();
+    for(auto i = 0; i < count; ++i)
+    {
+        result = FMath::Max(result, FMath::Max3(FMath::Abs(vx[i]), FMath::Abs(vy[i]), FMath::Abs(vz[i])));
+    }
+    m_maxVelocity = result;
+}
+
+TArray<FluidSimulation3D::FReactionTerm> FluidSimulation3D::reactionTerms() const
+{
+    TArray<FReactionTerm> terms;
+    for(const auto& reaction : m_reactions)
+    {
+        if(reaction.Reactant >= EGasType::GasTypeCount || reaction.Rate <= 0.0f)
+        {
+            continue;
+        }
+        FReactionTerm term;
+        term.reactant = reaction.Reactant.GetValue();
+        term.coreactant = FMath::Min<int32>(reaction.Coreactant.GetValue(), EGasType::GasTypeCount);
+        if(term.coreactant == term.reactant)
+        {
+            term.coreactant = EGasType::GasTypeCount;
+        }
+        // A negative threshold would use up more than the cell holds
+        term.threshold = FMath::Max(reaction.Threshold, 0.0f);
+        // Exact solution of the first order reaction, so it is stable for any time step
+        term.fraction = 1.0f - FMath::Exp(-reaction.Rate * m_dt);
+        term.ratio = FMath::Max(reaction.Ratio, 0.0f);
+        term.inverseRatio = term.ratio > SMALL_NUMBER ? 1.0f / term.ratio : MAX_flt;
+        term.products[EGasType::O2] = reaction.Products.O2;
+        term.products[EGasType::N2] = reaction.Products.N2;
+        term.products[EGasType::CO2] = reaction.Products.CO2;
+        term.products[EGasType::Toxin] = reaction.Products.Toxin;
+        terms.Add(term);
+    }
+    return terms;
+}
+
+void FluidSimulation3D::updateTotalPressure(bool react)
+{
+    SCOPE_CYCLE_COUNTER(STAT_TotalPressure)
+    auto& o2 = m_pressure.oxigen().source();
+    auto& n2 = m_pressure.nitrogen().source();
+    auto& co2 = m_pressure.carbonDioxide().source();
+    auto& toxin = m_pressure.toxin().source();
+    Fluid3D* const gases[EGasType::GasTypeCount] = {&o2, &n2, &co2, &toxin};
+    const auto terms = react ? reactionTerms() : TArray<FReactionTerm>();
+
+    const auto sumCell = [&](int32 index) {
+        m_totalPressure[index] = o2[index] + n2[index] + co2[index] + toxin[index];
+    };
+    // Reacts where the reactant is above the threshold, then sums. The gases are written in place, a cell only
+    // reads its own values
+    auto reacted = 0.0f;
+    const auto reactCell = [&](int32 index) {
+        for(const auto& term : terms)
+        {
+            auto& reactant = (*gases[term.reactant])[index];
+            auto amount = (reactant - term.threshold) * term.fraction;
+            if(term.coreactant != EGasType::GasTypeCount)
+            {
+                amount = FMath::Min(amount, (*gases[term.coreactant])[index] * term.inverseRatio);
+            }
+            if(amount <= 0.0f)
+            {
+                continue;
+            }
+            reactant -= amount;
+            if(term.coreactant != EGasType::GasTypeCount)
+            {
+                (*gases[term.coreactant])[index] -= amount * term.ratio;
+            }
+            for(auto gas = 0; gas < EGasType::GasTypeCount; ++gas)
+            {
+                (*gases[gas])[index] += amount * term.products[gas];
+            }
+            reacted = FMath::Max(reacted, amount);
+        }
+        sumCell(index);
+    };
+
+    if(!m_totalPressureValid || m_regions.isUniform())
+    {
+        const auto count = m_totalPressure.num();
+        if(terms.Num() == 0)
+        {
+            for(auto i = 0; i < count; ++i)
+            {
+                sumCell(i);
+            }
+        }
+#if WITH_ATMOS_ISPC
+        else if(useIspc())
+        {
+            static_assert(sizeof(FReactionTerm) == sizeof(ispc::Reaction), "Reaction layouts differ");
+            reacted = ispc::reactAndSum(&o2[0],
+                                        &n2[0],
+                                        &co2[0],
+                                        &toxin[0],
+                                        &m_totalPressure[0],
+                                        count,
+                                        reinterpret_cast<const ispc::Reaction*>(terms.GetData()),
+                                        terms.Num());
+        }
+#endif
+        else
+        {
+            for(auto i = 0; i < count; ++i)
+            {
+                reactCell(i);
+            }
+        }
+        m_totalPressureValid = true;
+        m_maxPressureDelta = FMath::Max(m_maxPressureDelta, reacted);
+        return;
+    }
+
+    // Only the active regions and the borders diffusion reaches into have changed. Border cells react with the
+    // pass of their own region
+    const auto updateCell = [&](int32 x, int32 y, int32 z) {
+        const auto index = m_totalPressure.index(x, y, z);
+        if(terms.Num() > 0)
+        {
+            reactCell(index);
+        }
+        else
+        {
+            sumCell(index);
+        }
+    };
+    m_regions.forEachSimulatedCell(updateCell, 0, 0);
+    m_regions.forEachBorderCell([&](int32 x, int32 y, int32 z) { sumCell(m_totalPressure.index(x, y, z)); });
+    if(m_regions.activeCoarseRegions() > 0)
+    {
+        // Coarse diffusion averages the blocks of every coarse region once any of them is due, but only the ones
+        // due in this pass react, over the time since their own last update
+        m_regions.forEachRegion(ERegionDetail::Coarse, [&](int32 x0, int32 y0, int32 x1, int32 y1) {
+            const auto active = m_regions.isActive(x0, y0);
+            for(auto z = 0; z < m_sizeZ; ++z)
+            {
+                for(auto y = y0; y < y1; ++y)
+                {
+                    for(auto x = x0; x < x1; ++x)
+                    {
+                        if(active)
+                        {
+                            updateCell(x, y, z);
+                        }
+                        else
+                        {
+                            sumCell(m_totalPressure.index(x, y, z));
+                        }
+                    }
+                }
+            }
+        });
+    }
+    m_maxPressureDelta = FMath::Max(m_maxPressureDelta, reacted);
 }
 
 // Apply diffusion across the grids
@@ -68,28 +685,51 @@ void FluidSimulation3D::updateDiffusion()
     // Diffusion of Velocity
     if(!FMath::IsNearlyZero(m_velocity.properties().diffusion))
     {
-        const auto scaledVelocity = m_velocity.properties().diffusion / static_cast<float>(m_diffusionIter);
+        const auto iterations = diffusionIterationsOf(m_velocity.properties());
+        const auto scaledVelocity = m_velocity.properties().diffusion / static_cast<float>(iterations);
 
-        for(auto i = 0; i < m_diffusionIter; ++i)
+        for(auto i = 0; i < iterations;)
         {
-            diffusionStable(m_velocity.sourceX(), m_velocity.destinationX(), scaledVelocity);
-            diffusionStable(m_velocity.sourceY(), m_velocity.destinationY(), scaledVelocity);
-            diffusionStable(m_velocity.sourceZ(), m_velocity.destinationZ(), scaledVelocity);
+            const auto steps = diffusionDepth(iterations - i);
+            diffuse(m_velocity.sourceX(), m_velocity.destinationX(), scaledVelocity, steps);
+            diffuse(m_velocity.sourceY(), m_velocity.destinationY(), scaledVelocity, steps);
+            diffuse(m_velocity.sourceZ(), m_velocity.destinationZ(), scaledVelocity, steps);
             m_velocity.swap();
+            i += steps;
         }
     }
 
-    // Diffusion of Pressure
-    if(!FMath::IsNearlyZero(m_pressure.properties().diffusion))
+    // Diffusion of every gas, at its own rate and over its own number of iterations
+    const auto coarse = m_regions.activeCoarseRegions() > 0;
+    for(auto type = 0; type < EGasType::GasTypeCount; ++type)
     {
-        const auto scale = m_pressure.properties().diffusion / static_cast<float>(m_diffusionIter);
-        for(auto i = 0; i < m_diffusionIter; ++i)
+        auto& gas = m_pressure.gas(static_cast<EGasType::Type>(type));
+        const auto diffusion = gas.properties().diffusion;
+        if(FMath::IsNearlyZero(diffusion))
         {
-            diffusionStable(m_pressure.oxigen().source(), m_pressure.oxigen().destination(), scale);
-            diffusionStable(m_pressure.nitrogen().source(), m_pressure.nitrogen().destination(), scale);
-            diffusionStable(m_pressure.carbonDioxide().source(), m_pressure.carbonDioxide().destination(), scale);
-            diffusionStable(m_pressure.toxin().source(), m_pressure.toxin().destination(), scale);
-            m_pressure.swap();
+            continue;
+        }
+        const auto iterations = diffusionIterationsOf(gas.properties());
+        const auto scale = diffusion / static_cast<float>(iterations);
+
+        // Coarse blocks take a single step per update on a grid with cells coarseFactor times larger
+        const auto coarseForce = FMath::Min(m_dt * diffusion / (m_coarseFactor * m_coarseFactor), 1.0f / 6.0f);
+
+        // The changes of the last iteration tell if the pressure is still settling
+        for(auto i = 0; i < iterations;)
+        {
+            const auto steps = diffusionDepth(iterations - i);
+            i += steps;
+            auto change = diffuse(gas.source(), gas.destination(), scale, steps);
+            if(i == iterations)
+            {
+                if(coarse)
+                {
+                    change = FMath::Max(change, coarseDiffusion(gas.destination(), coarseForce));
+                }
+                m_maxPressureDelta = FMath::Max(m_maxPressureDelta, change);
+            }
+            gas.swap();
         }
     }
 }
@@ -98,81 +738,264 @@ void FluidSimulation3D::updateDiffusion()
 void FluidSimulation3D::updateForces()
 {
     SCOPE_CYCLE_COUNTER(STAT_UpdateForces)
-    // Apply dampening force on velocity due to viscosity
-    if(!FMath::IsNearlyZero(m_velocity.properties().decay))
+    const auto decay = m_velocity.properties().decay;
+    if(FMath::IsNearlyZero(decay) && FMath::IsNearlyZero(m_pressureAccel) && FMath::IsNearlyZero(m_vorticity))
     {
-        exponentialDecay(m_velocity.destinationX(), m_velocity.properties().decay);
-        exponentialDecay(m_velocity.destinationY(), m_velocity.properties().decay);
-        exponentialDecay(m_velocity.destinationZ(), m_velocity.properties().decay);
-        m_velocity.swap();
+        return;
     }
 
-    // Apply equilibrium force on pressure for mass conservation
-    if(!FMath::IsNearlyZero(m_pressureAccel))
-    {
-        pressureAcceleration(m_pressureAccel);
-    }
+    // Dampening force on velocity due to viscosity, and equilibrium force on pressure for mass conservation
+    accelerate(FMath::IsNearlyZero(decay) ? 1.0f : FMath::Pow(1.0f - decay, m_dt),
+               FMath::IsNearlyZero(m_pressureAccel) ? 0.0f : m_dt * m_pressureAccel);
 
     // Apply curl force on vorticies to prevent artificial dampening
     if(!FMath::IsNearlyZero(m_vorticity))
     {
         vorticityConfinement(m_vorticity);
     }
+    m_velocity.swap();
 }
 
 // Apply advection across the grids
 void FluidSimulation3D::updateAdvection()
 {
     SCOPE_CYCLE_COUNTER(STAT_UpdateAdvection)
+    const auto scale = advectionScale();
+    const auto velocityScale = m_velocity.properties().advection * scale;
+    const auto gasScale = [scale](const FluidPkg3D& gas) { return gas.properties().advection * scale; };
+
+    // Advection order makes significant differences
+    // Advecting pressure first leads to self-maintaining waves and ripple
+    // artifacts Advecting velocity first naturally dissipates the waves
+
+    if(m_advectionScheme == EAdvectionScheme::MacCormack)
+    {
+        // Velocity traces along itself, so every component reads the unmodified source
+        macCormackAdvection(m_velocity.sourceX(), m_velocity.destinationX(), velocityScale);
+        macCormackAdvection(m_velocity.sourceY(), m_velocity.destinationY(), velocityScale);
+        macCormackAdvection(m_velocity.sourceZ(), m_velocity.destinationZ(), velocityScale);
+        m_velocity.swap();
+
+        // Semi-Lagrangian sampling ignores the divergence of the flow, so gases get their mass restored
+        const auto advectGas = [&](FluidPkg3D& gas) {
+            macCormackAdvection(gas.source(), gas.destination(), gasScale(gas));
+            restoreMass(gas.source(), gas.destination());
+        };
+        advectGas(m_pressure.oxigen());
+        advectGas(m_pressure.nitrogen());
+        advectGas(m_pressure.carbonDioxide());
+        advectGas(m_pressure.toxin());
+        m_pressure.swap();
+        return;
+    }
+
+    // Advect Velocity
+    forwardAdvection(m_velocity.sourceX(), m_velocity.destinationX(), velocityScale);
+    forwardAdvection(m_velocity.sourceY(), m_velocity.destinationY(), velocityScale);
+    forwardAdvection(m_velocity.sourceZ(), m_velocity.destinationZ(), velocityScale);
+
+    reverseSignedAdvection(m_velocity, velocityScale);
+
+    // Advect Pressure. Represents compressible fluid
+    for(auto type = 0; type < EGasType::GasTypeCount; ++type)
+    {
+        auto& gas = m_pressure.gas(static_cast<EGasType::Type>(type));
+        forwardAdvection(gas.source(), gas.destination(), gasScale(gas));
+        gas.swap();
+        reverseAdvection(gas.source(), gas.destination(), gasScale(gas));
+        gas.swap();
+    }
+}
+
+FAtmosMemoryUsage FluidSimulation3D::memoryUsage() const
+{
+    FAtmosMemoryUsage usage;
+    usage.solids = m_solids.allocatedSize();
+    usage.velocity = m_velocity.allocatedSize();
+    usage.gases = m_pressure.allocatedSize();
+    usage.curl = m_curl.allocatedSize();
+    usage.totalPressure = m_totalPressure.allocatedSize();
+    usage.advectionScratch = m_advectionScratch.allocatedSize();
+    usage.diffusionScratch = m_diffusionPlanes.GetAllocatedSize();
+    usage.levelOfDetail = m_coarseCells.allocatedSize() + m_coarseFaces.allocatedSize() +
+                          m_coarseMass.allocatedSize() + m_coarseFlux.allocatedSize();
+    usage.peakTransient = m_peakTransientBytes;
+    return usage;
+}
+
+FAtmosMemoryUsage FluidSimulation3D::estimateMemory(int32 xSize,
+                                                    int32 ySize,
+                                                    int32 zSize,
+                                                    const FArray3DPolicy& policy,
+                                                    EAdvectionScheme scheme,
+                                                    int32 coarseFactor)
+{
+    const auto grid = TArray3D<float>::storageSize(xSize, ySize, zSize, policy);
+    const auto coarseX = FMath::DivideAndRoundUp(xSize, coarseFactor);
+    const auto coarseY = FMath::DivideAndRoundUp(ySize, coarseFactor);
+    const auto coarseZ = FMath::DivideAndRoundUp(zSize, coarseFactor);
+    const FArray3DPolicy coarsePolicy(0, false);
+
+    FAtmosMemoryUsage usage;
+    usage.solids = TArray3D<EFlowDirection>::storageSize(xSize - 1, ySize - 1, zSize - 1, policy);
+    usage.velocity = 2 * 3 * grid;
+    usage.gases = 2 * EGasType::GasTypeCount * grid;
+    usage.curl = grid;
+    usage.totalPressure = grid;
+    usage.levelOfDetail = 3 * TArray3D<float>::storageSize(coarseX, coarseY, coarseZ, coarsePolicy) +
+                          TArray3D<FVector>::storageSize(coarseX, coarseY, coarseZ, coarsePolicy);
+    if(scheme == EAdvectionScheme::MacCormack)
+    {
+        usage.advectionScratch = grid;
+    }
+    else
+    {
+        // See reverseAdvection()
+        usage.peakTransient = 3 * TArray3D<int32>::storageSize(xSize, ySize, zSize, policy) + 9 * grid;
+    }
+    usage.diffusionScratch = diffusionPlanesSize(xSize, ySize, maxDiffusionDepth(xSize, ySize));
+    return usage;
+}
+
+float FluidSimulation3D::advectionScale() const
+{
     const auto avgDimension = (m_sizeX + m_sizeY + m_sizeZ) / 3.0f;
     const auto stdDimension = 100.0f;
 
     // Change advection scale depending on grid size. Smaller grids means larger
     // cells, so scale should be smaller. Average dimension size of std_dimension
     // value (100) equals an advection_scale of 1
-    const auto advectionScale = avgDimension / stdDimension;
+    return avgDimension / stdDimension;
+}
 
-    // Advection order makes significant differences
-    // Advecting pressure first leads to self-maintaining waves and ripple
-    // artifacts Advecting velocity first naturally dissipates the waves
+bool FluidSimulation3D::traceCell(
+  int32 x, int32 y, int32 z, float force, float& newX, float& newY, float& newZ) const
+{
+    const auto vx = m_velocity.sourceX().element(x, y, z);
+    const auto vy = m_velocity.sourceY().element(x, y, z);
+    const auto vz = m_velocity.sourceZ().element(x, y, z);
+    if(FMath::IsNearlyZero(vx) && FMath::IsNearlyZero(vy) && FMath::IsNearlyZero(vz))
+    {
+        return false;
+    }
 
-    // Advect Velocity
-    forwardAdvection(
-      m_velocity.sourceX(), m_velocity.destinationX(), m_velocity.properties().advection * advectionScale);
-    forwardAdvection(
-      m_velocity.sourceY(), m_velocity.destinationY(), m_velocity.properties().advection * advectionScale);
-    forwardAdvection(
-      m_velocity.sourceZ(), m_velocity.destinationZ(), m_velocity.properties().advection * advectionScale);
+    newX = x + vx * force;
+    newY = y + vy * force;
+    newZ = z + vz * force;
 
-    reverseSignedAdvection(m_velocity, m_velocity.properties().advection * advectionScale);
+    // Check for and correct boundary collisions
+    collide(x, y, z, newX, newY, newZ);
+    return true;
+}
 
-    // Advect Pressure. Represents compressible fluid
-    forwardAdvection(m_pressure.oxigen().source(),
-                     m_pressure.oxigen().destination(),
-                     m_pressure.properties().advection * advectionScale);
-    forwardAdvection(m_pressure.nitrogen().source(),
-                     m_pressure.nitrogen().destination(),
-                     m_pressure.properties().advection * advectionScale);
-    forwardAdvection(m_pressure.carbonDioxide().source(),
-                     m_pressure.carbonDioxide().destination(),
-                     m_pressure.properties().advection * advectionScale);
-    forwardAdvection(m_pressure.toxin().source(),
-                     m_pressure.toxin().destination(),
-                     m_pressure.properties().advection * advectionScale);
-    m_pressure.swap();
-    reverseAdvection(m_pressure.oxigen().source(),
-                     m_pressure.oxigen().destination(),
-                     m_pressure.properties().advection * advectionScale);
-    reverseAdvection(m_pressure.nitrogen().source(),
-                     m_pressure.nitrogen().destination(),
-                     m_pressure.properties().advection * advectionScale);
-    reverseAdvection(m_pressure.carbonDioxide().source(),
-                     m_pressure.carbonDioxide().destination(),
-                     m_pressure.properties().advection * advectionScale);
-    reverseAdvection(m_pressure.toxin().source(),
-                     m_pressure.toxin().destination(),
-                     m_pressure.properties().advection * advectionScale);
-    m_pressure.swap();
+void FluidSimulation3D::semiLagrangianAdvection(const Fluid3D& in, Fluid3D& out, float force) const
+{
+    out = in;
+
+#if WITH_ATMOS_ISPC
+    if(useIspc())
+    {
+        const auto grid = ispcGrid(in);
+        const auto solids = ispcGrid(m_solids);
+        ispc::semiLagrangian(&in[0],
+                             &out[0],
+                             &m_velocity.sourceX()[0],
+                             &m_velocity.sourceY()[0],
+                             &m_velocity.sourceZ()[0],
+                             reinterpret_cast<const uint32*>(&m_solids[0]),
+                             &grid,
+                             &solids,
+                             force);
+        return;
+    }
+#endif
+
+    // Each cell only writes itself, so the order of cells does not matter
+    const auto advectCell = [&](int32 x, int32 y, int32 z) {
+        float x1, y1, z1;
+        // Trace backwards: the value arriving here left from (x1, y1, z1)
+        if(!traceCell(x, y, z, -force, x1, y1, z1))
+        {
+            return;
+        }
+
+        const auto x1A = FMath::FloorToInt(x1);
+        const auto y1A = FMath::FloorToInt(y1);
+        const auto z1A = FMath::FloorToInt(z1);
+        const auto fx1 = x1 - x1A;
+        const auto fy1 = y1 - y1A;
+        const auto fz1 = z1 - z1A;
+
+        // Trilinear interpolation of the 8 cells around the traced point
+        out.element(x, y, z) = (1.0f - fz1) * ((1.0f - fy1) * ((1.0f - fx1) * in.element(x1A, y1A, z1A) +
+                                                               fx1 * in.element(x1A + 1, y1A, z1A)) +
+                                               fy1 * ((1.0f - fx1) * in.element(x1A, y1A + 1, z1A) +
+                                                      fx1 * in.element(x1A + 1, y1A + 1, z1A))) +
+                               fz1 * ((1.0f - fy1) * ((1.0f - fx1) * in.element(x1A, y1A, z1A + 1) +
+                                                      fx1 * in.element(x1A + 1, y1A, z1A + 1)) +
+                                      fy1 * ((1.0f - fx1) * in.element(x1A, y1A + 1, z1A + 1) +
+                                             fx1 * in.element(x1A + 1, y1A + 1, z1A + 1)));
+    };
+    forEachSimulatedCell(in, advectCell);
+}
+
+void FluidSimulation3D::macCormackAdvection(const Fluid3D& in, Fluid3D& out, float scale)
+{
+    const auto force = m_dt * scale; // distance to advect
+
+    if(FMath::IsNearlyZero(force))
+    {
+        out = in;
+        return;
+    }
+
+    // Predict forwards in time, then advect the prediction back to estimate the error of a round trip
+    semiLagrangianAdvection(in, out, force);
+    semiLagrangianAdvection(out, m_advectionScratch, -force);
+
+    const auto correctCell = [&](int32 x, int32 y, int32 z) {
+        float x1, y1, z1;
+        if(!traceCell(x, y, z, -force, x1, y1, z1))
+        {
+            return;
+        }
+
+        const auto x1A = FMath::FloorToInt(x1);
+        const auto y1A = FMath::FloorToInt(y1);
+        const auto z1A = FMath::FloorToInt(z1);
+
+        // Limit the corrected value to the range it was interpolated from, which prevents new extrema
+        auto minValue = in.element(x1A, y1A, z1A);
+        auto maxValue = minValue;
+        for(auto corner = 1; corner < 8; ++corner)
+        {
+            const auto value = in.element(x1A + (corner & 1), y1A + ((corner >> 1) & 1), z1A + ((corner >> 2) & 1));
+            minValue = FMath::Min(minValue, value);
+            maxValue = FMath::Max(maxValue, value);
+        }
+
+        auto& value = out.element(x, y, z);
+        const auto error = in.element(x, y, z) - m_advectionScratch.element(x, y, z);
+        value = FMath::Clamp(value + 0.5f * error, minValue, maxValue);
+    };
+    forEachSimulatedCell(in, correctCell);
+}
+
+void FluidSimulation3D::restoreMass(const Fluid3D& in, Fluid3D& out) const
+{
+    auto before = 0.0;
+    auto after = 0.0;
+    const auto count = in.num();
+    for(auto i = 0; i < count; ++i)
+    {
+        before += in[i];
+        after += out[i];
+    }
+
+    if(after > SMALL_NUMBER)
+    {
+        out *= static_cast<float>(before / after);
+    }
 }
 
 void FluidSimulation3D::forwardAdvection(const Fluid3D& in, Fluid3D& out, float scale) const
@@ -199,72 +1022,69 @@ void FluidSimulation3D::forwardAdvection(const Fluid3D& in, Fluid3D& out, float
         return;
     }
 
-    // This can easily be threaded as the input array is independent from the
-    // output array
-    for(auto x = 1; x < m_sizeX - 1; ++x)
-    {
-        for(auto y = 1; y < m_sizeY - 1; ++y)
+    // Every cell scatters into its neighbours, see forEachScatterCell for how it is threaded
+    const auto advectCell = [&](int32 x, int32 y, int32 z) {
+        const auto vx = m_velocity.sourceX().element(x, y, z);
+        const auto vy = m_velocity.sourceY().element(x, y, z);
+        const auto vz = m_velocity.sourceZ().element(x, y, z);
+        if(!FMath::IsNearlyZero(vx) || !FMath::IsNearlyZero(vy) || !FMath::IsNearlyZero(vz))
         {
-            for(auto z = 1; z < m_sizeZ - 1; ++z)
-            {
-                const auto vx = m_velocity.sourceX().element(x, y, z);
-                const auto vy = m_velocity.sourceY().element(x, y, z);
-                const auto vz = m_velocity.sourceZ().element(x, y, z);
-                if(!FMath::IsNearlyZero(vx) || !FMath::IsNearlyZero(vy) || !FMath::IsNearlyZero(vz))
-                {
-                    // Find the floating point location of the forward advection
-                    auto x1 = x + vx * force;
-                    auto y1 = y + vy * force;
-                    auto z1 = z + vz * force;
-
-                    // Check for and correct boundary collisions
-                    collide(x, y, z, x1, y1, z1);
-
-                    // Find the nearest top-left integer grid point of the advection
-                    const auto x1A = FMath::FloorToInt(x1);
-                    const auto y1A = FMath::FloorToInt(y1);
-                    const auto z1A = FMath::FloorToInt(z1);
-
-                    // Store the fractional parts
-                    const auto fx1 = x1 - x1A;
-                    const auto fy1 = y1 - y1A;
-                    const auto fz1 = z1 - z1A;
-
-                    // The floating point location after forward advection (x1,y1,z1) will
-                    // land within an 8 point cube (A,B,C,D,E,F,G,H). Distribute the value
-                    // of the source point among the destination grid points using
-                    // bilinear interoplation. Subtract the total value given to the
-                    // destination grid points from the source point.
-
-                    // Pull source value from the unmodified p_in
-                    const auto sourceValue = in.element(x, y, z);
-
-                    // Bilinear interpolation
-                    auto A = (1.0f - fz1) * (1.0f - fy1) * (1.0f - fx1) * sourceValue;
-                    auto B = (1.0f - fz1) * (1.0f - fy1) * fx1 * sourceValue;
-                    auto C = (1.0f - fz1) * fy1 * (1.0f - fx1) * sourceValue;
-                    auto D = (1.0f - fz1) * fy1 * fx1 * sourceValue;
-                    auto E = fz1 * (1.0f - fy1) * (1.0f - fx1) * sourceValue;
-                    auto F = fz1 * (1.0f - fy1) * fx1 * sourceValue;
-                    auto G = fz1 * fy1 * (1.0f - fx1) * sourceValue;
-                    auto H = fz1 * fy1 * fx1 * sourceValue;
-
-                    // Add A,B,C,D,E,F,G,H to the eight destination cells
-                    out.element(x1A, y1A, z1A) += A;
-                    out.element(x1A + 1, y1A, z1A) += B;
-                    out.element(x1A, y1A + 1, z1A) += C;
-                    out.element(x1A + 1, y1A + 1, z1A) += D;
-                    out.element(x1A, y1A, z1A + 1) += E;
-                    out.element(x1A + 1, y1A, z1A + 1) += F;
-                    out.element(x1A, y1A + 1, z1A + 1) += G;
-                    out.element(x1A + 1, y1A + 1, z1A + 1) += H;
-
-                    // Subtract A-H from source for mass conservation
-                    out.element(x, y, z) -= A + B + C + D + E + F + G + H;
-                }
-            }
+            // Find the floating point location of the forward advection
+            auto x1 = x + vx * force;
+            auto y1 = y + vy * force;
+            auto z1 = z + vz * force;
+
+            // Check for and correct boundary collisions
+            collide(x, y, z, x1, y1, z1);
+
+            // Find the nearest top-left integer grid point of the advection
+            const auto x1A = FMath::FloorToInt(x1);
+            const auto y1A = FMath::FloorToInt(y1);
+            const auto z1A = FMath::FloorToInt(z1);
+
+            // Store the fractional parts
+            const auto fx1 = x1 - x1A;
+            const auto fy1 = y1 - y1A;
+            const auto fz1 = z1 - z1A;
+
+            // The floating point location after forward advection (x1,y1,z1) will
+            // land within an 8 point cube (A,B,C,D,E,F,G,H). Distribute the value
+            // of the source point among the destination grid points using
+            // bilinear interoplation. Subtract the total value given to the
+            // destination grid points from the source point.
+
+            // Pull source value from the unmodified p_in
+            const auto sourceValue = in.element(x, y, z);
+
+            // Bilinear interpolation. Shares of walls and of cells behind a blocked face stay in the source
+            const auto open = openTargets(x, y, z, x1A, y1A, z1A);
+            const auto share = [open, sourceValue](int32 corner, float weight) {
+                return (open & (1u << corner)) != 0 ? weight * sourceValue : 0.0f;
+            };
+            auto A = share(0, (1.0f - fz1) * (1.0f - fy1) * (1.0f - fx1));
+            auto B = share(1, (1.0f - fz1) * (1.0f - fy1) * fx1);
+            auto C = share(2, (1.0f - fz1) * fy1 * (1.0f - fx1));
+            auto D = share(3, (1.0f - fz1) * fy1 * fx1);
+            auto E = share(4, fz1 * (1.0f - fy1) * (1.0f - fx1));
+            auto F = share(5, fz1 * (1.0f - fy1) * fx1);
+            auto G = share(6, fz1 * fy1 * (1.0f - fx1));
+            auto H = share(7, fz1 * fy1 * fx1);
+
+            // Add A,B,C,D,E,F,G,H to the eight destination cells
+            out.element(x1A, y1A, z1A) += A;
+            out.element(x1A + 1, y1A, z1A) += B;
+            out.element(x1A, y1A + 1, z1A) += C;
+            out.element(x1A + 1, y1A + 1, z1A) += D;
+            out.element(x1A, y1A, z1A + 1) += E;
+            out.element(x1A + 1, y1A, z1A + 1) += F;
+            out.element(x1A, y1A + 1, z1A + 1) += G;
+            out.element(x1A + 1, y1A + 1, z1A + 1) += H;
+
+            // Subtract A-H from source for mass conservation
+            out.element(x, y, z) -= A + B + C + D + E + F + G + H;
         }
-    }
+    };
+    forEachScatterCell(in, advectCell);
 }
 
 void FluidSimulation3D::reverseAdvection(const Fluid3D& in, Fluid3D& out, float scale) const
@@ -292,243 +1112,237 @@ void FluidSimulation3D::reverseAdvection(const Fluid3D& in, Fluid3D& out, float
     // we need to zero out the fractions
     // The new X coordinate after advection stored in x,y,z where x,y,z,z is the
     // original source point
-    TArray3D<int32> FromSource_xA(m_sizeX, m_sizeY, m_sizeZ, -1.f);
+    TArray3D<int32> FromSource_xA(m_sizeX, m_sizeY, m_sizeZ, -1, in.policy());
     // The new Y coordinate after advection stored in x,y,z where x,y,z is the
     // original source point
-    TArray3D<int32> FromSource_yA(m_sizeX, m_sizeY, m_sizeZ, -1.f);
+    TArray3D<int32> FromSource_yA(m_sizeX, m_sizeY, m_sizeZ, -1, in.policy());
     // The new Z coordinate after advection stored in x,y,z where x,y,z is the
     // original source point
-    TArray3D<int32> FromSource_zA(m_sizeX, m_sizeY, m_sizeZ, -1.f);
+    TArray3D<int32> FromSource_zA(m_sizeX, m_sizeY, m_sizeZ, -1, in.policy());
     // The value of A after advection stored in x,y,z where x,y,z is the original
     // source point
-    TArray3D<float> FromSource_A(m_sizeX, m_sizeY, m_sizeZ);
+    TArray3D<float> FromSource_A(m_sizeX, m_sizeY, m_sizeZ, in.policy());
     // The value of B after advection stored in x,y,z where x,y,z is the original
     // source point
-    TArray3D<float> FromSource_B(m_sizeX, m_sizeY, m_sizeZ);
+    TArray3D<float> FromSource_B(m_sizeX, m_sizeY, m_sizeZ, in.policy());
     // The value of C after advection stored in x,y,z where x,y,z is the original
     // source point
-    TArray3D<float> FromSource_C(m_sizeX, m_sizeY, m_sizeZ);
+    TArray3D<float> FromSource_C(m_sizeX, m_sizeY, m_sizeZ, in.policy());
     // The value of D after advection stored in x,y,z where x,y,z is the original
     // source point
-    TArray3D<float> FromSource_D(m_sizeX, m_sizeY, m_sizeZ);
+    TArray3D<float> FromSource_D(m_sizeX, m_sizeY, m_sizeZ, in.policy());
     // The value of E after advection stored in x,y,z where x,y,z is the original
     // source point
-    TArray3D<float> FromSource_E(m_sizeX, m_sizeY, m_sizeZ);
+    TArray3D<float> FromSource_E(m_sizeX, m_sizeY, m_sizeZ, in.policy());
     // The value of F after advection stored in x,y,z where x,y,z is the original
     // source point
-    TArray3D<float> FromSource_F(m_sizeX, m_sizeY, m_sizeZ);
+    TArray3D<float> FromSource_F(m_sizeX, m_sizeY, m_sizeZ, in.policy());
     // The value of G after advection stored in x,y,z where x,y,z is the original
     // source point
-    TArray3D<float> FromSource_G(m_sizeX, m_sizeY, m_sizeZ);
+    TArray3D<float> FromSource_G(m_sizeX, m_sizeY, m_sizeZ, in.policy());
     // The value of H after advection stored in x,y,z where x,y,z is the original
     // source point
-    TArray3D<float> FromSource_H(m_sizeX, m_sizeY, m_sizeZ);
+    TArray3D<float> FromSource_H(m_sizeX, m_sizeY, m_sizeZ, in.policy());
     // The total accumulated value after advection stored in x,y,z where x,y,z is
     // the destination point
-    TArray3D<float> TotalDestValue(m_sizeX, m_sizeY, m_sizeZ);
+    TArray3D<float> TotalDestValue(m_sizeX, m_sizeY, m_sizeZ, in.policy());
+    m_peakTransientBytes =
+      FMath::Max(m_peakTransientBytes, 3 * FromSource_xA.allocatedSize() + 9 * TotalDestValue.allocatedSize());
 
     // This can easily be threaded as the input array is independent from the
     // output array
-    for(auto x = 1; x < m_sizeX - 1; ++x)
-    {
-        for(auto y = 1; y < m_sizeY - 1; ++y)
+    const auto advectCell = [&](int32 x, int32 y, int32 z) {
+        const auto vx = m_velocity.sourceX().element(x, y, z);
+        const auto vy = m_velocity.sourceY().element(x, y, z);
+        const auto vz = m_velocity.sourceZ().element(x, y, z);
+        if(!FMath::IsNearlyZero(vx) || !FMath::IsNearlyZero(vy) || !FMath::IsNearlyZero(vz))
         {
-            for(auto z = 1; z < m_sizeZ - 1; ++z)
-            {
-                const auto vx = m_velocity.sourceX().element(x, y, z);
-                const auto vy = m_velocity.sourceY().element(x, y, z);
-                const auto vz = m_velocity.sourceZ().element(x, y, z);
-                if(!FMath::IsNearlyZero(vx) || !FMath::IsNearlyZero(vy) || !FMath::IsNearlyZero(vz))
-                {
-                    // Find the floating point location of the advection
-                    auto x1 = x + vx * force;
-                    auto y1 = y + vy * force;
-                    auto z1 = z + vz * force;
-
-                    // Check for and correct boundary collisions
-                    collide(x, y, z, x1, y1, z1);
-
-                    // Find the nearest top-left integer grid point of the advection
-                    x1A = FMath::FloorToInt(x1);
-                    y1A = FMath::FloorToInt(y1);
-                    z1A = FMath::FloorToInt(z1);
-
-                    // Store the fractional parts
-                    const auto fx1 = x1 - x1A;
-                    const auto fy1 = y1 - y1A;
-                    const auto fz1 = z1 - z1A;
-
-                    /*
-                    A_________B
-                    |\        |\
-                    | \E______|_\F
-                    |  |      |  |
-                    |  |      |  |
-                    C--|------D  |
-                     \ |       \ |
-                      \|G_______\H
-
-
-                    From Mick West:
-                    By adding the source value into the destination, we handle the problem
-                    of multiple destinations but by subtracting it from the source we
-                    gloss over the problem of multiple sources. Suppose multiple
-                    destinations have the same (partial) source cells, then what happens
-                    is the first dest that is processed will get all of that source cell
-                    (or all of the fraction it needs).  Subsequent dest cells will get a
-                    reduced fraction.  In extreme cases this will lead to holes forming
-                    based on the update order.
-
-                    Solution:  Maintain an array for dest cells, and source cells.
-                    For dest cells, store the eight source cells and the eight fractions
-                    For source cells, store the number of dest cells that source from
-                    here, and the total fraction E.G.  Dest cells A, B, C all source from
-                    cell D (and explicit others XYZ, which we don't need to store) So,
-                    dest cells store A->D(0.1)XYZ..., B->D(0.5)XYZ.... C->D(0.7)XYZ...
-                    Source Cell D is updated with A, B then C
-                    Update A:   Dests = 1, Tot = 0.1
-                    Update B:   Dests = 2, Tot = 0.6
-                    Update C:   Dests = 3, Tot = 1.3
-
-                    How much should go to each of A, B and C? They are asking for a total
-                    of 1.3, so should they get it all, or should they just get 0.4333 in
-                    total? Ad Hoc answer: if total <=1 then they get what they ask for if
-                    total >1 then is is divided between them proportionally. If there were
-                    two at 1.0, they would get 0.5 each If there were two at 0.5, they
-                    would get 0.5 each If there were two at 0.1, they would get 0.1 each
-                    If there were one at 0.6 and one at 0.8, they would get 0.6/1.4 and
-                    0.8/1.4  (0.429 and 0.571) each
-
-                    So in our example, total is 1.3,
-                    A gets 0.1/1.3, B gets 0.6/1.3 C gets 0.7/1.3, all totalling 1.0
-
-                    */
-                    // Bilinear interpolation
-                    A = (1.0f - fz1) * (1.0f - fy1) * (1.0f - fx1);
-                    B = (1.0f - fz1) * (1.0f - fy1) * fx1;
-                    C = (1.0f - fz1) * fy1 * (1.0f - fx1);
-                    D = (1.0f - fz1) * fy1 * fx1;
-                    E = fz1 * (1.0f - fy1) * (1.0f - fx1);
-                    F = fz1 * (1.0f - fy1) * fx1;
-                    G = fz1 * fy1 * (1.0f - fx1);
-                    H = fz1 * fy1 * fx1;
-
-                    // Store the coordinates of destination point A for this source point
-                    // (x,y,z)
-                    FromSource_xA.element(x, y, z) = x1A;
-                    FromSource_yA.element(x, y, z) = y1A;
-                    FromSource_zA.element(x, y, z) = z1A;
-
-                    // Store the values of A,B,C,D,E,F,G,H for this source point
-                    FromSource_A.element(x, y, z) = A;
-                    FromSource_B.element(x, y, z) = B;
-                    FromSource_C.element(x, y, z) = C;
-                    FromSource_D.element(x, y, z) = D;
-                    FromSource_E.element(x, y, z) = E;
-                    FromSource_F.element(x, y, z) = F;
-                    FromSource_G.element(x, y, z) = G;
-                    FromSource_H.element(x, y, z) = H;
-
-                    // Accumullting the total value for the four destinations
-                    TotalDestValue.element(x1A, y1A, z1A) += A;
-                    TotalDestValue.element(x1A + 1, y1A, z1A) += B;
-                    TotalDestValue.element(x1A, y1A + 1, z1A) += C;
-                    TotalDestValue.element(x1A + 1, y1A + 1, z1A) += D;
-                    TotalDestValue.element(x1A, y1A, z1A + 1) += E;
-                    TotalDestValue.element(x1A + 1, y1A, z1A + 1) += F;
-                    TotalDestValue.element(x1A, y1A + 1, z1A + 1) += G;
-                    TotalDestValue.element(x1A + 1, y1A + 1, z1A + 1) += H;
-                }
-            }
+            // Find the floating point location of the advection
+            auto x1 = x + vx * force;
+            auto y1 = y + vy * force;
+            auto z1 = z + vz * force;
+
+            // Check for and correct boundary collisions
+            collide(x, y, z, x1, y1, z1);
+
+            // Find the nearest top-left integer grid point of the advection
+            x1A = FMath::FloorToInt(x1);
+            y1A = FMath::FloorToInt(y1);
+            z1A = FMath::FloorToInt(z1);
+
+            // Store the fractional parts
+            const auto fx1 = x1 - x1A;
+            const auto fy1 = y1 - y1A;
+            const auto fz1 = z1 - z1A;
+
+            /*
+            A_________B
+            |\        |\
+            | \E______|_\F
+            |  |      |  |
+            |  |      |  |
+            C--|------D  |
+             \ |       \ |
+              \|G_______\H
+
+
+            From Mick West:
+            By adding the source value into the destination, we handle the problem
+            of multiple destinations but by subtracting it from the source we
+            gloss over the problem of multiple sources. Suppose multiple
+            destinations have the same (partial) source cells, then what happens
+            is the first dest that is processed will get all of that source cell
+            (or all of the fraction it needs).  Subsequent dest cells will get a
+            reduced fraction.  In extreme cases this will lead to holes forming
+            based on the update order.
+
+            Solution:  Maintain an array for dest cells, and source cells.
+            For dest cells, store the eight source cells and the eight fractions
+            For source cells, store the number of dest cells that source from
+            here, and the total fraction E.G.  Dest cells A, B, C all source from
+            cell D (and explicit others XYZ, which we don't need to store) So,
+            dest cells store A->D(0.1)XYZ..., B->D(0.5)XYZ.... C->D(0.7)XYZ...
+            Source Cell D is updated with A, B then C
+            Update A:   Dests = 1, Tot = 0.1
+            Update B:   Dests = 2, Tot = 0.6
+            Update C:   Dests = 3, Tot = 1.3
+
+            How much should go to each of A, B and C? They are asking for a total
+            of 1.3, so should they get it all, or should they just get 0.4333 in
+            total? Ad Hoc answer: if total <=1 then they get what they ask for if
+            total >1 then is is divided between them proportionally. If there were
+            two at 1.0, they would get 0.5 each If there were two at 0.5, they
+            would get 0.5 each If there were two at 0.1, they would get 0.1 each
+            If there were one at 0.6 and one at 0.8, they would get 0.6/1.4 and
+            0.8/1.4  (0.429 and 0.571) each
+
+            So in our example, total is 1.3,
+            A gets 0.1/1.3, B gets 0.6/1.3 C gets 0.7/1.3, all totalling 1.0
+
+            */
+            // Bilinear interpolation. Nothing is taken from walls or from behind a blocked face
+            const auto open = openTargets(x, y, z, x1A, y1A, z1A);
+            const auto share = [open](int32 corner, float weight) {
+                return (open & (1u << corner)) != 0 ? weight : 0.0f;
+            };
+            A = share(0, (1.0f - fz1) * (1.0f - fy1) * (1.0f - fx1));
+            B = share(1, (1.0f - fz1) * (1.0f - fy1) * fx1);
+            C = share(2, (1.0f - fz1) * fy1 * (1.0f - fx1));
+            D = share(3, (1.0f - fz1) * fy1 * fx1);
+            E = share(4, fz1 * (1.0f - fy1) * (1.0f - fx1));
+            F = share(5, fz1 * (1.0f - fy1) * fx1);
+            G = share(6, fz1 * fy1 * (1.0f - fx1));
+            H = share(7, fz1 * fy1 * fx1);
+
+            // Store the coordinates of destination point A for this source point
+            // (x,y,z)
+            FromSource_xA.element(x, y, z) = x1A;
+            FromSource_yA.element(x, y, z) = y1A;
+            FromSource_zA.element(x, y, z) = z1A;
+
+            // Store the values of A,B,C,D,E,F,G,H for this source point
+            FromSource_A.element(x, y, z) = A;
+            FromSource_B.element(x, y, z) = B;
+            FromSource_C.element(x, y, z) = C;
+            FromSource_D.element(x, y, z) = D;
+            FromSource_E.element(x, y, z) = E;
+            FromSource_F.element(x, y, z) = F;
+            FromSource_G.element(x, y, z) = G;
+            FromSource_H.element(x, y, z) = H;
+
+            // Accumullting the total value for the four destinations
+            TotalDestValue.element(x1A, y1A, z1A) += A;
+            TotalDestValue.element(x1A + 1, y1A, z1A) += B;
+            TotalDestValue.element(x1A, y1A + 1, z1A) += C;
+            TotalDestValue.element(x1A + 1, y1A + 1, z1A) += D;
+            TotalDestValue.element(x1A, y1A, z1A + 1) += E;
+            TotalDestValue.element(x1A + 1, y1A, z1A + 1) += F;
+            TotalDestValue.element(x1A, y1A + 1, z1A + 1) += G;
+            TotalDestValue.element(x1A + 1, y1A + 1, z1A + 1) += H;
         }
-    }
+    };
+    forEachSimulatedCell(in, advectCell);
 
-    for(auto y = 1; y < m_sizeY - 1; ++y)
-    {
-        for(auto x = 1; x < m_sizeX - 1; ++x)
+    const auto transferCell = [&](int32 x, int32 y, int32 z) {
+        if(FromSource_xA.element(x, y, z) != -1.f)
         {
-            for(auto z = 1; z < m_sizeZ - 1; ++z)
-            {
-                if(FromSource_xA.element(x, y, z) != -1.f)
-                {
-                    // Get the coordinates of A
-                    x1A = FromSource_xA.element(x, y, z);
-                    y1A = FromSource_yA.element(x, y, z);
-                    z1A = FromSource_zA.element(x, y, z);
-
-                    // Get the four fractional amounts we earlier interpolated
-                    A = FromSource_A.element(x, y, z);
-                    B = FromSource_B.element(x, y, z);
-                    C = FromSource_C.element(x, y, z);
-                    D = FromSource_D.element(x, y, z);
-                    E = FromSource_E.element(x, y, z);
-                    F = FromSource_F.element(x, y, z);
-                    G = FromSource_G.element(x, y, z);
-                    H = FromSource_H.element(x, y, z);
-
-                    // Get the TOTAL fraction requested from each source cell
-                    auto A_Total = TotalDestValue.element(x1A, y1A, z1A);
-                    auto B_Total = TotalDestValue.element(x1A + 1, y1A, z1A);
-                    auto C_Total = TotalDestValue.element(x1A, y1A + 1, z1A);
-                    auto D_Total = TotalDestValue.element(x1A + 1, y1A + 1, z1A);
-                    auto E_Total = TotalDestValue.element(x1A, y1A, z1A + 1);
-                    auto F_Total = TotalDestValue.element(x1A + 1, y1A, z1A + 1);
-                    auto G_Total = TotalDestValue.element(x1A, y1A + 1, z1A + 1);
-                    auto H_Total = TotalDestValue.element(x1A + 1, y1A + 1, z1A + 1);
-
-                    // If less then 1.0 in total then no scaling is neccessary
-                    if(A_Total < 1.0f)
-                        A_Total = 1.0f;
-                    if(B_Total < 1.0f)
-                        B_Total = 1.0f;
-                    if(C_Total < 1.0f)
-                        C_Total = 1.0f;
-                    if(D_Total < 1.0f)
-                        D_Total = 1.0f;
-                    if(E_Total < 1.0f)
-                        E_Total = 1.0f;
-                    if(F_Total < 1.0f)
-                        F_Total = 1.0f;
-                    if(G_Total < 1.0f)
-                        G_Total = 1.0f;
-                    if(H_Total < 1.0f)
-                        H_Total = 1.0f;
-
-                    // Scale the amount we are transferring
-                    A /= A_Total;
-                    B /= B_Total;
-                    C /= C_Total;
-                    D /= D_Total;
-                    E /= E_Total;
-                    F /= F_Total;
-                    G /= G_Total;
-                    H /= H_Total;
-
-                    // Give the fraction of the original source, do not alter the original
-                    // So we are taking fractions from p_in, but not altering those values
-                    // as they are used again by later cells if the field were mass
-                    // conserving, then we could simply move the value but if we try that
-                    // we lose mass
-                    out.element(x, y, z) += A * in.element(x1A, y1A, z1A) + B * in.element(x1A + 1, y1A, z1A) +
-                                            C * in.element(x1A, y1A + 1, z1A) + D * in.element(x1A + 1, y1A + 1, z1A) +
-                                            E * in.element(x1A, y1A, z1A + 1) + F * in.element(x1A + 1, y1A, z1A + 1) +
-                                            G * in.element(x1A, y1A + 1, z1A + 1) +
-                                            H * in.element(x1A + 1, y1A + 1, z1A + 1);
-
-                    // Subtract the values added to the destination from the source for
-                    // mass conservation
-                    out.element(x1A, y1A, z1A) -= A * in.element(x1A, y1A, z1A);
-                    out.element(x1A + 1, y1A, z1A) -= B * in.element(x1A + 1, y1A, z1A);
-                    out.element(x1A, y1A + 1, z1A) -= C * in.element(x1A, y1A + 1, z1A);
-                    out.element(x1A + 1, y1A + 1, z1A) -= D * in.element(x1A + 1, y1A + 1, z1A);
-                    out.element(x1A, y1A, z1A + 1) -= E * in.element(x1A, y1A, z1A + 1);
-                    out.element(x1A + 1, y1A, z1A + 1) -= F * in.element(x1A + 1, y1A, z1A + 1);
-                    out.element(x1A, y1A + 1, z1A + 1) -= G * in.element(x1A, y1A + 1, z1A + 1);
-                    out.element(x1A + 1, y1A + 1, z1A + 1) -= H * in.element(x1A + 1, y1A + 1, z1A + 1);
-                }
-            }
+            // Get the coordinates of A
+            x1A = FromSource_xA.element(x, y, z);
+            y1A = FromSource_yA.element(x, y, z);
+            z1A = FromSource_zA.element(x, y, z);
+
+            // Get the four fractional amounts we earlier interpolated
+            A = FromSource_A.element(x, y, z);
+            B = FromSource_B.element(x, y, z);
+            C = FromSource_C.element(x, y, z);
+            D = FromSource_D.element(x, y, z);
+            E = FromSource_E.element(x, y, z);
+            F = FromSource_F.element(x, y, z);
+            G = FromSource_G.element(x, y, z);
+            H = FromSource_H.element(x, y, z);
+
+            // Get the TOTAL fraction requested from each source cell
+            auto A_Total = TotalDestValue.element(x1A, y1A, z1A);
+            auto B_Total = TotalDestValue.element(x1A + 1, y1A, z1A);
+            auto C_Total = TotalDestValue.element(x1A, y1A + 1, z1A);
+            auto D_Total = TotalDestValue.element(x1A + 1, y1A + 1, z1A);
+            auto E_Total = TotalDestValue.element(x1A, y1A, z1A + 1);
+            auto F_Total = TotalDestValue.element(x1A + 1, y1A, z1A + 1);
+            auto G_Total = TotalDestValue.element(x1A, y1A + 1, z1A + 1);
+            auto H_Total = TotalDestValue.element(x1A + 1, y1A + 1, z1A + 1);
+
+            // If less then 1.0 in total then no scaling is neccessary
+            if(A_Total < 1.0f)
+                A_Total = 1.0f;
+            if(B_Total < 1.0f)
+                B_Total = 1.0f;
+            if(C_Total < 1.0f)
+                C_Total = 1.0f;
+            if(D_Total < 1.0f)
+                D_Total = 1.0f;
+            if(E_Total < 1.0f)
+                E_Total = 1.0f;
+            if(F_Total < 1.0f)
+                F_Total = 1.0f;
+            if(G_Total < 1.0f)
+                G_Total = 1.0f;
+            if(H_Total < 1.0f)
+                H_Total = 1.0f;
+
+            // Scale the amount we are transferring
+            A /= A_Total;
+            B /= B_Total;
+            C /= C_Total;
+            D /= D_Total;
+            E /= E_Total;
+            F /= F_Total;
+            G /= G_Total;
+            H /= H_Total;
+
+            // Give the fraction of the original source, do not alter the original
+            // So we are taking fractions from p_in, but not altering those values
+            // as they are used again by later cells if the field were mass
+            // conserving, then we could simply move the value but if we try that
+            // we lose mass
+            out.element(x, y, z) += A * in.element(x1A, y1A, z1A) + B * in.element(x1A + 1, y1A, z1A) +
+                                    C * in.element(x1A, y1A + 1, z1A) + D * in.element(x1A + 1, y1A + 1, z1A) +
+                                    E * in.element(x1A, y1A, z1A + 1) + F * in.element(x1A + 1, y1A, z1A + 1) +
+                                    G * in.element(x1A, y1A + 1, z1A + 1) +
+                                    H * in.element(x1A + 1, y1A + 1, z1A + 1);
+
+            // Subtract the values added to the destination from the source for
+            // mass conservation
+            out.element(x1A, y1A, z1A) -= A * in.element(x1A, y1A, z1A);
+            out.element(x1A + 1, y1A, z1A) -= B * in.element(x1A + 1, y1A, z1A);
+            out.element(x1A, y1A + 1, z1A) -= C * in.element(x1A, y1A + 1, z1A);
+            out.element(x1A + 1, y1A + 1, z1A) -= D * in.element(x1A + 1, y1A + 1, z1A);
+            out.element(x1A, y1A, z1A + 1) -= E * in.element(x1A, y1A, z1A + 1);
+            out.element(x1A + 1, y1A, z1A + 1) -= F * in.element(x1A + 1, y1A, z1A + 1);
+            out.element(x1A, y1A + 1, z1A + 1) -= G * in.element(x1A, y1A + 1, z1A + 1);
+            out.element(x1A + 1, y1A + 1, z1A + 1) -= H * in.element(x1A + 1, y1A + 1, z1A + 1);
         }
-    }
+    };
+    forEachSimulatedCell(in, transferCell);
 }
 
 // Signed advection is mass conserving, but allows signed quantities
@@ -548,123 +1362,118 @@ void FluidSimulation3D::reverseSignedAdvection(VelPkg3D& v, const float scale) c
     auto velOutY = v.destinationY();
     auto velOutZ = v.destinationZ();
 
-    for(auto x = 1; x < m_sizeX - 1; ++x)
-    {
-        for(auto y = 1; y < m_sizeY - 1; ++y)
+    const auto advectCell = [&](int32 x, int32 y, int32 z) {
+        const auto vx = m_velocity.sourceX().element(x, y, z);
+        const auto vy = m_velocity.sourceY().element(x, y, z);
+        const auto vz = m_velocity.sourceZ().element(x, y, z);
+        if(!FMath::IsNearlyZero(vx) || !FMath::IsNearlyZero(vy) || !FMath::IsNearlyZero(vz))
         {
-            for(auto z = 1; z < m_sizeZ - 1; ++z)
+            // Find the floating point location of the advection
+            // x, y, z locations after advection
+            auto x1 = x + vx * force;
+            auto y1 = y + vy * force;
+            auto z1 = z + vz * force;
+
+            const auto bCollide = collide(x, y, z, x1, y1, z1);
+
+            // Find the nearest top-left integer grid point of the advection
+            const auto x1A = FMath::FloorToInt(x1);
+            const auto y1A = FMath::FloorToInt(y1);
+            const auto z1A = FMath::FloorToInt(z1);
+
+            // Store the fractional parts
+            const auto fx1 = x1 - x1A;
+            const auto fy1 = y1 - y1A;
+            const auto fz1 = z1 - z1A;
+
+            // Get amounts from (in) source cells for X velocity
+            auto A_X = (1.0f - fx1) * (1.0f - fy1) * (1.0f - fz1) * v.destinationX().element(x1A, y1A, z1A);
+            auto B_X = fx1 * (1.0f - fy1) * (1.0f - fz1) * v.destinationX().element(x1A + 1, y1A, z1A);
+            auto C_X = (1.0f - fx1) * fy1 * (1.0f - fz1) * v.destinationX().element(x1A, y1A + 1, z1A);
+            auto D_X = fx1 * fy1 * (1.0f - fz1) * v.destinationX().element(x1A + 1, y1A + 1, z1A);
+            auto E_X = (1.0f - fx1) * (1.0f - fy1) * fz1 * v.destinationX().element(x1A, y1A, z1A + 1);
+            auto F_X = fx1 * (1.0f - fy1) * fz1 * v.destinationX().element(x1A + 1, y1A, z1A + 1);
+            auto G_X = (1.0f - fx1) * fy1 * fz1 * v.destinationX().element(x1A, y1A + 1, z1A + 1);
+            auto H_X = fx1 * fy1 * fz1 * v.destinationX().element(x1A + 1, y1A + 1, z1A + 1);
+
+            // Get amounts from (in) source cells for Y velocity
+            auto A_Y = (1.0f - fx1) * (1.0f - fy1) * (1.0f - fz1) * v.destinationY().element(x1A, y1A, z1A);
+            auto B_Y = fx1 * (1.0f - fy1) * (1.0f - fz1) * v.destinationY().element(x1A + 1, y1A, z1A);
+            auto C_Y = (1.0f - fx1) * fy1 * (1.0f - fz1) * v.destinationY().element(x1A, y1A + 1, z1A);
+            auto D_Y = fx1 * fy1 * (1.0f - fz1) * v.destinationY().element(x1A + 1, y1A + 1, z1A);
+            auto E_Y = (1.0f - fx1) * (1.0f - fy1) * fz1 * v.destinationY().element(x1A, y1A, z1A + 1);
+            auto F_Y = fx1 * (1.0f - fy1) * fz1 * v.destinationY().element(x1A + 1, y1A, z1A + 1);
+            auto G_Y = (1.0f - fx1) * fy1 * fz1 * v.destinationY().element(x1A, y1A + 1, z1A + 1);
+            auto H_Y = fx1 * fy1 * fz1 * v.destinationY().element(x1A + 1, y1A + 1, z1A + 1);
+
+            // Get amounts from (in) source cells for Z velocity
+            auto A_Z = (1.0f - fx1) * (1.0f - fy1) * (1.0f - fz1) * v.destinationZ().element(x1A, y1A, z1A);
+            auto B_Z = fx1 * (1.0f - fy1) * (1.0f - fz1) * v.destinationZ().element(x1A + 1, y1A, z1A);
+            auto C_Z = (1.0f - fx1) * fy1 * (1.0f - fz1) * v.destinationZ().element(x1A, y1A + 1, z1A);
+            auto D_Z = fx1 * fy1 * (1.0f - fz1) * v.destinationZ().element(x1A + 1, y1A + 1, z1A);
+            auto E_Z = (1.0f - fx1) * (1.0f - fy1) * fz1 * v.destinationZ().element(x1A, y1A, z1A + 1);
+            auto F_Z = fx1 * (1.0f - fy1) * fz1 * v.destinationZ().element(x1A + 1, y1A, z1A + 1);
+            auto G_Z = (1.0f - fx1) * fy1 * fz1 * v.destinationZ().element(x1A, y1A + 1, z1A + 1);
+            auto H_Z = fx1 * fy1 * fz1 * v.destinationZ().element(x1A + 1, y1A + 1, z1A + 1);
+
+            // X Velocity
+            // add to (out) source cell
+            if(!bCollide)
             {
-                const auto vx = m_velocity.sourceX().element(x, y, z);
-                const auto vy = m_velocity.sourceY().element(x, y, z);
-                const auto vz = m_velocity.sourceZ().element(x, y, z);
-                if(!FMath::IsNearlyZero(vx) || !FMath::IsNearlyZero(vy) || !FMath::IsNearlyZero(vz))
-                {
-                    // Find the floating point location of the advection
-                    // x, y, z locations after advection
-                    auto x1 = x + vx * force;
-                    auto y1 = y + vy * force;
-                    auto z1 = z + vz * force;
-
-                    const auto bCollide = collide(x, y, z, x1, y1, z1);
-
-                    // Find the nearest top-left integer grid point of the advection
-                    const auto x1A = FMath::FloorToInt(x1);
-                    const auto y1A = FMath::FloorToInt(y1);
-                    const auto z1A = FMath::FloorToInt(z1);
-
-                    // Store the fractional parts
-                    const auto fx1 = x1 - x1A;
-                    const auto fy1 = y1 - y1A;
-                    const auto fz1 = z1 - z1A;
-
-                    // Get amounts from (in) source cells for X velocity
-                    auto A_X = (1.0f - fx1) * (1.0f - fy1) * (1.0f - fz1) * v.destinationX().element(x1A, y1A, z1A);
-                    auto B_X = fx1 * (1.0f - fy1) * (1.0f - fz1) * v.destinationX().element(x1A + 1, y1A, z1A);
-                    auto C_X = (1.0f - fx1) * fy1 * (1.0f - fz1) * v.destinationX().element(x1A, y1A + 1, z1A);
-                    auto D_X = fx1 * fy1 * (1.0f - fz1) * v.destinationX().element(x1A + 1, y1A + 1, z1A);
-                    auto E_X = (1.0f - fx1) * (1.0f - fy1) * fz1 * v.destinationX().element(x1A, y1A, z1A + 1);
-                    auto F_X = fx1 * (1.0f - fy1) * fz1 * v.destinationX().element(x1A + 1, y1A, z1A + 1);
-                    auto G_X = (1.0f - fx1) * fy1 * fz1 * v.destinationX().element(x1A, y1A + 1, z1A + 1);
-                    auto H_X = fx1 * fy1 * fz1 * v.destinationX().element(x1A + 1, y1A + 1, z1A + 1);
-
-                    // Get amounts from (in) source cells for Y velocity
-                    auto A_Y = (1.0f - fx1) * (1.0f - fy1) * (1.0f - fz1) * v.destinationY().element(x1A, y1A, z1A);
-                    auto B_Y = fx1 * (1.0f - fy1) * (1.0f - fz1) * v.destinationY().element(x1A + 1, y1A, z1A);
-                    auto C_Y = (1.0f - fx1) * fy1 * (1.0f - fz1) * v.destinationY().element(x1A, y1A + 1, z1A);
-                    auto D_Y = fx1 * fy1 * (1.0f - fz1) * v.destinationY().element(x1A + 1, y1A + 1, z1A);
-                    auto E_Y = (1.0f - fx1) * (1.0f - fy1) * fz1 * v.destinationY().element(x1A, y1A, z1A + 1);
-                    auto F_Y = fx1 * (1.0f - fy1) * fz1 * v.destinationY().element(x1A + 1, y1A, z1A + 1);
-                    auto G_Y = (1.0f - fx1) * fy1 * fz1 * v.destinationY().element(x1A, y1A + 1, z1A + 1);
-                    auto H_Y = fx1 * fy1 * fz1 * v.destinationY().element(x1A + 1, y1A + 1, z1A + 1);
-
-                    // Get amounts from (in) source cells for Z velocity
-                    auto A_Z = (1.0f - fx1) * (1.0f - fy1) * (1.0f - fz1) * v.destinationZ().element(x1A, y1A, z1A);
-                    auto B_Z = fx1 * (1.0f - fy1) * (1.0f - fz1) * v.destinationZ().element(x1A + 1, y1A, z1A);
-                    auto C_Z = (1.0f - fx1) * fy1 * (1.0f - fz1) * v.destinationZ().element(x1A, y1A + 1, z1A);
-                    auto D_Z = fx1 * fy1 * (1.0f - fz1) * v.destinationZ().element(x1A + 1, y1A + 1, z1A);
-                    auto E_Z = (1.0f - fx1) * (1.0f - fy1) * fz1 * v.destinationZ().element(x1A, y1A, z1A + 1);
-                    auto F_Z = fx1 * (1.0f - fy1) * fz1 * v.destinationZ().element(x1A + 1, y1A, z1A + 1);
-                    auto G_Z = (1.0f - fx1) * fy1 * fz1 * v.destinationZ().element(x1A, y1A + 1, z1A + 1);
-                    auto H_Z = fx1 * fy1 * fz1 * v.destinationZ().element(x1A + 1, y1A + 1, z1A + 1);
-
-                    // X Velocity
-                    // add to (out) source cell
-                    if(!bCollide)
-                    {
-                        velOutX.element(x, y, z) += A_X + B_X + C_X + D_X + E_X + F_X + G_X + H_X;
-                    }
-                    // and subtract from (out) dest cells
-                    velOutX.element(x1A, y1A, z1A) -= A_X;
-                    velOutX.element(x1A + 1, y1A, z1A) -= B_X;
-                    velOutX.element(x1A, y1A + 1, z1A) -= C_X;
-                    velOutX.element(x1A + 1, y1A + 1, z1A) -= D_X;
-                    velOutX.element(x1A, y1A, z1A + 1) -= E_X;
-                    velOutX.element(x1A + 1, y1A, z1A + 1) -= F_X;
-                    velOutX.element(x1A, y1A + 1, z1A + 1) -= G_X;
-                    velOutX.element(x1A + 1, y1A + 1, z1A + 1) -= H_X;
-
-                    // Y Velocity
-                    // add to (out) source cell
-                    if(!bCollide)
-                    {
-                        velOutY.element(x, y, z) += A_Y + B_Y + C_Y + D_Y + E_Y + F_Y + G_Y + H_Y;
-                    }
-                    // and subtract from (out) dest cells
-                    velOutY.element(x1A, y1A, z1A) -= A_Y;
-                    velOutY.element(x1A + 1, y1A, z1A) -= B_Y;
-                    velOutY.element(x1A, y1A + 1, z1A) -= C_Y;
-                    velOutY.element(x1A + 1, y1A + 1, z1A) -= D_Y;
-                    velOutY.element(x1A, y1A, z1A + 1) -= E_Y;
-                    velOutY.element(x1A + 1, y1A, z1A + 1) -= F_Y;
-                    velOutY.element(x1A, y1A + 1, z1A + 1) -= G_Y;
-                    velOutY.element(x1A + 1, y1A + 1, z1A + 1) -= H_Y;
-
-                    // Z Velocity
-                    // add to (out) source cell
-                    if(!bCollide)
-                    {
-                        velOutZ.element(x, y, z) += A_Z + B_Z + C_Z + D_Z + E_Z + F_Z + G_Z + H_Z;
-                    }
-                    // and subtract from (out) dest cells
-                    velOutZ.element(x1A, y1A, z1A) -= A_Z;
-                    velOutZ.element(x1A + 1, y1A, z1A) -= B_Z;
-                    velOutZ.element(x1A, y1A + 1, z1A) -= C_Z;
-                    velOutZ.element(x1A + 1, y1A + 1, z1A) -= D_Z;
-                    velOutZ.element(x1A, y1A, z1A + 1) -= E_Z;
-                    velOutZ.element(x1A + 1, y1A, z1A + 1) -= F_Z;
-                    velOutZ.element(x1A, y1A + 1, z1A + 1) -= G_Z;
-                    velOutZ.element(x1A + 1, y1A + 1, z1A + 1) -= H_Z;
-                }
+                velOutX.element(x, y, z) += A_X + B_X + C_X + D_X + E_X + F_X + G_X + H_X;
+            }
+            // and subtract from (out) dest cells
+            velOutX.element(x1A, y1A, z1A) -= A_X;
+            velOutX.element(x1A + 1, y1A, z1A) -= B_X;
+            velOutX.element(x1A, y1A + 1, z1A) -= C_X;
+            velOutX.element(x1A + 1, y1A + 1, z1A) -= D_X;
+            velOutX.element(x1A, y1A, z1A + 1) -= E_X;
+            velOutX.element(x1A + 1, y1A, z1A + 1) -= F_X;
+            velOutX.element(x1A, y1A + 1, z1A + 1) -= G_X;
+            velOutX.element(x1A + 1, y1A + 1, z1A + 1) -= H_X;
+
+            // Y Velocity
+            // add to (out) source cell
+            if(!bCollide)
+            {
+                velOutY.element(x, y, z) += A_Y + B_Y + C_Y + D_Y + E_Y + F_Y + G_Y + H_Y;
             }
+            // and subtract from (out) dest cells
+            velOutY.element(x1A, y1A, z1A) -= A_Y;
+            velOutY.element(x1A + 1, y1A, z1A) -= B_Y;
+            velOutY.element(x1A, y1A + 1, z1A) -= C_Y;
+            velOutY.element(x1A + 1, y1A + 1, z1A) -= D_Y;
+            velOutY.element(x1A, y1A, z1A + 1) -= E_Y;
+            velOutY.element(x1A + 1, y1A, z1A + 1) -= F_Y;
+            velOutY.element(x1A, y1A + 1, z1A + 1) -= G_Y;
+            velOutY.element(x1A + 1, y1A + 1, z1A + 1) -= H_Y;
+
+            // Z Velocity
+            // add to (out) source cell
+            if(!bCollide)
+            {
+                velOutZ.element(x, y, z) += A_Z + B_Z + C_Z + D_Z + E_Z + F_Z + G_Z + H_Z;
+            }
+            // and subtract from (out) dest cells
+            velOutZ.element(x1A, y1A, z1A) -= A_Z;
+            velOutZ.element(x1A + 1, y1A, z1A) -= B_Z;
+            velOutZ.element(x1A, y1A + 1, z1A) -= C_Z;
+            velOutZ.element(x1A + 1, y1A + 1, z1A) -= D_Z;
+            velOutZ.element(x1A, y1A, z1A + 1) -= E_Z;
+            velOutZ.element(x1A + 1, y1A, z1A + 1) -= F_Z;
+            velOutZ.element(x1A, y1A + 1, z1A + 1) -= G_Z;
+            velOutZ.element(x1A + 1, y1A + 1, z1A + 1) -= H_Z;
         }
-    }
+    };
+    forEachScatterCell(m_velocity.sourceX(), advectCell);
     v.destinationX() = velOutX;
     v.destinationY() = velOutY;
     v.destinationZ() = velOutZ;
     v.swap();
 }
 
-float FluidSimulation3D::transferPressure(const Fluid3D& in, int32 x, int32 y, int32 z, float force) const
+template <typename TValue>
+float FluidSimulation3D::transferPressure(const TValue& value, int32 x, int32 y, int32 z, float force) const
 {
     SCOPE_CYCLE_COUNTER(STAT_TransferPressure);
     // Take care of boundries
@@ -676,59 +1485,492 @@ float FluidSimulation3D::transferPressure(const Fluid3D& in, int32 x, int32 y, i
     auto c = 0.f;
     if(!isBlocked(x, y, z, EFlowDirection::XPlus))
     {
-        c += in.element(x + 1, y, z);
+        c += value(x + 1, y, z);
         ++d;
     }
     if(!isBlocked(x, y, z, EFlowDirection::XMinus))
     {
-        c += in.element(x - 1, y, z);
+        c += value(x - 1, y, z);
         ++d;
     }
     if(!isBlocked(x, y, z, EFlowDirection::YPlus))
     {
-        c += in.element(x, y + 1, z);
+        c += value(x, y + 1, z);
         ++d;
     }
     if(!isBlocked(x, y, z, EFlowDirection::YMinus))
     {
-        c += in.element(x, y - 1, z);
+        c += value(x, y - 1, z);
         ++d;
     }
     if(!isBlocked(x, y, z, EFlowDirection::ZPlus))
     {
-        c += in.element(x, y, z + 1);
+        c += value(x, y, z + 1);
         ++d;
     }
     if(!isBlocked(x, y, z, EFlowDirection::ZMinus))
     {
-        c += in.element(x, y, z - 1);
+        c += value(x, y, z - 1);
         ++d;
     }
-    return in.element(x, y, z) + force * (c - d * in.element(x, y, z));
+    return value(x, y, z) + force * (c - d * value(x, y, z));
 }
 
-void FluidSimulation3D::diffusionStable(const Fluid3D& in, Fluid3D& out, float scale) const
+float FluidSimulation3D::diffusionStable(const Fluid3D& in, Fluid3D& out, float scale) const
 {
     SCOPE_CYCLE_COUNTER(STAT_StableDiffusion)
     const auto force = m_dt * scale;
 
     if(FMath::IsNegativeFloat(force) || FMath::IsNearlyZero(force))
-        return;
+        return 0.0f;
 
-    for(auto x = 0; x < m_sizeX; ++x)
+#if WITH_ATMOS_ISPC
+    if(useIspc())
     {
-        for(auto y = 0; y < m_sizeY; ++y)
+        const auto grid = ispcGrid(in);
+        const auto solids = ispcGrid(m_solids);
+        return ispc::diffuse(&in[0], &out[0], reinterpret_cast<const uint32*>(&m_solids[0]), &grid, &solids, force);
+    }
+#endif
+
+    auto change = 0.0f;
+    const auto read = [&in](int32 x, int32 y, int32 z) { return in.element(x, y, z); };
+    const auto diffuseCell = [&](int32 x, int32 y, int32 z) {
+        const auto value = transferPressure(read, x, y, z, force);
+        change = FMath::Max(change, FMath::Abs(value - in.element(x, y, z)));
+        out.element(x, y, z) = value;
+    };
+
+    if(m_regions.isUniform())
+    {
+        for(auto x = 0; x < m_sizeX; ++x)
         {
-            for(auto z = 0; z < m_sizeZ; ++z)
+            for(auto y = 0; y < m_sizeY; ++y)
+            {
+                for(auto z = 0; z < m_sizeZ; ++z)
+                {
+                    diffuseCell(x, y, z);
+                }
+            }
+        }
+        return change;
+    }
+
+    // Coarse regions keep their values, apart from what diffuses over their borders
+    out = in;
+    m_regions.forEachSimulatedCell(diffuseCell, 0, 0);
+    diffuseRegionBorders(in, out, force);
+    return change;
+}
+
+int32 FluidSimulation3D::diffusionIterationsOf(const FluidProperties& properties) const
+{
+    return properties.iterations > 0 ? FMath::Min(properties.iterations, m_diffusionIter) : m_diffusionIter;
+}
+
+int32 FluidSimulation3D::diffusionDepth(int32 remaining) const
+{
+    // Coarse regions and their borders need every iteration over the whole grid, the ISPC kernel has its own sweep
+    if(!m_diffusionBlocking || remaining < 2 || !m_regions.isUniform() || useIspc())
+    {
+        return 1;
+    }
+    return FMath::Min(remaining, maxDiffusionDepth(m_sizeX, m_sizeY));
+}
+
+int32 FluidSimulation3D::maxDiffusionDepth(int32 xSize, int32 ySize)
+{
+    // As many iterations as keep the planes in cache
+    const auto planes = DiffusionCacheBytes / FMath::Max<SIZE_T>(diffusionPlanesSize(xSize, ySize, 2), 1);
+    return FMath::Clamp(static_cast<int32>(planes) + 1, 1, MaxDiffusionDepth);
+}
+
+void FluidSimulation3D::diffusionBlocking(bool value)
+{
+    m_diffusionBlocking = value;
+    if(value)
+    {
+        m_diffusionPlanes.SetNumUninitialized(
+          diffusionPlanesSize(m_sizeX, m_sizeY, maxDiffusionDepth(m_sizeX, m_sizeY)) / sizeof(float));
+    }
+    else
+    {
+        m_diffusionPlanes.Empty();
+    }
+}
+
+SIZE_T FluidSimulation3D::diffusionPlanesSize(int32 xSize, int32 ySize, int32 steps)
+{
+    // Three planes for every iteration but the last, which writes to the output grid
+    return static_cast<SIZE_T>(3) * (steps - 1) * xSize * ySize * sizeof(float);
+}
+
+float FluidSimulation3D::diffuse(const Fluid3D& in, Fluid3D& out, float scale, int32 steps) const
+{
+    return steps > 1 ? diffusionBlocked(in, out, scale, steps) : diffusionStable(in, out, scale);
+}
+
+float FluidSimulation3D::diffusionBlocked(const Fluid3D& in, Fluid3D& out, float scale, int32 steps) const
+{
+    SCOPE_CYCLE_COUNTER(STAT_StableDiffusion)
+    const auto force = m_dt * scale;
+
+    if(FMath::IsNegativeFloat(force) || FMath::IsNearlyZero(force))
+        return 0.0f;
+
+    // Plane z of iteration i (1 to steps - 1) is kept in slot z % 3 of that iteration
+    const auto planeSize = m_sizeX * m_sizeY;
+    check(m_diffusionPlanes.Num() >= 3 * (steps - 1) * planeSize);
+    auto* const planes = m_diffusionPlanes.GetData();
+    const auto plane = [&](int32 iteration, int32 z) { return &planes[(3 * (iteration - 1) + z % 3) * planeSize]; };
+
+    // Iteration i computes plane z once iteration i - 1 has its plane z + 1, which it did earlier in the same front
+    auto change = 0.0f;
+    for(auto front = 0; front < m_sizeZ + steps - 1; ++front)
+    {
+        for(auto iteration = 1; iteration <= steps; ++iteration)
+        {
+            const auto z = front - iteration + 1;
+            if(z < 0 || z >= m_sizeZ)
+            {
+                continue;
+            }
+
+            const auto previous = iteration - 1;
+            const auto read = [&](int32 nx, int32 ny, int32 nz) {
+                return previous == 0 ? in.element(nx, ny, nz) : plane(previous, nz)[nx + m_sizeX * ny];
+            };
+            if(iteration < steps)
+            {
+                auto* const target = plane(iteration, z);
+                for(auto y = 0; y < m_sizeY; ++y)
+                {
+                    for(auto x = 0; x < m_sizeX; ++x)
+                    {
+                        target[x + m_sizeX * y] = transferPressure(read, x, y, z, force);
+                    }
+                }
+                continue;
+            }
+            for(auto y = 0; y < m_sizeY; ++y)
+            {
+                for(auto x = 0; x < m_sizeX; ++x)
+                {
+                    const auto value = transferPressure(read, x, y, z, force);
+                    change = FMath::Max(change, FMath::Abs(value - read(x, y, z)));
+                    out.element(x, y, z) = value;
+                }
+            }
+        }
+    }
+    return change;
+}
+
+void FluidSimulation3D::diffuseRegionBorders(const Fluid3D& in, Fluid3D& out, float force) const
+{
+    m_regions.forEachBorderCell([&](int32 x, int32 y, int32 z) {
+        const auto value = in.element(x, y, z);
+        auto flux = 0.0f;
+
+        // Mirrors transferPressure() of the full detail neighbour, so use its walls
+        const auto exchange = [&](int32 nx, int32 ny, EFlowDirection towards) {
+            if(m_regions.isSimulated(nx, ny) && !isBlocked(nx, ny, z, EFlowDirection::Self) &&
+               !isBlocked(nx, ny, z, towards))
+            {
+                flux += in.element(nx, ny, z) - value;
+            }
+        };
+        exchange(x + 1, y, EFlowDirection::XMinus);
+        exchange(x - 1, y, EFlowDirection::XPlus);
+        exchange(x, y + 1, EFlowDirection::YMinus);
+        exchange(x, y - 1, EFlowDirection::YPlus);
+
+        out.element(x, y, z) = value + force * flux;
+    });
+}
+
+void FluidSimulation3D::classifyCoarseBlocks()
+{
+    SCOPE_CYCLE_COUNTER(STAT_CoarseDiffusion)
+    const auto factor = m_coarseFactor;
+    m_coarseCells.set(0.0f);
+    m_coarseFaces.set(FVector::ZeroVector);
+
+    const auto classifyBlock = [&](int32 bx, int32 by, int32 bz) {
+        // Boundary cells never take part
+        const auto x0 = FMath::Max(bx * factor, 1);
+        const auto y0 = FMath::Max(by * factor, 1);
+        const auto z0 = FMath::Max(bz * factor, 1);
+        const auto x1 = FMath::Min(bx * factor + factor, m_sizeX - 1);
+        const auto y1 = FMath::Min(by * factor + factor, m_sizeY - 1);
+        const auto z1 = FMath::Min(bz * factor + factor, m_sizeZ - 1);
+        if(x0 >= x1 || y0 >= y1 || z0 >= z1)
+        {
+            return;
+        }
+
+        // Averaging a block with solids or walls inside would leak through them, such blocks are left as they are
+        for(auto z = z0; z < z1; ++z)
+        {
+            for(auto y = y0; y < y1; ++y)
+            {
+                for(auto x = x0; x < x1; ++x)
+                {
+                    if(isBlocked(x, y, z, EFlowDirection::Self) ||
+                       (x + 1 < x1 && isBlocked(x, y, z, EFlowDirection::XPlus)) ||
+                       (y + 1 < y1 && isBlocked(x, y, z, EFlowDirection::YPlus)) ||
+                       (z + 1 < z1 && isBlocked(x, y, z, EFlowDirection::ZPlus)))
+                    {
+                        return;
+                    }
+                }
+            }
+        }
+        m_coarseCells.element(bx, by, bz) = (x1 - x0) * (y1 - y0) * (z1 - z0);
+
+        // Fraction of the cells on a face that let gas through to the next block
+        auto& faces = m_coarseFaces.element(bx, by, bz);
+        for(auto z = z0; z < z1; ++z)
+        {
+            for(auto y = y0; y < y1; ++y)
+            {
+                faces.X += isBlocked(x1 - 1, y, z, EFlowDirection::XPlus) ? 0.0f : 1.0f;
+            }
+        }
+        for(auto z = z0; z < z1; ++z)
+        {
+            for(auto x = x0; x < x1; ++x)
             {
-                out.element(x, y, z) = transferPressure(in, x, y, z, force);
+                faces.Y += isBlocked(x, y1 - 1, z, EFlowDirection::YPlus) ? 0.0f : 1.0f;
             }
         }
+        for(auto y = y0; y < y1; ++y)
+        {
+            for(auto x = x0; x < x1; ++x)
+            {
+                faces.Z += isBlocked(x, y, z1 - 1, EFlowDirection::ZPlus) ? 0.0f : 1.0f;
+            }
+        }
+        faces.X /= (y1 - y0) * (z1 - z0);
+        faces.Y /= (x1 - x0) * (z1 - z0);
+        faces.Z /= (x1 - x0) * (y1 - y0);
+    };
+
+    m_regions.forEachRegion(ERegionDetail::Coarse, [&](int32 x0, int32 y0, int32 x1, int32 y1) {
+        for(auto bz = 0; bz < m_coarseCells.getZ(); ++bz)
+        {
+            for(auto by = y0 / factor; by * factor < y1; ++by)
+            {
+                for(auto bx = x0 / factor; bx * factor < x1; ++bx)
+                {
+                    classifyBlock(bx, by, bz);
+                }
+            }
+        }
+    });
+}
+
+float FluidSimulation3D::coarseDiffusion(Fluid3D& data, float force)
+{
+    SCOPE_CYCLE_COUNTER(STAT_CoarseDiffusion)
+    const auto factor = m_coarseFactor;
+
+    // Calls func(cell value, block index) for every cell of the blocks that are averaged
+    const auto forEachBlockCell = [&](auto&& func) {
+        m_regions.forEachRegion(ERegionDetail::Coarse, [&](int32 x0, int32 y0, int32 x1, int32 y1) {
+            for(auto z = 1; z < m_sizeZ - 1; ++z)
+            {
+                for(auto y = FMath::Max(y0, 1); y < FMath::Min(y1, m_sizeY - 1); ++y)
+                {
+                    for(auto x = FMath::Max(x0, 1); x < FMath::Min(x1, m_sizeX - 1); ++x)
+                    {
+                        const auto block = m_coarseCells.index(x / factor, y / factor, z / factor);
+                        if(m_coarseCells[block] > 0.0f)
+                        {
+                            func(data.element(x, y, z), block);
+                        }
+                    }
+                }
+            }
+        });
+    };
+
+    // Restrict to the coarse grid
+    m_coarseMass.set(0.0f);
+    forEachBlockCell([&](float& value, int32 block) { m_coarseMass[block] += value; });
+
+    // Exchange between open neighbouring blocks, the same amount leaves one as enters the other.
+    // Blocks of regions that are not updated in this pass only exchange with the ones that are
+    m_coarseFlux.set(0.0f);
+    const auto exchange = [&](int32 block, int32 neighbour, float open, bool active) {
+        const auto cells = m_coarseCells[block];
+        const auto neighbourCells = m_coarseCells[neighbour];
+        if(open <= 0.0f || neighbourCells <= 0.0f || !active)
+        {
+            return;
+        }
+        const auto difference = m_coarseMass[neighbour] / neighbourCells - m_coarseMass[block] / cells;
+        const auto transfer = force * open * difference * FMath::Min(cells, neighbourCells);
+        m_coarseFlux[block] += transfer;
+        m_coarseFlux[neighbour] -= transfer;
+    };
+    for(auto bz = 0; bz < m_coarseCells.getZ(); ++bz)
+    {
+        for(auto by = 0; by < m_coarseCells.getY(); ++by)
+        {
+            for(auto bx = 0; bx < m_coarseCells.getX(); ++bx)
+            {
+                const auto block = m_coarseCells.index(bx, by, bz);
+                if(m_coarseCells[block] <= 0.0f)
+                {
+                    continue;
+                }
+                const auto& faces = m_coarseFaces[block];
+                const auto active = m_regions.isActive(bx * factor, by * factor);
+                if(bx + 1 < m_coarseCells.getX())
+                {
+                    const auto neighbourActive = active || m_regions.isActive((bx + 1) * factor, by * factor);
+                    exchange(block, m_coarseCells.index(bx + 1, by, bz), faces.X, neighbourActive);
+                }
+                if(by + 1 < m_coarseCells.getY())
+                {
+                    const auto neighbourActive = active || m_regions.isActive(bx * factor, (by + 1) * factor);
+                    exchange(block, m_coarseCells.index(bx, by + 1, bz), faces.Y, neighbourActive);
+                }
+                if(bz + 1 < m_coarseCells.getZ())
+                {
+                    exchange(block, m_coarseCells.index(bx, by, bz + 1), faces.Z, active);
+                }
+            }
+        }
+    }
+
+    // Prolong back to uniform cells
+    auto change = 0.0f;
+    forEachBlockCell([&](float& value, int32 block) {
+        const auto mean = (m_coarseMass[block] + m_coarseFlux[block]) / m_coarseCells[block];
+        change = FMath::Max(change, FMath::Abs(mean - value));
+        value = mean;
+    });
+    return change;
+}
+
+void FluidSimulation3D::updateVacuum()
+{
+    SCOPE_CYCLE_COUNTER(STAT_Venting)
+    const auto& grid = m_pressure.oxigen().source();
+    m_venting.Reset();
+
+    // Cells next to space vent through their own faces
+    m_regions.forEachSimulatedCell(
+      [&](int32 x, int32 y, int32 z) {
+          const auto faces = ventFaces(x, y, z);
+          if(faces > 0 && !m_breachCells.Contains(grid.index(x, y, z)))
+          {
+              m_venting.Emplace(grid.index(x, y, z), m_ventRate * faces);
+          }
+      },
+      1,
+      1);
+
+    // Breach zones vent as one well mixed volume, which diffusion would take many iterations to converge to
+    for(const auto& zone : m_breachZones)
+    {
+        const auto rate = m_ventRate * zone.ventFaces / zone.cells.Num();
+        for(const auto index : zone.cells)
+        {
+            int32 x, y, z;
+            grid.coordinates(index, x, y, z);
+            if(m_regions.isActive(x, y))
+            {
+                m_venting.Emplace(index, rate);
+            }
+        }
+    }
+
+    if(m_venting.Num() == 0)
+    {
+        return;
+    }
+
+    // Exact solution of dp/dt = -rate * p, so venting is stable for any time step. Only the listed cells change,
+    // they are written in place
+    for(auto gas = 0; gas < EGasType::GasTypeCount; ++gas)
+    {
+        auto& values = m_pressure.gas(static_cast<EGasType::Type>(gas)).source();
+        for(const auto& cell : m_venting)
+        {
+            auto& value = values[cell.Key];
+            const auto remaining = value * FMath::Exp(-cell.Value * m_dt);
+            m_vented += value - remaining;
+            m_maxPressureDelta = FMath::Max(m_maxPressureDelta, value - remaining);
+            value = remaining;
+        }
+    }
+}
+
+int32 FluidSimulation3D::ventFaces(int32 x, int32 y, int32 z) const
+{
+    if(x < 1 || y < 1 || z < 1 || x >= m_sizeX - 1 || y >= m_sizeY - 1 || z >= m_sizeZ - 1)
+    {
+        return 0;
+    }
+    const auto flags = m_solids.element(x, y, z);
+    if(!EnumHasAnyFlags(flags, EFlowDirection::VacuumFaces) ||
+       EnumHasAnyFlags(flags, EFlowDirection::Self | EFlowDirection::Vacuum))
+    {
+        return 0;
+    }
+
+    auto result = 0;
+    for(const auto face : {EFlowDirection::XPlus,
+                           EFlowDirection::XMinus,
+                           EFlowDirection::YPlus,
+                           EFlowDirection::YMinus,
+                           EFlowDirection::ZPlus,
+                           EFlowDirection::ZMinus})
+    {
+        result += EnumHasAnyFlags(flags, vacuumFace(face)) && !EnumHasAnyFlags(flags, face) ? 1 : 0;
     }
+    return result;
 }
 
 // Checks if destination point during advection is out of bounds and pulls point
 // in if needed
+uint32 FluidSimulation3D::openTargets(int32 x, int32 y, int32 z, int32 x1A, int32 y1A, int32 z1A) const
+{
+    // Reads the flags directly, this runs for every moving cell of every advection
+    const auto flags = m_solids.element(x, y, z);
+    const auto faceOpen = [flags](int32 delta, EFlowDirection plus, EFlowDirection minus) {
+        const auto face = delta > 0 ? plus : minus;
+        return delta == 0 || !EnumHasAnyFlags(flags, face | vacuumFace(face));
+    };
+    const bool openX[] = {faceOpen(x1A - x, EFlowDirection::XPlus, EFlowDirection::XMinus),
+                          faceOpen(x1A + 1 - x, EFlowDirection::XPlus, EFlowDirection::XMinus)};
+    const bool openY[] = {faceOpen(y1A - y, EFlowDirection::YPlus, EFlowDirection::YMinus),
+                          faceOpen(y1A + 1 - y, EFlowDirection::YPlus, EFlowDirection::YMinus)};
+    const bool openZ[] = {faceOpen(z1A - z, EFlowDirection::ZPlus, EFlowDirection::ZMinus),
+                          faceOpen(z1A + 1 - z, EFlowDirection::ZPlus, EFlowDirection::ZMinus)};
+
+    auto result = 0u;
+    for(auto corner = 0; corner < 8; ++corner)
+    {
+        const auto dx = corner & 1;
+        const auto dy = (corner >> 1) & 1;
+        const auto dz = corner >> 2;
+        const auto tx = x1A + dx;
+        const auto ty = y1A + dy;
+        const auto tz = z1A + dz;
+        if(openX[dx] && openY[dy] && openZ[dz] && tx > 0 && tx < m_sizeX - 1 && ty > 0 && ty < m_sizeY - 1 &&
+           tz > 0 && tz < m_sizeZ - 1 &&
+           !EnumHasAnyFlags(m_solids.element(tx, ty, tz), EFlowDirection::Self | EFlowDirection::Vacuum))
+        {
+            result |= 1u << corner;
+        }
+    }
+    return result;
+}
+
 bool FluidSimulation3D::collide(int32 thisX, int32 thisY, int32 thisZ, float& newX, float& newY, float& newZ) const
 {
     SCOPE_CYCLE_COUNTER(STAT_TransferPressure);
@@ -825,154 +2067,142 @@ bool FluidSimulation3D::isBlocked(int32 x, int32 y, int32 z, EFlowDirection dir)
         return true;
     }
 
+    // Vacuum faces and cells block like walls and solids, gas leaves through them in updateVacuum()
+    const auto flags = m_solids.element(x, y, z);
     switch(dir)
     {
-    case EFlowDirection::XPlus: return x + 1 < m_sizeX && EnumHasAllFlags(m_solids.element(x, y, z), dir);
-    case EFlowDirection::XMinus: return x - 1 >= 0 && EnumHasAllFlags(m_solids.element(x, y, z), dir);
-    case EFlowDirection::YPlus: return y + 1 < m_sizeY && EnumHasAllFlags(m_solids.element(x, y, z), dir);
-    case EFlowDirection::YMinus: return y - 1 >= 0 && EnumHasAllFlags(m_solids.element(x, y, z), dir);
-    case EFlowDirection::ZPlus: return z + 1 < m_sizeZ && EnumHasAllFlags(m_solids.element(x, y, z), dir);
-    case EFlowDirection::ZMinus: return z - 1 >= 0 && EnumHasAllFlags(m_solids.element(x, y, z), dir);
-    case EFlowDirection::Self: return EnumHasAnyFlags(m_solids.element(x, y, z), EFlowDirection::Self);
+    case EFlowDirection::XPlus: return x + 1 < m_sizeX && EnumHasAnyFlags(flags, dir | vacuumFace(dir));
+    case EFlowDirection::XMinus: return x - 1 >= 0 && EnumHasAnyFlags(flags, dir | vacuumFace(dir));
+    case EFlowDirection::YPlus: return y + 1 < m_sizeY && EnumHasAnyFlags(flags, dir | vacuumFace(dir));
+    case EFlowDirection::YMinus: return y - 1 >= 0 && EnumHasAnyFlags(flags, dir | vacuumFace(dir));
+    case EFlowDirection::ZPlus: return z + 1 < m_sizeZ && EnumHasAnyFlags(flags, dir | vacuumFace(dir));
+    case EFlowDirection::ZMinus: return z - 1 >= 0 && EnumHasAnyFlags(flags, dir | vacuumFace(dir));
+    case EFlowDirection::Self: return EnumHasAnyFlags(flags, EFlowDirection::Self | EFlowDirection::Vacuum);
     default: UE_LOG(LogFluidSimulation, Verbose, TEXT("Atmos tried to check with undefined direction!")); return false;
     }
 }
 
-// Apply acceleration due to pressure
-void FluidSimulation3D::pressureAcceleration(const float scale)
+// Apply decay and acceleration due to pressure
+void FluidSimulation3D::accelerate(const float decay, const float force)
 {
-    const auto force = m_dt * scale;
-
-    m_velocity.destinationX() = m_velocity.sourceX();
-    m_velocity.destinationY() = m_velocity.sourceY();
-    m_velocity.destinationZ() = m_velocity.sourceZ();
+    auto& outX = m_velocity.destinationX();
+    auto& outY = m_velocity.destinationY();
+    auto& outZ = m_velocity.destinationZ();
+    const auto& inX = m_velocity.sourceX();
+    const auto& inY = m_velocity.sourceY();
+    const auto& inZ = m_velocity.sourceZ();
+
+    // Regions outside of the pass keep their velocity until their own pass
+    if(!m_regions.isUniform())
+    {
+        outX = inX;
+        outY = inY;
+        outZ = inZ;
+    }
 
-    for(auto x = 0; x < m_sizeX - 1; ++x)
+#if WITH_ATMOS_ISPC
+    if(useIspc())
     {
-        for(auto y = 0; y < m_sizeY - 1; ++y)
+        const auto grid = ispcGrid(outX);
+        const auto solids = ispcGrid(m_solids);
+        ispc::accelerate(&inX[0],
+                         &inY[0],
+                         &inZ[0],
+                         &outX[0],
+                         &outY[0],
+                         &outZ[0],
+                         &m_totalPressure[0],
+                         reinterpret_cast<const uint32*>(&m_solids[0]),
+                         &grid,
+                         &solids,
+                         decay,
+                         force);
+        return;
+    }
+#endif
+
+    // Pressure differential across the face towards the next cell along dir, the total pressure is the one of the
+    // end of the previous pass. Walls hold the pressure difference, otherwise the flow against them would never
+    // come to rest
+    const auto faceForce = [&](int32 x, int32 y, int32 z, EFlowDirection dir, int32 dx, int32 dy, int32 dz) {
+        if(x < 0 || y < 0 || z < 0 || x >= m_sizeX - 1 || y >= m_sizeY - 1 || z >= m_sizeZ - 1 ||
+           isBlocked(x, y, z, dir))
         {
-            for(auto z = 0; z < m_sizeZ - 1; ++z)
-            {
-                // Pressure differential between points to get an accelleration force.
-                auto& o2 = m_pressure.oxigen().source();
-                auto& n2 = m_pressure.nitrogen().source();
-                auto& co2 = m_pressure.carbonDioxide().source();
-                auto& toxin = m_pressure.toxin().source();
-                const auto srcPress =
-                  o2.element(x, y, z) + n2.element(x, y, z) + co2.element(x, y, z) + toxin.element(x, y, z);
-
-                const auto destX = o2.element(x + 1, y, z) + n2.element(x + 1, y, z) + co2.element(x + 1, y, z) +
-                                   toxin.element(x + 1, y, z);
-
-                const auto destY = o2.element(x, y + 1, z) + n2.element(x, y + 1, z) + co2.element(x, y + 1, z) +
-                                   toxin.element(x, y + 1, z);
-
-                const auto destZ = o2.element(x, y, z + 1) + n2.element(x, y, z + 1) + co2.element(x, y, z + 1) +
-                                   toxin.element(x, y, z + 1);
-
-                const auto forceX = destX - srcPress;
-                const auto forceY = destY - srcPress;
-                const auto forceZ = destZ - srcPress;
-
-                // Use the acceleration force to move the velocity field in the
-                // appropriate direction. Ex. If an area of high pressure exists the
-                // acceleration force will turn the velocity field away from this area
-                m_velocity.destinationX().element(x, y, z) += force * forceX;
-                m_velocity.destinationX().element(x + 1, y, z) -= force * forceX;
-
-                m_velocity.destinationY().element(x, y, z) += force * forceY;
-                m_velocity.destinationY().element(x, y + 1, z) -= force * forceY;
-
-                m_velocity.destinationZ().element(x, y, z) += force * forceZ;
-                m_velocity.destinationZ().element(x, y, z + 1) -= force * forceZ;
-            }
+            return 0.0f;
         }
-    }
-
-    m_velocity.swap();
-}
+        return m_totalPressure.element(x + dx, y + dy, z + dz) - m_totalPressure.element(x, y, z);
+    };
 
-// Apply a natural deceleration to forces applied to the grids
-void FluidSimulation3D::exponentialDecay(Fluid3D& data, float decay) const
-{
-    for(auto x = 0; x < m_sizeX; ++x)
-    {
-        for(auto y = 0; y < m_sizeY; ++y)
+    const auto accelerateCell = [&](int32 x, int32 y, int32 z) {
+        const auto index = outX.index(x, y, z);
+        if(force == 0.0f)
         {
-            for(auto z = 0; z < m_sizeZ; ++z)
-            {
-                data.element(x, y, z) = data.element(x, y, z) * FMath::Pow(1 - decay, m_dt);
-            }
+            outX[index] = inX[index] * decay;
+            outY[index] = inY[index] * decay;
+            outZ[index] = inZ[index] * decay;
+            return;
         }
-    }
+
+        // Use the acceleration force to move the velocity field in the appropriate direction. Ex. If an area of
+        // high pressure exists the acceleration force will turn the velocity field away from this area
+        const auto forceX =
+          faceForce(x, y, z, EFlowDirection::XPlus, 1, 0, 0) - faceForce(x - 1, y, z, EFlowDirection::XPlus, 1, 0, 0);
+        const auto forceY =
+          faceForce(x, y, z, EFlowDirection::YPlus, 0, 1, 0) - faceForce(x, y - 1, z, EFlowDirection::YPlus, 0, 1, 0);
+        const auto forceZ =
+          faceForce(x, y, z, EFlowDirection::ZPlus, 0, 0, 1) - faceForce(x, y, z - 1, EFlowDirection::ZPlus, 0, 0, 1);
+        outX[index] = inX[index] * decay + force * forceX;
+        outY[index] = inY[index] * decay + force * forceY;
+        outZ[index] = inZ[index] * decay + force * forceZ;
+    };
+    m_regions.forEachSimulatedCell(accelerateCell, 0, 0);
 }
 
 // Apply vorticities to the simulation
 void FluidSimulation3D::vorticityConfinement(const float scale)
 {
-    m_velocity.destinationX().set(0.0f);
-    m_velocity.destinationY().set(0.0f);
-    m_velocity.destinationZ().set(0.0f);
-
-    for(auto i = 1; i < m_sizeX - 1; ++i)
-    {
-        for(auto j = 1; j < m_sizeY - 1; ++j)
-        {
-            for(auto k = 1; k < m_sizeZ - 1; ++k)
-            {
-                m_curl.element(i, j, k) = FMath::Abs(curl(i, j, k));
-            }
-        }
-    }
-
-    for(auto x = 1; x < m_sizeX - 1; ++x)
-    {
-        for(auto y = 1; y < m_sizeY - 1; ++y)
-        {
-            for(auto z = 1; z < m_sizeZ - 1; ++z)
-            {
-                // Get curl gradient across cells
-                auto lrCurl = (m_curl.element(x + 1, y, z) - m_curl.element(x - 1, y, z)) * 0.5f;
-                auto udCurl = (m_curl.element(x, y + 1, z) - m_curl.element(x, y - 1, z)) * 0.5f;
-                auto bfCurl = (m_curl.element(x, y, z + 1) - m_curl.element(x, y, z - 1)) * 0.5f;
-
-                // Normalize the derivitive curl vector
-                const auto length = FMath::Sqrt(lrCurl * lrCurl + udCurl * udCurl + bfCurl * bfCurl) + 0.000001f;
-                lrCurl /= length;
-                udCurl /= length;
-                bfCurl /= length;
-
-                const auto magnitude = curl(x, y, z);
-
-                m_velocity.destinationX().element(x, y, z) = -udCurl * magnitude;
-                m_velocity.destinationY().element(x, y, z) = lrCurl * magnitude;
-                m_velocity.destinationZ().element(x, y, z) = bfCurl * magnitude;
-            }
-        }
-    }
-    m_velocity.destinationX() *= scale;
-    m_velocity.destinationY() *= scale;
-    m_velocity.destinationZ() *= scale;
-    m_velocity.destinationX() += m_velocity.sourceX();
-    m_velocity.destinationY() += m_velocity.sourceY();
-    m_velocity.destinationZ() += m_velocity.sourceZ();
-    m_velocity.swap();
+    auto& outX = m_velocity.destinationX();
+    auto& outY = m_velocity.destinationY();
+    auto& outZ = m_velocity.destinationZ();
+
+    // The curl is cached once per cell, confinement reads it at the neighbours as well
+    m_regions.forEachSimulatedCell(
+      [&](int32 x, int32 y, int32 z) { m_curl.element(x, y, z) = curl(outX, outY, outZ, x, y, z); }, 1, 1);
+
+    // Every cell only reads the curl and writes itself, so the velocity is altered in place
+    const auto confineCell = [&](int32 x, int32 y, int32 z) {
+        // Get curl gradient across cells
+        auto lrCurl = (FMath::Abs(m_curl.element(x + 1, y, z)) - FMath::Abs(m_curl.element(x - 1, y, z))) * 0.5f;
+        auto udCurl = (FMath::Abs(m_curl.element(x, y + 1, z)) - FMath::Abs(m_curl.element(x, y - 1, z))) * 0.5f;
+        auto bfCurl = (FMath::Abs(m_curl.element(x, y, z + 1)) - FMath::Abs(m_curl.element(x, y, z - 1))) * 0.5f;
+
+        // Normalize the derivitive curl vector and scale it by the strength
+        const auto length = FMath::Sqrt(lrCurl * lrCurl + udCurl * udCurl + bfCurl * bfCurl) + 0.000001f;
+        const auto magnitude = m_curl.element(x, y, z) * scale / length;
+
+        const auto index = outX.index(x, y, z);
+        outX[index] -= udCurl * magnitude;
+        outY[index] += lrCurl * magnitude;
+        outZ[index] += bfCurl * magnitude;
+    };
+    m_regions.forEachSimulatedCell(confineCell, 1, 1);
 }
 
 // Calculate the curl at position (x,y,z) in the fluid grid. Physically this
 // represents the vortex strength at the cell. Computed as follows: w = (del x
 // U) where U is the velocity vector at (i, j).
-float FluidSimulation3D::curl(const int32 x, const int32 y, const int32 z) const
+float FluidSimulation3D::curl(
+  const Fluid3D& vx, const Fluid3D& vy, const Fluid3D& vz, const int32 x, const int32 y, const int32 z)
 {
     // difference in XV of cells above and below
     // positive number is a counter-clockwise rotation
-    const auto xCurl = (m_velocity.sourceX().element(x, y + 1, z) - m_velocity.sourceX().element(x, y - 1, z)) * 0.5f;
+    const auto xCurl = (vx.element(x, y + 1, z) - vx.element(x, y - 1, z)) * 0.5f;
 
     // difference in YV of cells left and right
-    const auto yCurl = (m_velocity.sourceY().element(x + 1, y, z) - m_velocity.sourceY().element(x - 1, y, z)) * 0.5f;
+    const auto yCurl = (vy.element(x + 1, y, z) - vy.element(x - 1, y, z)) * 0.5f;
 
     // difference in ZV of cells front and back
-    const auto zCurl = (m_velocity.sourceZ().element(x, y, z + 1) - m_velocity.sourceY().element(x, y, z - 1)) * 0.5f;
+    const auto zCurl = (vz.element(x, y, z + 1) - vz.element(x, y, z - 1)) * 0.5f;
 
     return xCurl - yCurl - zCurl;
 }
@@ -984,4 +2214,64 @@ void FluidSimulation3D::reset()
     m_pressure.reset(0.0f);
     m_velocity.reset(0.0f);
     m_solids.set(EFlowDirection::Max);
+    wake();
+}
+
+void FluidSimulation3D::copyFrom(const FluidSimulation3D& other, const FIntVector& offset)
+{
+    // The border cells of either grid are walls, only the cells inside both are copied
+    const FIntVector begin(FMath::Max(1, 1 + offset.X), FMath::Max(1, 1 + offset.Y), FMath::Max(1, 1 + offset.Z));
+    const FIntVector end(FMath::Min(m_sizeX - 1, other.m_sizeX - 1 + offset.X),
+                         FMath::Min(m_sizeY - 1, other.m_sizeY - 1 + offset.Y),
+                         FMath::Min(m_sizeZ - 1, other.m_sizeZ - 1 + offset.Z));
+    if(begin.X >= end.X || begin.Y >= end.Y || begin.Z >= end.Z)
+    {
+        return;
+    }
+
+    const auto forEachCopiedCell = [&](TFunctionRef<void(int32, int32, int32)> func) {
+        ParallelFor(end.Z - begin.Z, [&](int32 slice) {
+            const auto z = begin.Z + slice;
+            for(auto y = begin.Y; y < end.Y; ++y)
+            {
+                for(auto x = begin.X; x < end.X; ++x)
+                {
+                    func(x, y, z);
+                }
+            }
+        });
+    };
+    const auto copy = [&](const Fluid3D& from, Fluid3D& out, const Fluid3D& current) {
+        out = current;
+        forEachCopiedCell([&](int32 x, int32 y, int32 z) {
+            out.element(x, y, z) = from.element(x - offset.X, y - offset.Y, z - offset.Z);
+        });
+    };
+
+    for(auto gas = 0; gas < EGasType::GasTypeCount; ++gas)
+    {
+        const auto type = static_cast<EGasType::Type>(gas);
+        copy(other.m_pressure.gas(type).source(), m_pressure.gas(type).destination(), m_pressure.gas(type).source());
+    }
+    m_pressure.swap();
+    copy(other.m_velocity.sourceX(), m_velocity.destinationX(), m_velocity.sourceX());
+    copy(other.m_velocity.sourceY(), m_velocity.destinationY(), m_velocity.sourceY());
+    copy(other.m_velocity.sourceZ(), m_velocity.destinationZ(), m_velocity.sourceZ());
+    m_velocity.swap();
+    forEachCopiedCell([&](int32 x, int32 y, int32 z) {
+        m_solids.element(x, y, z) = other.m_solids.element(x - offset.X, y - offset.Y, z - offset.Z);
+    });
+
+    for(const auto& cell : other.m_breaches)
+    {
+        const auto moved = cell + offset;
+        if(moved.X >= begin.X && moved.Y >= begin.Y && moved.Z >= begin.Z && moved.X < end.X && moved.Y < end.Y &&
+           moved.Z < end.Z)
+        {
+            m_breaches.AddUnique(moved);
+        }
+    }
+    m_vented = other.m_vented;
+    updateBreachZones();
+    wake();
 }
@@ -0,0 +1,140 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "FluidSimulation3D.h"
+#include "FluidSimulationModule.h"
+
+namespace {
+// Seeds a grid with a smooth swirl so advection touches scattered neighbour cubes, then returns the average cost of
+// updateAdvection in milliseconds
+double benchmarkAdvection(EArray3DLayout layout, const FIntVector& size, int32 iterations)
+{
+    FluidSimulation3D sim(size.X, size.Y, size.Z, 0.1f, FArray3DPolicy(layout));
+    sim.solids().set(EFlowDirection::None);
+    FluidProperties gasProperties;
+    gasProperties.advection = 1.0f;
+    sim.pressure().properties(gasProperties);
+    sim.velocity().properties().advection = 1.0f;
+
+    const auto gas = [](int32 x, int32 y, int32 z) { return 100.0f + (x * 7 + y * 13 + z * 29) % 50; };
+    sim.pressure().oxigen().destination().parallelGenerate(gas);
+    sim.pressure().nitrogen().destination().parallelGenerate(gas);
+    sim.pressure().carbonDioxide().destination().parallelGenerate(gas);
+    sim.pressure().toxin().destination().parallelGenerate(gas);
+    sim.pressure().swap();
+
+    sim.velocity().destinationX().parallelGenerate(
+      [](int32 x, int32 y, int32 z) { return FMath::Sin(y * 0.3f) * 8.0f; });
+    sim.velocity().destinationY().parallelGenerate(
+      [](int32 x, int32 y, int32 z) { return FMath::Cos(x * 0.3f) * 8.0f; });
+    sim.velocity().destinationZ().parallelGenerate(
+      [](int32 x, int32 y, int32 z) { return FMath::Sin((x + y) * 0.2f) * 2.0f; });
+    sim.velocity().swap();
+
+    const auto start = FPlatformTime::Seconds();
+    for(auto i = 0; i < iterations; ++i)
+    {
+        sim.updateAdvection();
+    }
+    return (FPlatformTime::Seconds() - start) * 1000.0 / iterations;
+}
+
+// Returns the average cost of updateDiffusion in milliseconds, with or without temporal blocking
+double benchmarkDiffusion(bool blocking, const FIntVector& size, int32 iterations)
+{
+    FluidSimulation3D sim(size.X, size.Y, size.Z, 0.1f);
+    sim.solids().set(EFlowDirection::None);
+    sim.diffusionBlocking(blocking);
+    FluidProperties gasProperties;
+    gasProperties.diffusion = 1.0f;
+    sim.pressure().properties(gasProperties);
+    sim.velocity().properties().diffusion = 1.0f;
+
+    const auto gas = [](int32 x, int32 y, int32 z) { return 100.0f + (x * 7 + y * 13 + z * 29) % 50; };
+    sim.pressure().oxigen().destination().parallelGenerate(gas);
+    sim.pressure().nitrogen().destination().parallelGenerate(gas);
+    sim.pressure().carbonDioxide().destination().parallelGenerate(gas);
+    sim.pressure().toxin().destination().parallelGenerate(gas);
+    sim.pressure().swap();
+
+    const auto start = FPlatformTime::Seconds();
+    for(auto i = 0; i < iterations; ++i)
+    {
+        sim.updateDiffusion();
+    }
+    return (FPlatformTime::Seconds() - start) * 1000.0 / iterations;
+}
+
+void readBenchmarkArgs(const TArray<FString>& args, FIntVector& size, int32& iterations)
+{
+    if(args.Num() >= 3)
+    {
+        size = {FCString::Atoi(*args[0]), FCString::Atoi(*args[1]), FCString::Atoi(*args[2])};
+    }
+    if(args.Num() >= 4)
+    {
+        iterations = FMath::Max(1, FCString::Atoi(*args[3]));
+    }
+}
+
+void benchmarkLayout(const TArray<FString>& args)
+{
+    FIntVector size(130, 130, 6);
+    auto iterations = 10;
+    readBenchmarkArgs(args, size, iterations);
+
+    const auto linear = benchmarkAdvection(EArray3DLayout::Linear, size, iterations);
+    const auto morton = benchmarkAdvection(EArray3DLayout::Morton, size, iterations);
+    UE_LOG(LogFluidSimulation,
+           Display,
+           TEXT("Advection of %dx%dx%d grid: linear %.3f ms, Morton %.3f ms (%.2fx)"),
+           size.X,
+           size.Y,
+           size.Z,
+           linear,
+           morton,
+           linear / morton);
+}
+
+void benchmarkBlocking(const TArray<FString>& args)
+{
+    FIntVector size(514, 514, 6);
+    auto iterations = 3;
+    readBenchmarkArgs(args, size, iterations);
+
+    const auto sweeps = benchmarkDiffusion(false, size, iterations);
+    const auto blocked = benchmarkDiffusion(true, size, iterations);
+    UE_LOG(LogFluidSimulation,
+           Display,
+           TEXT("Diffusion of %dx%dx%d grid: sweeps %.3f ms, temporally blocked %.3f ms (%.2fx)"),
+           size.X,
+           size.Y,
+           size.Z,
+           sweeps,
+           blocked,
+           sweeps / blocked);
+}
+} // namespace
+
+static FAutoConsoleCommand GAtmosBenchmarkLayout(
+  TEXT("Atmos.BenchmarkLayout"),
+  TEXT("Compares advection cost of linear and Morton grid layouts. Usage: Atmos.BenchmarkLayout [X Y Z [Iterations]]"),
+  FConsoleCommandWithArgsDelegate::CreateStatic(&benchmarkLayout));
+
+static FAutoConsoleCommand GAtmosBenchmarkBlocking(
+  TEXT("Atmos.BenchmarkBlocking"),
+  TEXT("Times diffusion with and without temporal blocking. Usage: Atmos.BenchmarkBlocking [X Y Z [Iterations]]"),
+  FConsoleCommandWithArgsDelegate::CreateStatic(&benchmarkBlocking));
@@ -16,89 +16,635 @@
 
 #include "FluidSimulationManager.h"
 
+#include "Async/Async.h"
 #include "AtmoStruct.h"
 #include "FluidSimulation3D.h"
 #include "FluidSimulationModule.h"
+#include "FluidSimulationScheduler.h"
+#include "HAL/Event.h"
+#include "Misc/ScopeLock.h"
 
-FFluidSimulationManager::FFluidSimulationManager() : m_isTaskStopped(true), m_size(1, 1, 1) {}
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Atmos time step"), STAT_AtmosTimeStep, STATGROUP_AtmosStats);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Atmos max velocity"), STAT_AtmosMaxVelocity, STATGROUP_AtmosStats);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Atmos vented"), STAT_AtmosVented, STATGROUP_AtmosStats);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Atmos idle"), STAT_AtmosIdle, STATGROUP_AtmosStats);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Atmos tick time"), STAT_AtmosTickTime, STATGROUP_AtmosStats);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Atmos budget misses"), STAT_AtmosBudgetMisses, STATGROUP_AtmosStats);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Atmos quality level"), STAT_AtmosQualityLevel, STATGROUP_AtmosStats);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Atmos gas commands"), STAT_AtmosGasCommands, STATGROUP_AtmosStats);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Atmos dropped gas commands"), STAT_AtmosDroppedGasCommands, STATGROUP_AtmosStats);
+DECLARE_MEMORY_STAT(TEXT("Atmos solids"), STAT_AtmosSolidsMemory, STATGROUP_AtmosStats);
+DECLARE_MEMORY_STAT(TEXT("Atmos velocity"), STAT_AtmosVelocityMemory, STATGROUP_AtmosStats);
+DECLARE_MEMORY_STAT(TEXT("Atmos gases"), STAT_AtmosGasesMemory, STATGROUP_AtmosStats);
+DECLARE_MEMORY_STAT(TEXT("Atmos curl"), STAT_AtmosCurlMemory, STATGROUP_AtmosStats);
+DECLARE_MEMORY_STAT(TEXT("Atmos total pressure"), STAT_AtmosTotalPressureMemory, STATGROUP_AtmosStats);
+DECLARE_MEMORY_STAT(TEXT("Atmos advection scratch"), STAT_AtmosAdvectionScratchMemory, STATGROUP_AtmosStats);
+DECLARE_MEMORY_STAT(TEXT("Atmos diffusion scratch"), STAT_AtmosDiffusionScratchMemory, STATGROUP_AtmosStats);
+DECLARE_MEMORY_STAT(TEXT("Atmos level of detail"), STAT_AtmosLevelOfDetailMemory, STATGROUP_AtmosStats);
+DECLARE_MEMORY_STAT(TEXT("Atmos peak transient"), STAT_AtmosPeakTransientMemory, STATGROUP_AtmosStats);
+DECLARE_MEMORY_STAT(TEXT("Atmos total memory"), STAT_AtmosTotalMemory, STATGROUP_AtmosStats);
 
-void FFluidSimulationManager::setSize(FVector size)
+// Breaches stay at full detail for this long, by then the zone behind them is mostly empty
+static const float BreachEventSeconds = 30.0f;
+
+// The governor restores a quality level after this many ticks in a row that took less than this part of the budget
+static const int32 HeadroomTicks = 30;
+static const float HeadroomFraction = 0.5f;
+
+// Schedule radius the far update rate reduction starts from when the schedule is disabled
+static const int32 DegradedScheduleRadius = 64;
+
+// Gas commands that may wait for a tick, enough for the vents and scrubbers of a station pushing every frame
+static const int32 GasQueueCapacity = 4096;
+
+namespace {
+// Cells of the grid for a size in tiles, with the boundary cells around them
+FIntVector gridSize(const FVector& size)
 {
-    m_size = {FMath::CeilToInt(size.X), FMath::CeilToInt(size.Y), FMath::CeilToInt(size.Z)};
-    // add boundaries
-    m_size += FIntVector(2);
+    return FIntVector(FMath::CeilToInt(size.X), FMath::CeilToInt(size.Y), FMath::CeilToInt(size.Z)) + FIntVector(2);
 }
 
-void FFluidSimulationManager::start()
+// Every manager alive, for Atmos.Memory
+FCriticalSection GManagersLock;
+TArray<FFluidSimulationManager*> GManagers;
+
+float toMiB(SIZE_T bytes)
 {
-    m_thread.Reset(FRunnableThread::Create(this, TEXT("FFluidSimulationManager")));
+    return bytes / (1024.0f * 1024.0f);
 }
 
-bool FFluidSimulationManager::Init()
+void logMemoryUsage()
 {
-    m_sim = MakeUnique<FluidSimulation3D>(m_size.X, m_size.Y, m_size.Z, 0.1f);
-    UE_LOG(LogFluidSimulation, Log, TEXT("Atmo thread init start"));
+    FScopeLock lock(&GManagersLock);
+    auto running = 0;
+    for(const auto* manager : GManagers)
+    {
+        const auto usage = manager->getMemoryUsage();
+        if(usage.total() == 0)
+        {
+            continue;
+        }
+        UE_LOG(LogFluidSimulation,
+               Display,
+               TEXT("Atmos simulation %d: total %.2f MiB, peak transient %.2f MiB"),
+               running++,
+               toMiB(usage.total()),
+               toMiB(usage.peakTransient));
+        UE_LOG(LogFluidSimulation,
+               Display,
+               TEXT("  solids %.2f, velocity %.2f, gases %.2f, curl %.2f, total pressure %.2f MiB"),
+               toMiB(usage.solids),
+               toMiB(usage.velocity),
+               toMiB(usage.gases),
+               toMiB(usage.curl),
+               toMiB(usage.totalPressure));
+        UE_LOG(LogFluidSimulation,
+               Display,
+               TEXT("  advection scratch %.2f, diffusion scratch %.2f, level of detail %.2f MiB"),
+               toMiB(usage.advectionScratch),
+               toMiB(usage.diffusionScratch),
+               toMiB(usage.levelOfDetail));
+    }
+    if(running == 0)
+    {
+        UE_LOG(LogFluidSimulation, Display, TEXT("No atmos simulation is running"));
+    }
+}
+} // namespace
+
+static FAutoConsoleCommand GAtmosMemory(TEXT("Atmos.Memory"),
+                                        TEXT("Logs the memory held by every running atmos simulation"),
+                                        FConsoleCommandDelegate::CreateStatic(&logMemoryUsage));
+
+FFluidSimulationManager::FFluidSimulationManager()
+  : m_isTaskStopped(true)
+  , m_size(1, 1, 1)
+  , m_resizedRequest(0)
+  , m_inputResize(0)
+  , m_layout(EArray3DLayout::Linear)
+  , m_padRows(true)
+  , m_advectionScheme(EAdvectionScheme::Conservative)
+  , m_parallelAdvection(false)
+  , m_ispcKernels(false)
+  , m_deterministic(false)
+  , m_adaptiveTimeStep(true)
+  , m_cflNumber(1.0f)
+  , m_minTimeStep(1.0f / 30.0f)
+  , m_maxTimeStep(0.25f)
+  , m_maxSubSteps(1)
+  , m_detailRadius(100)
+  , m_coarseFactor(2)
+  , m_scheduleRadius(50)
+  , m_focusChanged(false)
+  , m_ventRate(1.0f)
+  , m_gasQueue(GasQueueCapacity)
+  , m_steadyVelocity(0.01f)
+  , m_steadyPressure(0.01f)
+  , m_steadyTicks(30)
+  , m_wakeEvent(FPlatformProcess::GetSynchEventFromPool(false))
+  , m_isIdle(false)
+  , m_hasWork(false)
+  , m_tickTime(0.0)
+  , m_diffusionIterations(15)
+  , m_vorticity(0.03f)
+  , m_tickBudget(1.0f / 30.0f)
+  , m_qualityLevel(0)
+  , m_headroomTicks(0)
+  , m_threadPriority(TPri_Normal)
+  , m_threadAffinity(FPlatformAffinity::GetNoAffinityMask())
+  , m_snapshotInterval(0.25f)
+  , m_snapshotQuantum(0.1f)
+  , m_snapshotTime(0.0)
+  , m_overlayEnabled(false)
+  , m_memoryBudget(0)
+  , m_scheduler(nullptr)
+  , m_schedulePriority(0)
+  , m_scheduleMaxRate(0.0f)
+{
+    FluidProperties gas;
+    gas.diffusion = 1.0f;
+    gas.advection = 1.0f;
+    m_gasProperties.Init(gas, EGasType::GasTypeCount);
+    m_resizeOffsets.Add(FIntVector::ZeroValue);
+
+    m_degradationOrder = {EAtmosDegradation::DiffusionIterations,
+                          EAtmosDegradation::Vorticity,
+                          EAtmosDegradation::FarUpdateRate,
+                          EAtmosDegradation::DiffusionIterations,
+                          EAtmosDegradation::FarUpdateRate};
 
+    FScopeLock lock(&GManagersLock);
+    GManagers.Add(this);
+}
+
+FFluidSimulationManager::~FFluidSimulationManager()
+{
+    if(m_scheduler != nullptr)
+    {
+        m_scheduler->remove(this);
+    }
+    if(m_resizeTask.IsValid())
+    {
+        m_resizeTask.Wait();
+    }
     {
-        Fluid3D::SetterDelegate binder;
-        binder.BindRaw(this, &FFluidSimulationManager::initializeAtmoCell, static_cast<uint32>(0));
-        m_sim->pressure().oxigen().destination().set(binder);
-        UE_LOG(LogFluidSimulation, Log, TEXT("Atmo O2 values loaded"));
+        FScopeLock lock(&GManagersLock);
+        GManagers.RemoveSingleSwap(this);
     }
+    FPlatformProcess::ReturnSynchEventToPool(m_wakeEvent);
+    m_wakeEvent = nullptr;
+}
 
+bool FFluidSimulationManager::setSize(FVector size)
+{
+    m_size = gridSize(size);
+    return fitMemoryBudget(m_size);
+}
+
+bool FFluidSimulationManager::resize(FVector size, const FIntVector& offset)
+{
+    if(!isStarted())
     {
-        Fluid3D::SetterDelegate binder;
-        binder.BindRaw(this, &FFluidSimulationManager::initializeAtmoCell, static_cast<uint32>(1));
-        m_sim->pressure().nitrogen().destination().set(binder);
-        UE_LOG(LogFluidSimulation, Log, TEXT("Atmo N2 values loaded"));
+        return setSize(size);
     }
 
+    // One build at a time, it reads the settings fitMemoryBudget() may change
+    if(m_resizeTask.IsValid())
+    {
+        m_resizeTask.Wait();
+    }
+    const auto newSize = gridSize(size);
+    if(!fitMemoryBudget(newSize))
+    {
+        return false;
+    }
+    // Offsets are relative to the previous request, whether that one was swapped in or not
+    int32 request;
     {
-        Fluid3D::SetterDelegate binder;
-        binder.BindRaw(this, &FFluidSimulationManager::initializeAtmoCell, static_cast<uint32>(2));
-        m_sim->pressure().carbonDioxide().destination().set(binder);
-        UE_LOG(LogFluidSimulation, Log, TEXT("Atmo CO2 values loaded"));
+        FScopeLock lock(&m_frameLock);
+        m_resizeOffsets.Add(m_resizeOffsets.Last() + offset);
+        request = m_resizeOffsets.Num() - 1;
     }
+    m_resizeTask = Async<void>(EAsyncExecution::ThreadPool, [this, newSize, request]() {
+        auto sim = createSimulation(newSize);
+        {
+            FScopeLock lock(&m_resizeLock);
+            m_resized = MoveTemp(sim);
+            m_resizedRequest = request;
+        }
+        signal();
+    });
+    return true;
+}
+
+int32 FFluidSimulationManager::requestedResize() const
+{
+    FScopeLock lock(&m_frameLock);
+    return m_resizeOffsets.Num() - 1;
+}
+
+void FFluidSimulationManager::acknowledgeResize(int32 request)
+{
+    FScopeLock lock(&m_frameLock);
+    m_gameResize.Set(FMath::Clamp(request, 0, m_resizeOffsets.Num() - 1));
+}
 
+FIntVector FFluidSimulationManager::inputCell(const FIntVector& cell) const
+{
+    return cell + m_resizeOffsets[m_inputResize] - m_resizeOffsets[m_gameResize.GetValue()];
+}
+
+FIntVector FFluidSimulationManager::runningCell(const FIntVector& cell) const
+{
+    FScopeLock lock(&m_frameLock);
+    return cell + m_resizeOffsets[m_runningResize.GetValue()] - m_resizeOffsets[m_gameResize.GetValue()];
+}
+
+void FFluidSimulationManager::applyResize()
+{
+    TUniquePtr<FluidSimulation3D> sim;
+    int32 request;
     {
-        Fluid3D::SetterDelegate binder;
-        binder.BindRaw(this, &FFluidSimulationManager::initializeAtmoCell, static_cast<uint32>(3));
-        m_sim->pressure().toxin().destination().set(binder);
-        UE_LOG(LogFluidSimulation, Log, TEXT("Atmo Toxin values loaded"));
+        FScopeLock lock(&m_resizeLock);
+        if(!m_resized.IsValid())
+        {
+            return;
+        }
+        sim = MoveTemp(m_resized);
+        request = m_resizedRequest;
     }
 
-    // apply to source
-    m_sim->pressure().swap();
+    // Edits queued so far go to the running grid, everything queued from here on addresses the new one
+    FIntVector offset;
+    {
+        FScopeLock lock(&m_frameLock);
+        applyEdits();
+        offset = m_resizeOffsets[request] - m_resizeOffsets[m_inputResize];
+        m_inputResize = request;
+        {
+            FScopeLock focusLock(&m_focusLock);
+            for(auto& point : m_focus)
+            {
+                point += offset;
+            }
+            for(auto& event : m_events)
+            {
+                event.cell += offset;
+            }
+            m_focusChanged = true;
+        }
+        m_subscriptions.move(offset);
+    }
 
-    // reset velocity map
-    m_sim->velocity().reset(0.0f);
+    sim->copyFrom(*m_sim, offset);
+    {
+        FScopeLock lock(&m_simLock);
+        Swap(m_sim, sim);
+        m_size = FIntVector(m_sim->depth(), m_sim->width(), m_sim->height());
+        m_runningResize.Set(request);
+    }
+    UE_LOG(LogFluidSimulation, Log, TEXT("Atmo grid resized to %dx%dx%d"), m_size.X, m_size.Y, m_size.Z);
+    applyQuality();
+    updateMemoryUsage();
+}
 
-    // set solids
+bool FFluidSimulationManager::fitMemoryBudget(const FIntVector& size)
+{
+    const auto estimate = [this, &size]() {
+        const auto usage =
+          FluidSimulation3D::estimateMemory(size.X, size.Y, size.Z, gridPolicy(), m_advectionScheme, m_coarseFactor);
+        return usage.total();
+    };
+    if(m_memoryBudget == 0 || estimate() <= m_memoryBudget)
+    {
+        return true;
+    }
+    const auto padRows = m_padRows;
+    const auto layout = m_layout;
+    const auto advectionScheme = m_advectionScheme;
+
+    // Storage only costs speed, so it goes first. Conservative advection allocates twelve grids of scratch at once,
+    // MacCormack one grid for the whole update
+    if(m_padRows)
+    {
+        m_padRows = false;
+        UE_LOG(LogFluidSimulation, Warning, TEXT("Atmos grid over the memory budget, rows are no longer padded"));
+    }
+    if(estimate() > m_memoryBudget && m_layout == EArray3DLayout::Morton)
+    {
+        m_layout = EArray3DLayout::Linear;
+        UE_LOG(LogFluidSimulation, Warning, TEXT("Atmos grid over the memory budget, using the linear layout"));
+    }
+    if(estimate() > m_memoryBudget && m_advectionScheme == EAdvectionScheme::Conservative)
+    {
+        m_advectionScheme = EAdvectionScheme::MacCormack;
+        UE_LOG(LogFluidSimulation, Warning, TEXT("Atmos grid over the memory budget, using MacCormack advection"));
+    }
+
+    const auto bytes = estimate();
+    if(bytes > m_memoryBudget)
     {
-        TBaseDelegate<EFlowDirection, int32, int32, int32> binder;
-        binder.BindRaw(this, &FFluidSimulationManager::initializeSolid);
-        m_sim->solids().set(binder);
+        UE_LOG(LogFluidSimulation,
+               Error,
+               TEXT("Atmos grid of %dx%dx%d cells needs %.2f MiB, over the memory budget of %.2f MiB"),
+               size.X,
+               size.Y,
+               size.Z,
+               toMiB(bytes),
+               toMiB(m_memoryBudget));
+        // A refused grid leaves the settings as they were
+        m_padRows = padRows;
+        m_layout = layout;
+        m_advectionScheme = advectionScheme;
+        return false;
     }
+    return true;
+}
 
-    m_sim->diffusionIterations(15);
-    m_sim->pressureAccel(1.0f);
-    m_sim->vorticity(0.03f);
+void FFluidSimulationManager::setFocus(const TArray<FIntVector>& focus)
+{
+    FScopeLock frameLock(&m_frameLock);
+    auto points = focus;
+    for(auto& point : points)
+    {
+        point = inputCell(point);
+    }
+    FScopeLock lock(&m_focusLock);
+    if(m_focus != points)
+    {
+        m_focus = MoveTemp(points);
+        m_focusChanged = true;
+    }
+}
+
+void FFluidSimulationManager::addActiveEvent(const FIntVector& cell, float seconds)
+{
+    FScopeLock frameLock(&m_frameLock);
+    FScopeLock lock(&m_focusLock);
+    m_events.Add({inputCell(cell), FPlatformTime::Seconds() + seconds});
+    m_focusChanged = true;
+}
 
-    m_sim->pressure().properties().diffusion = 1.0f;
-    m_sim->pressure().properties().advection = 1.0f;
+void FFluidSimulationManager::breach(const FIntVector& cell, EFlowDirection face)
+{
+    FScopeLock lock(&m_frameLock);
+    addActiveEvent(cell, BreachEventSeconds);
+    const auto target = inputCell(cell);
+    enqueue([target, face](FluidSimulation3D& sim) { sim.breach(target.X, target.Y, target.Z, face); });
+}
 
-    m_sim->velocity().properties().diffusion = 1.0f;
-    m_sim->velocity().properties().advection = 1.0f;
-    m_sim->velocity().properties().decay = 0.5f;
+void FFluidSimulationManager::seal(const FIntVector& cell, EFlowDirection face)
+{
+    FScopeLock lock(&m_frameLock);
+    const auto target = inputCell(cell);
+    enqueue([target, face](FluidSimulation3D& sim) { sim.seal(target.X, target.Y, target.Z, face); });
+}
+
+void FFluidSimulationManager::setVacuum(const FIntVector& cell, bool value)
+{
+    FScopeLock lock(&m_frameLock);
+    if(value)
+    {
+        addActiveEvent(cell, BreachEventSeconds);
+    }
+    const auto target = inputCell(cell);
+    enqueue([target, value](FluidSimulation3D& sim) { sim.vacuum(target.X, target.Y, target.Z, value); });
+}
+
+void FFluidSimulationManager::setReactions(const TArray<FAtmoReaction>& reactions)
+{
+    {
+        FScopeLock lock(&m_editLock);
+        m_reactions = reactions;
+    }
+    enqueue([reactions](FluidSimulation3D& sim) { sim.reactions(reactions); });
+}
+
+void FFluidSimulationManager::addGas(const FIntVector& cell, const FAtmoStruct& gas)
+{
+    FScopeLock lock(&m_frameLock);
+    const auto target = inputCell(cell);
+    enqueue([target, gas](FluidSimulation3D& sim) {
+        sim.addGas(target.X, target.Y, target.Z, EGasType::O2, gas.O2);
+        sim.addGas(target.X, target.Y, target.Z, EGasType::N2, gas.N2);
+        sim.addGas(target.X, target.Y, target.Z, EGasType::CO2, gas.CO2);
+        sim.addGas(target.X, target.Y, target.Z, EGasType::Toxin, gas.Toxin);
+    });
+}
+
+void FFluidSimulationManager::drainGas(const FIntVector& cell,
+                                       const FAtmoStruct& gas,
+                                       TFunction<void(const FAtmoStruct&)>&& drained)
+{
+    FScopeLock lock(&m_frameLock);
+    const auto target = inputCell(cell);
+    enqueue([target, gas, drained = MoveTemp(drained)](FluidSimulation3D& sim) {
+        FAtmoStruct removed;
+        removed.O2 = -sim.addGas(target.X, target.Y, target.Z, EGasType::O2, -gas.O2);
+        removed.N2 = -sim.addGas(target.X, target.Y, target.Z, EGasType::N2, -gas.N2);
+        removed.CO2 = -sim.addGas(target.X, target.Y, target.Z, EGasType::CO2, -gas.CO2);
+        removed.Toxin = -sim.addGas(target.X, target.Y, target.Z, EGasType::Toxin, -gas.Toxin);
+        drained(removed);
+    });
+}
+
+bool FFluidSimulationManager::queueGas(const FAtmoGasCommand& command)
+{
+    // The cells are moved to the running grid when the command is applied
+    auto stamped = command;
+    stamped.resize = m_gameResize.GetValue();
+    if(!m_gasQueue.push(stamped))
+    {
+        return false;
+    }
+    // A running grid drains the queue on its next tick anyway, only a parked one has to be woken
+    if(m_isIdle)
+    {
+        signal();
+    }
+    return true;
+}
+
+void FFluidSimulationManager::wake()
+{
+    enqueue([](FluidSimulation3D& sim) { sim.wake(); });
+}
+
+void FFluidSimulationManager::applyGasCommands(float elapsed)
+{
+    // Commands address the grid the caller mapped them on, see acknowledgeResize()
+    const auto resize = m_runningResize.GetValue();
+    if(m_gasCommands.ContainsByPredicate([resize](const FAtmoGasCommand& command) { return command.resize != resize; }))
+    {
+        FScopeLock lock(&m_frameLock);
+        for(auto& command : m_gasCommands)
+        {
+            const auto offset = m_resizeOffsets[resize] - m_resizeOffsets[command.resize];
+            command.position += FVector(offset);
+            command.max += offset;
+            command.resize = resize;
+        }
+    }
+    SET_DWORD_STAT(STAT_AtmosGasCommands, m_gasCommands.Num());
+    SET_DWORD_STAT(STAT_AtmosDroppedGasCommands, m_gasQueue.dropped());
+    // Compacts the commands that keep running in place
+    auto running = 0;
+    for(auto i = 0; i < m_gasCommands.Num(); ++i)
+    {
+        auto& command = m_gasCommands[i];
+        const auto seconds = command.seconds > 0.0f ? FMath::Min(command.seconds, elapsed) : 1.0f;
+        const float rates[EGasType::GasTypeCount] = {
+          command.rate.O2, command.rate.N2, command.rate.CO2, command.rate.Toxin};
+        const FIntVector cell(command.position);
+        for(auto gas = 0; gas < EGasType::GasTypeCount; ++gas)
+        {
+            if(rates[gas] == 0.0f)
+            {
+                continue;
+            }
+            const auto type = static_cast<EGasType::Type>(gas);
+            const auto amount = rates[gas] * seconds;
+            switch(command.shape)
+            {
+            case EAtmoGasShape::Cell: m_sim->addGas(cell.X, cell.Y, cell.Z, type, amount); break;
+            case EAtmoGasShape::Point: m_sim->distributeGas(command.position, type, amount); break;
+            case EAtmoGasShape::Region: m_sim->distributeGas(cell, command.max, type, amount); break;
+            }
+        }
+        command.seconds -= elapsed;
+        if(command.seconds > 0.0f)
+        {
+            m_gasCommands[running++] = command;
+        }
+    }
+    m_gasCommands.SetNum(running, false);
+}
+
+void FFluidSimulationManager::enqueue(TFunction<void(FluidSimulation3D&)>&& edit)
+{
+    {
+        FScopeLock lock(&m_editLock);
+        m_edits.Add(MoveTemp(edit));
+    }
+    signal();
+}
+
+void FFluidSimulationManager::signal()
+{
+    m_hasWork = true;
+    m_wakeEvent->Trigger();
+    if(m_scheduler != nullptr)
+    {
+        m_scheduler->wake();
+    }
+}
+
+void FFluidSimulationManager::start()
+{
+    // The scheduler calls Init() on one of its workers
+    if(m_scheduler != nullptr)
+    {
+        m_scheduler->add(this, m_schedulePriority, m_scheduleMaxRate);
+        return;
+    }
+    m_thread.Reset(
+      FRunnableThread::Create(this, TEXT("FFluidSimulationManager"), 0, m_threadPriority, m_threadAffinity));
+}
+
+void FFluidSimulationManager::setThreadPriority(EThreadPriority priority)
+{
+    m_threadPriority = priority;
+    if(m_thread.IsValid())
+    {
+        m_thread->SetThreadPriority(priority);
+    }
+}
+
+bool FFluidSimulationManager::Init()
+{
+    // Settings may have changed since setSize()
+    if(!fitMemoryBudget(m_size))
+    {
+        return false;
+    }
+    UE_LOG(LogFluidSimulation, Log, TEXT("Atmo thread init start"));
+    m_sim = createSimulation(m_size);
+    m_qualityLevel = 0;
+    m_headroomTicks = 0;
+    m_tickTime = FPlatformTime::Seconds();
+    m_isIdle = false;
+    m_hasWork = false;
+    updateMemoryUsage();
 
     m_isTaskStopped = false;
     UE_LOG(LogFluidSimulation, Log, TEXT("Atmo thread initialized"));
     return true;
 }
 
+TUniquePtr<FluidSimulation3D> FFluidSimulationManager::createSimulation(const FIntVector& size) const
+{
+    auto sim = MakeUnique<FluidSimulation3D>(size.X, size.Y, size.Z, 0.1f, gridPolicy());
+
+    const auto loadGas = [this](FluidPkg3D& gas, uint32 type) {
+        gas.destination().parallelGenerate(
+          [this, type](int32 x, int32 y, int32 z) { return initializeAtmoCell(x, y, z, type); });
+    };
+
+    loadGas(sim->pressure().oxigen(), EGasType::O2);
+    UE_LOG(LogFluidSimulation, Log, TEXT("Atmo O2 values loaded"));
+
+    loadGas(sim->pressure().nitrogen(), EGasType::N2);
+    UE_LOG(LogFluidSimulation, Log, TEXT("Atmo N2 values loaded"));
+
+    loadGas(sim->pressure().carbonDioxide(), EGasType::CO2);
+    UE_LOG(LogFluidSimulation, Log, TEXT("Atmo CO2 values loaded"));
+
+    loadGas(sim->pressure().toxin(), EGasType::Toxin);
+    UE_LOG(LogFluidSimulation, Log, TEXT("Atmo Toxin values loaded"));
+
+    // apply to source
+    sim->pressure().swap();
+
+    // reset velocity map
+    sim->velocity().reset(0.0f);
+
+    // set solids
+    sim->solids().parallelGenerate(
+      [this, &size](int32 x, int32 y, int32 z) { return initializeSolid(size, x, y, z); });
+
+    sim->diffusionIterations(m_diffusionIterations);
+    sim->pressureAccel(1.0f);
+    sim->vorticity(m_vorticity);
+
+    for(auto gas = 0; gas < EGasType::GasTypeCount; ++gas)
+    {
+        sim->pressure().gas(static_cast<EGasType::Type>(gas)).properties() = m_gasProperties[gas];
+    }
+    {
+        FScopeLock lock(&m_editLock);
+        sim->reactions(m_reactions);
+    }
+
+    sim->velocity().properties().diffusion = 1.0f;
+    sim->velocity().properties().advection = 1.0f;
+    sim->velocity().properties().decay = 0.5f;
+
+    sim->advectionScheme(m_advectionScheme);
+    sim->parallelAdvection(m_parallelAdvection);
+    sim->ispcKernels(m_ispcKernels);
+    sim->deterministic(m_deterministic);
+    sim->coarseFactor(m_coarseFactor);
+    sim->detailRadius(m_detailRadius);
+    sim->scheduleRadius(m_scheduleRadius);
+    sim->ventRate(m_ventRate);
+    sim->steadyVelocity(m_steadyVelocity);
+    sim->steadyPressure(m_steadyPressure);
+    sim->steadyTicks(m_steadyTicks);
+    return sim;
+}
+
 uint32 FFluidSimulationManager::Run()
 {
-    auto timestamp = FPlatformTime::Seconds();
     // Initial wait before starting
     FPlatformProcess::Sleep(0.03);
     UE_LOG(LogFluidSimulation, Log, TEXT("Atmo thread started"));
@@ -107,14 +653,17 @@ uint32 FFluidSimulationManager::Run()
     {
         if(!m_sim.IsValid())
             break;
-        const auto waitInterval = 1.0f / 30.0f;
-        auto delta = FPlatformTime::Seconds() - timestamp;
-        if(delta < waitInterval)
-            FPlatformProcess::Sleep(waitInterval - delta);
-        delta = FPlatformTime::Seconds() - timestamp;
-        m_sim->dt(delta);
-        m_sim->update();
-        timestamp = FPlatformTime::Seconds();
+        // A parked grid waits for work, which triggers the event. Work queued since the last tick returns the
+        // wait at once
+        if(m_isIdle && !m_hasWork)
+        {
+            m_wakeEvent->Wait();
+            continue;
+        }
+        const auto wait = nextTickTime() - FPlatformTime::Seconds();
+        if(wait > 0.0)
+            FPlatformProcess::Sleep(wait);
+        tick();
     }
     UE_LOG(LogFluidSimulation, Log, TEXT("Atmo thread is exited"));
     m_isTaskStopped = false;
@@ -123,67 +672,335 @@ uint32 FFluidSimulationManager::Run()
     return 0;
 }
 
+double FFluidSimulationManager::nextTickTime() const
+{
+    if(m_isIdle)
+    {
+        return m_hasWork ? 0.0 : TNumericLimits<double>::Max();
+    }
+    return m_tickTime + stepInterval();
+}
+
+void FFluidSimulationManager::tick()
+{
+    m_hasWork = false;
+    applyResize();
+    applyFocus();
+    applyEdits();
+    // Room for a full queue next to the commands still running, the drain itself never reallocates
+    m_gasCommands.Reserve(m_gasCommands.Num() + m_gasQueue.capacity());
+    if(m_gasQueue.drain(m_gasCommands) > 0)
+    {
+        m_sim->keepAwake();
+    }
+    // Nothing changes on a steady grid, it is parked until there is work
+    if(m_sim->isSteady())
+    {
+        // New subscriptions learn their state before parking, otherwise the next tick reports it
+        if(m_subscriptions.hasPending())
+        {
+            m_subscriptions.evaluate(*m_sim);
+        }
+        m_isIdle = true;
+        SET_DWORD_STAT(STAT_AtmosIdle, 1);
+        // A command pushed while parking saw the grid running and did not signal
+        if(!m_gasQueue.isEmpty())
+        {
+            signal();
+        }
+        return;
+    }
+    if(m_isIdle)
+    {
+        // The time spent parked does not count, the first step follows one interval after waking
+        m_isIdle = false;
+        SET_DWORD_STAT(STAT_AtmosIdle, 0);
+        m_tickTime = FPlatformTime::Seconds();
+        return;
+    }
+
+    // Split a late update so that no single step exceeds the stable one. Deterministic ticks take the nominal
+    // interval, the wall clock differs between runs
+    const auto elapsed =
+      m_deterministic ? stepInterval() : static_cast<float>(FPlatformTime::Seconds() - m_tickTime);
+    const auto stableStep = m_adaptiveTimeStep ? m_sim->stableTimeStep(m_cflNumber) : elapsed;
+    const auto subSteps = FMath::Clamp(FMath::CeilToInt(elapsed / stableStep), 1, m_maxSubSteps);
+    m_sim->dt(elapsed / subSteps);
+    const auto tickStart = FPlatformTime::Seconds();
+    applyGasCommands(elapsed);
+    for(auto step = 0; step < subSteps; ++step)
+    {
+        m_sim->update();
+    }
+    governQuality(FPlatformTime::Seconds() - tickStart);
+    updateMemoryUsage();
+    m_subscriptions.evaluate(*m_sim);
+    if(m_snapshotInterval > 0.0f && FPlatformTime::Seconds() - m_snapshotTime >= m_snapshotInterval)
+    {
+        captureSnapshot();
+    }
+    SET_FLOAT_STAT(STAT_AtmosTimeStep, m_sim->dt());
+    SET_FLOAT_STAT(STAT_AtmosMaxVelocity, m_sim->maxVelocity());
+    SET_FLOAT_STAT(STAT_AtmosVented, m_sim->vented());
+    m_tickTime = FPlatformTime::Seconds();
+}
+
+float FFluidSimulationManager::stepInterval() const
+{
+    if(!m_adaptiveTimeStep)
+    {
+        return m_minTimeStep;
+    }
+    // Wait for as long as the flow allows, but keep reacting to changes at a minimum rate
+    return FMath::Clamp(m_sim->stableTimeStep(m_cflNumber), m_minTimeStep, m_maxTimeStep);
+}
+
+void FFluidSimulationManager::governQuality(double tickTime)
+{
+    SET_FLOAT_STAT(STAT_AtmosTickTime, tickTime);
+    if(m_tickBudget <= 0.0f || m_deterministic)
+    {
+        return;
+    }
+
+    // Give up one level at once when late, win it back only after a while with room to spare
+    if(tickTime > m_tickBudget)
+    {
+        INC_DWORD_STAT(STAT_AtmosBudgetMisses);
+        m_headroomTicks = 0;
+        if(m_qualityLevel < m_degradationOrder.Num())
+        {
+            ++m_qualityLevel;
+            applyQuality();
+        }
+    }
+    else if(tickTime < m_tickBudget * HeadroomFraction && m_qualityLevel > 0)
+    {
+        if(++m_headroomTicks >= HeadroomTicks)
+        {
+            --m_qualityLevel;
+            m_headroomTicks = 0;
+            applyQuality();
+        }
+    }
+    else
+    {
+        m_headroomTicks = 0;
+    }
+    SET_DWORD_STAT(STAT_AtmosQualityLevel, m_qualityLevel);
+}
+
+void FFluidSimulationManager::applyQuality()
+{
+    auto iterations = m_diffusionIterations;
+    auto vorticity = m_vorticity;
+    auto scheduleRadius = m_scheduleRadius;
+    for(auto level = 0; level < m_qualityLevel; ++level)
+    {
+        switch(m_degradationOrder[level])
+        {
+        case EAtmosDegradation::DiffusionIterations: iterations = FMath::Max(iterations / 2, 1); break;
+        case EAtmosDegradation::Vorticity: vorticity = 0.0f; break;
+        case EAtmosDegradation::FarUpdateRate:
+            scheduleRadius = FMath::Max((scheduleRadius > 0 ? scheduleRadius : DegradedScheduleRadius) / 2, 1);
+            break;
+        }
+    }
+    m_sim->diffusionIterations(iterations);
+    m_sim->vorticity(vorticity);
+    if(m_sim->scheduleRadius() != scheduleRadius)
+    {
+        // The schedule is rebuilt with the next focus update
+        m_sim->scheduleRadius(scheduleRadius);
+        FScopeLock lock(&m_focusLock);
+        m_focusChanged = true;
+    }
+}
+
+void FFluidSimulationManager::captureSnapshot()
+{
+    m_snapshotTime = FPlatformTime::Seconds();
+    const auto previous = getSnapshot();
+    const auto snapshot =
+      MakeShared<AtmoSnapshot3D, ESPMode::ThreadSafe>(m_size.X, m_size.Y, m_size.Z, m_snapshotQuantum);
+    snapshot->capture(m_sim->pressure(), previous.Get());
+    if(m_overlayEnabled)
+    {
+        m_overlay.capture(*snapshot);
+    }
+
+    FScopeLock lock(&m_snapshotLock);
+    m_snapshot = snapshot;
+}
+
+void FFluidSimulationManager::updateMemoryUsage()
+{
+    const auto usage = m_sim->memoryUsage();
+    SET_MEMORY_STAT(STAT_AtmosSolidsMemory, usage.solids);
+    SET_MEMORY_STAT(STAT_AtmosVelocityMemory, usage.velocity);
+    SET_MEMORY_STAT(STAT_AtmosGasesMemory, usage.gases);
+    SET_MEMORY_STAT(STAT_AtmosCurlMemory, usage.curl);
+    SET_MEMORY_STAT(STAT_AtmosTotalPressureMemory, usage.totalPressure);
+    SET_MEMORY_STAT(STAT_AtmosAdvectionScratchMemory, usage.advectionScratch);
+    SET_MEMORY_STAT(STAT_AtmosDiffusionScratchMemory, usage.diffusionScratch);
+    SET_MEMORY_STAT(STAT_AtmosLevelOfDetailMemory, usage.levelOfDetail);
+    SET_MEMORY_STAT(STAT_AtmosPeakTransientMemory, usage.peakTransient);
+    SET_MEMORY_STAT(STAT_AtmosTotalMemory, usage.total());
+
+    FScopeLock lock(&m_memoryLock);
+    m_memoryUsage = usage;
+}
+
+FAtmosMemoryUsage FFluidSimulationManager::getMemoryUsage() const
+{
+    FScopeLock lock(&m_memoryLock);
+    return m_memoryUsage;
+}
+
+int32 FFluidSimulationManager::subscribe(const FAtmoSubscription& subscription)
+{
+    auto handle = INDEX_NONE;
+    {
+        // Held while adding, so that a resize moves the box either with the others or not at all
+        FScopeLock lock(&m_frameLock);
+        auto moved = subscription;
+        moved.min = inputCell(subscription.min);
+        moved.max = inputCell(subscription.max);
+        handle = m_subscriptions.add(moved);
+    }
+    signal();
+    return handle;
+}
+
+TSharedPtr<const AtmoSnapshot3D, ESPMode::ThreadSafe> FFluidSimulationManager::getSnapshot() const
+{
+    FScopeLock lock(&m_snapshotLock);
+    return m_snapshot;
+}
+
+void FFluidSimulationManager::applyFocus()
+{
+    FScopeLock lock(&m_focusLock);
+    const auto now = FPlatformTime::Seconds();
+    const auto expired = m_events.RemoveAll([now](const FActiveEvent& event) { return event.expiry <= now; });
+    if(!m_focusChanged && expired == 0)
+    {
+        return;
+    }
+
+    auto points = m_focus;
+    for(const auto& event : m_events)
+    {
+        points.Add(event.cell);
+    }
+    m_sim->focus(points);
+    m_focusChanged = false;
+}
+
+void FFluidSimulationManager::applyEdits()
+{
+    TArray<TFunction<void(FluidSimulation3D&)>> edits;
+    {
+        FScopeLock lock(&m_editLock);
+        Swap(edits, m_edits);
+    }
+    for(const auto& edit : edits)
+    {
+        edit(*m_sim);
+    }
+}
+
 void FFluidSimulationManager::Stop()
 {
     m_isTaskStopped = true;
+    if(m_scheduler != nullptr)
+    {
+        m_scheduler->remove(this);
+        return;
+    }
+    m_wakeEvent->Trigger();
     m_thread->WaitForCompletion();
 }
 
 FAtmoStruct FFluidSimulationManager::getPressure(int32 x, int32 y, int32 z) const
 {
-    if(x < 0 || x >= m_size.X)
+    FScopeLock lock(&m_simLock);
+    const auto cell = runningCell(FIntVector(x, y, z));
+    if(cell.X < 0 || cell.X >= m_size.X)
     {
         return {};
     }
-    if(y < 0 || y >= m_size.Y)
+    if(cell.Y < 0 || cell.Y >= m_size.Y)
     {
         return {};
     }
-    if(z < 0 || z >= m_size.Z)
+    if(cell.Z < 0 || cell.Z >= m_size.Z)
     {
         return {};
     }
 
     FAtmoStruct atmo;
-    atmo.O2 = m_sim->pressure().oxigen().source().element(x, y, z);
-    atmo.N2 = m_sim->pressure().nitrogen().source().element(x, y, z);
-    atmo.CO2 = m_sim->pressure().carbonDioxide().source().element(x, y, z);
-    atmo.Toxin = m_sim->pressure().toxin().source().element(x, y, z);
+    atmo.O2 = m_sim->pressure().oxigen().source().element(cell.X, cell.Y, cell.Z);
+    atmo.N2 = m_sim->pressure().nitrogen().source().element(cell.X, cell.Y, cell.Z);
+    atmo.CO2 = m_sim->pressure().carbonDioxide().source().element(cell.X, cell.Y, cell.Z);
+    atmo.Toxin = m_sim->pressure().toxin().source().element(cell.X, cell.Y, cell.Z);
 
     return atmo;
 }
 
+float FFluidSimulationManager::getTotalPressure(int32 x, int32 y, int32 z) const
+{
+    FScopeLock lock(&m_simLock);
+    const auto cell = runningCell(FIntVector(x, y, z));
+    if(cell.X < 0 || cell.X >= m_size.X)
+    {
+        return 0.0f;
+    }
+    if(cell.Y < 0 || cell.Y >= m_size.Y)
+    {
+        return 0.0f;
+    }
+    if(cell.Z < 0 || cell.Z >= m_size.Z)
+    {
+        return 0.0f;
+    }
+
+    return m_sim->totalPressure().element(cell.X, cell.Y, cell.Z);
+}
+
 FVector FFluidSimulationManager::getVelocity(int32 x, int32 y, int32 z) const
 {
-    if(x < 0 || x >= m_size.X)
+    FScopeLock lock(&m_simLock);
+    const auto cell = runningCell(FIntVector(x, y, z));
+    if(cell.X < 0 || cell.X >= m_size.X)
         return {};
-    if(y < 0 || y >= m_size.Y)
+    if(cell.Y < 0 || cell.Y >= m_size.Y)
         return {};
-    if(z < 0 || z >= m_size.Z)
+    if(cell.Z < 0 || cell.Z >= m_size.Z)
         return {};
 
-    const auto sourceX = m_sim->velocity().sourceX().element(x, y, z);
-    const auto sourceY = m_sim->velocity().sourceY().element(x, y, z);
-    const auto sourceZ = m_sim->velocity().sourceZ().element(x, y, z);
+    const auto sourceX = m_sim->velocity().sourceX().element(cell.X, cell.Y, cell.Z);
+    const auto sourceY = m_sim->velocity().sourceY().element(cell.X, cell.Y, cell.Z);
+    const auto sourceZ = m_sim->velocity().sourceZ().element(cell.X, cell.Y, cell.Z);
 
     return {sourceX, sourceY, sourceZ};
 }
 
-EFlowDirection FFluidSimulationManager::initializeSolid(int32 x, int32 y, int32 z) const
+EFlowDirection FFluidSimulationManager::initializeSolid(const FIntVector& size, int32 x, int32 y, int32 z) const
 {
     // Which direction is blocked
     auto mask = EFlowDirection::None;
     if(x <= 0)
         mask |= EFlowDirection::XMinus;
-    if(x >= m_size.X - 1)
+    if(x >= size.X - 1)
         mask |= EFlowDirection::XPlus;
     if(y <= 0)
         mask |= EFlowDirection::YMinus;
-    if(y >= m_size.Y - 1)
+    if(y >= size.Y - 1)
         mask |= EFlowDirection::YPlus;
     if(z <= 0)
         mask |= EFlowDirection::ZMinus;
-    if(z >= m_size.Z - 1)
+    if(z >= size.Z - 1)
         mask |= EFlowDirection::ZPlus;
     return mask;
 }
@@ -191,6 +1008,8 @@ EFlowDirection FFluidSimulationManager::initializeSolid(int32 x, int32 y, int32
 float FFluidSimulationManager::initializeAtmoCell(int32 x, int32 y, int32 z, uint32 type) const
 {
     // TODO: Load from file
-    // For now just random
-    return FMath::FRandRange(10.0f, 1200.0f);
+    // For now just random. Cells are filled from worker threads, so every cell gets its own stream
+    const auto seed = HashCombine(HashCombine(GetTypeHash(x), GetTypeHash(y)), HashCombine(GetTypeHash(z), type));
+    const FRandomStream stream(static_cast<int32>(seed));
+    return stream.FRandRange(10.0f, 1200.0f);
 }
@@ -0,0 +1,345 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "FluidSimulationScheduler.h"
+
+#include "FluidSimulationManager.h"
+#include "FluidSimulationModule.h"
+#include "HAL/Event.h"
+#include "Misc/ScopeLock.h"
+
+// Longest a worker waits before it looks for due simulations again
+static const double MaxWaitSeconds = 0.05;
+
+// Flows through a port smaller than this in every gas are held back until they add up, so that coupled grids at
+// rest can park
+static const float MinPortFlow = 0.01f;
+
+class FFluidSimulationScheduler::FWorker : public FRunnable
+{
+public:
+    FWorker(FFluidSimulationScheduler& scheduler, int32 index)
+      : m_scheduler(scheduler)
+      , m_isStopped(false)
+    {
+        m_thread.Reset(FRunnableThread::Create(this, *FString::Printf(TEXT("FFluidSimulationScheduler %d"), index)));
+    }
+
+    uint32 Run() override
+    {
+        while(!m_isStopped)
+        {
+            auto wait = MaxWaitSeconds;
+            auto initialized = true;
+            auto* manager = m_scheduler.acquire(wait, initialized);
+            if(manager == nullptr)
+            {
+                m_scheduler.m_workEvent->Wait(static_cast<uint32>(FMath::CeilToInt(wait * 1000.0)));
+                continue;
+            }
+            m_scheduler.run(manager, initialized);
+        }
+        return 0;
+    }
+
+    void Stop() override { m_isStopped = true; }
+
+    void join() { m_thread->WaitForCompletion(); }
+
+private:
+    FFluidSimulationScheduler& m_scheduler;
+    TUniquePtr<FRunnableThread> m_thread;
+    FThreadSafeBool m_isStopped;
+};
+
+FFluidSimulationScheduler::FFluidSimulationScheduler()
+  : m_workEvent(FPlatformProcess::GetSynchEventFromPool(false))
+  , m_workerCount(FMath::Clamp(FPlatformMisc::NumberOfCores() / 4, 1, 4))
+  , m_nextPort(0)
+{
+}
+
+FFluidSimulationScheduler::~FFluidSimulationScheduler()
+{
+    stopWorkers();
+    FPlatformProcess::ReturnSynchEventToPool(m_workEvent);
+    m_workEvent = nullptr;
+}
+
+FFluidSimulationScheduler& FFluidSimulationScheduler::get()
+{
+    static FFluidSimulationScheduler scheduler;
+    return scheduler;
+}
+
+void FFluidSimulationScheduler::setWorkerCount(int32 count)
+{
+    FScopeLock lock(&m_workerLock);
+    m_workerCount = FMath::Max(count, 1);
+}
+
+void FFluidSimulationScheduler::add(FFluidSimulationManager* manager, int32 priority, float maxRate)
+{
+    {
+        FScopeLock lock(&m_lock);
+        m_entries.Add({manager, priority, maxRate > 0.0f ? 1.0 / maxRate : 0.0, 0.0, false, false});
+    }
+    startWorkers();
+    wake();
+}
+
+void FFluidSimulationScheduler::remove(FFluidSimulationManager* manager)
+{
+    for(;;)
+    {
+        {
+            FScopeLock lock(&m_lock);
+            const auto index =
+              m_entries.IndexOfByPredicate([manager](const FEntry& entry) { return entry.manager == manager; });
+            if(index == INDEX_NONE)
+            {
+                return;
+            }
+            if(!m_entries[index].running)
+            {
+                m_entries.RemoveAt(index);
+                m_ports.RemoveAll([manager](const FPort& port) {
+                    return port.managers[0] == manager || port.managers[1] == manager;
+                });
+                break;
+            }
+        }
+        // A worker is ticking it, which does not take long
+        FPlatformProcess::Sleep(0.001f);
+    }
+    stopWorkers();
+}
+
+int32 FFluidSimulationScheduler::connect(FFluidSimulationManager* managerA,
+                                         const FIntVector& cellA,
+                                         FFluidSimulationManager* managerB,
+                                         const FIntVector& cellB,
+                                         float rate)
+{
+    FScopeLock lock(&m_lock);
+    FPort port;
+    port.handle = m_nextPort++;
+    port.managers[0] = managerA;
+    port.managers[1] = managerB;
+    port.cells[0] = cellA;
+    port.cells[1] = cellB;
+    port.sampled[0] = false;
+    port.sampled[1] = false;
+    port.rate = FMath::Max(rate, 0.0f);
+    port.exchangeTime = FPlatformTime::Seconds();
+    m_ports.Add(port);
+    return port.handle;
+}
+
+void FFluidSimulationScheduler::disconnect(int32 port)
+{
+    FScopeLock lock(&m_lock);
+    m_ports.RemoveAll([port](const FPort& entry) { return entry.handle == port; });
+}
+
+void FFluidSimulationScheduler::wake()
+{
+    m_workEvent->Trigger();
+}
+
+FFluidSimulationManager* FFluidSimulationScheduler::acquire(double& wait, bool& initialized)
+{
+    FScopeLock lock(&m_lock);
+    const auto now = FPlatformTime::Seconds();
+    FEntry* best = nullptr;
+    auto bestDue = 0.0;
+    for(auto& entry : m_entries)
+    {
+        if(entry.running)
+        {
+            continue;
+        }
+        const auto due =
+          entry.initialized ? FMath::Max(entry.manager->nextTickTime(), entry.lastTick + entry.minInterval) : 0.0;
+        if(due > now)
+        {
+            wait = FMath::Min(wait, due - now);
+            continue;
+        }
+        // Highest priority first, the one waiting longest among equals
+        if(best == nullptr || entry.priority > best->priority || (entry.priority == best->priority && due < bestDue))
+        {
+            best = &entry;
+            bestDue = due;
+        }
+    }
+    if(best == nullptr)
+    {
+        return nullptr;
+    }
+    best->running = true;
+    best->lastTick = now;
+    initialized = best->initialized;
+    return best->manager;
+}
+
+void FFluidSimulationScheduler::run(FFluidSimulationManager* manager, bool initialized)
+{
+    // Entries are only removed while they are not running, so the manager outlives this call
+    auto started = true;
+    if(initialized)
+    {
+        manager->tick();
+    }
+    else
+    {
+        started = manager->Init();
+    }
+
+    FScopeLock lock(&m_lock);
+    const auto index =
+      m_entries.IndexOfByPredicate([manager](const FEntry& entry) { return entry.manager == manager; });
+    if(!started)
+    {
+        UE_LOG(LogFluidSimulation, Error, TEXT("Atmos scheduler dropped a simulation that failed to initialize"));
+        m_entries.RemoveAt(index);
+        return;
+    }
+    m_entries[index].running = false;
+    m_entries[index].initialized = true;
+    exchange(manager);
+}
+
+void FFluidSimulationScheduler::exchange(FFluidSimulationManager* manager)
+{
+    // Simulations removed since they were drained get nothing
+    TArray<FCredit> credits;
+    {
+        FScopeLock lock(&m_creditLock);
+        Swap(credits, m_credits);
+    }
+    for(const auto& credit : credits)
+    {
+        if(m_entries.ContainsByPredicate([&credit](const FEntry& entry) { return entry.manager == credit.manager; }))
+        {
+            credit.manager->addGas(credit.cell, credit.gas);
+        }
+    }
+
+    const auto now = FPlatformTime::Seconds();
+    for(auto& port : m_ports)
+    {
+        if(port.managers[0] != manager && port.managers[1] != manager)
+        {
+            continue;
+        }
+        for(auto side = 0; side < 2; ++side)
+        {
+            if(port.managers[side] == manager)
+            {
+                const auto& cell = port.cells[side];
+                port.samples[side] = manager->getPressure(cell.X, cell.Y, cell.Z);
+                port.sampled[side] = true;
+            }
+        }
+        if(!port.sampled[0] || !port.sampled[1])
+        {
+            continue;
+        }
+
+        // Explicit exchange between the latest samples. At most half of the difference flows, so it never
+        // overshoots
+        const auto fraction = FMath::Min(port.rate * static_cast<float>(now - port.exchangeTime), 0.5f);
+        FAtmoStruct flow;
+        flow.O2 = (port.samples[0].O2 - port.samples[1].O2) * fraction;
+        flow.N2 = (port.samples[0].N2 - port.samples[1].N2) * fraction;
+        flow.CO2 = (port.samples[0].CO2 - port.samples[1].CO2) * fraction;
+        flow.Toxin = (port.samples[0].Toxin - port.samples[1].Toxin) * fraction;
+        if(FMath::Max(FMath::Max(FMath::Abs(flow.O2), FMath::Abs(flow.N2)),
+                      FMath::Max(FMath::Abs(flow.CO2), FMath::Abs(flow.Toxin))) < MinPortFlow)
+        {
+            continue;
+        }
+        port.exchangeTime = now;
+
+        // The samples may be a tick old, so every side gives what flows out of it on its own thread, where the cell
+        // is current, and the other side gets what was actually removed. No gas is made or lost. The samples take
+        // the flow into account until the grids tick again
+        const auto add = [](FAtmoStruct& gas, const FAtmoStruct& change, float sign) {
+            gas.O2 += change.O2 * sign;
+            gas.N2 += change.N2 * sign;
+            gas.CO2 += change.CO2 * sign;
+            gas.Toxin += change.Toxin * sign;
+        };
+        for(auto side = 0; side < 2; ++side)
+        {
+            const auto sign = side == 0 ? 1.0f : -1.0f;
+            FAtmoStruct out;
+            out.O2 = FMath::Max(flow.O2 * sign, 0.0f);
+            out.N2 = FMath::Max(flow.N2 * sign, 0.0f);
+            out.CO2 = FMath::Max(flow.CO2 * sign, 0.0f);
+            out.Toxin = FMath::Max(flow.Toxin * sign, 0.0f);
+            if(out.O2 + out.N2 + out.CO2 + out.Toxin <= 0.0f)
+            {
+                continue;
+            }
+            auto* target = port.managers[1 - side];
+            const auto cell = port.cells[1 - side];
+            port.managers[side]->drainGas(port.cells[side], out, [this, target, cell](const FAtmoStruct& drained) {
+                FScopeLock lock(&m_creditLock);
+                m_credits.Add({target, cell, drained});
+            });
+        }
+        add(port.samples[0], flow, -1.0f);
+        add(port.samples[1], flow, 1.0f);
+    }
+}
+
+void FFluidSimulationScheduler::startWorkers()
+{
+    FScopeLock lock(&m_workerLock);
+    if(m_workers.Num() > 0)
+    {
+        return;
+    }
+    for(auto index = 0; index < m_workerCount; ++index)
+    {
+        m_workers.Add(MakeUnique<FWorker>(*this, index));
+    }
+}
+
+void FFluidSimulationScheduler::stopWorkers()
+{
+    FScopeLock lock(&m_workerLock);
+    {
+        // A simulation may have been added since the last one was removed
+        FScopeLock entriesLock(&m_lock);
+        if(m_entries.Num() > 0)
+        {
+            return;
+        }
+    }
+    for(auto& worker : m_workers)
+    {
+        worker->Stop();
+    }
+    for(auto& worker : m_workers)
+    {
+        m_workEvent->Trigger();
+        worker->join();
+    }
+    m_workers.Reset();
+}
@@ -18,8 +18,8 @@
 
 VelPkg3D::VelPkg3D() {}
 
-VelPkg3D::VelPkg3D(int32 xSize, int32 ySize, int32 zSize)
-  : m_data{{xSize, ySize, zSize}, {xSize, ySize, zSize}, {xSize, ySize, zSize}}
+VelPkg3D::VelPkg3D(int32 xSize, int32 ySize, int32 zSize, const FArray3DPolicy& policy)
+  : m_data{{xSize, ySize, zSize, policy}, {xSize, ySize, zSize, policy}, {xSize, ySize, zSize, policy}}
 {
 }
 
@@ -38,3 +38,13 @@ void VelPkg3D::reset(float value)
         m_data[i].reset(value);
     }
 }
+
+SIZE_T VelPkg3D::allocatedSize() const
+{
+    SIZE_T size = 0;
+    for(int i = 0; i < m_data.Num(); ++i)
+    {
+        size += m_data[i].allocatedSize();
+    }
+    return size;
+}
@@ -17,194 +17,242 @@
 #pragma once
 
 #include "Array.h"
+#include "Array3DExpression.h"
+#include "ArrayView.h"
+#include "Async/ParallelFor.h"
 #include "Delegate.h"
+#include "Morton3D.h"
 #include "Platform.h"
 
+// Order in which TArray3D stores its cells
+enum class EArray3DLayout : uint8
+{
+    // x-fastest rows, padded and aligned according to the policy
+    Linear,
+    // Z-order bricks, see FMorton3D. Neighbouring cells in all three axes are close in memory
+    Morton
+};
+
+// Storage policy of a TArray3D. Storage always starts on a 64 byte boundary; the policy controls the order of
+// cells and the extra room reserved around the logical array.
+struct FArray3DPolicy
+{
+    // Layers of ghost cells around every face, addressable with coordinates in [-ghostLayers, size + ghostLayers)
+    int32 ghostLayers;
+    // Pad the row pitch to a whole number of SIMD registers so every row is aligned and has a safe vector tail.
+    // Linear layout only
+    bool padRows;
+    // Order of cells in memory
+    EArray3DLayout layout;
+
+    FArray3DPolicy() : ghostLayers(0), padRows(true), layout(EArray3DLayout::Linear) {}
+
+    FArray3DPolicy(int32 inGhostLayers, bool inPadRows, EArray3DLayout inLayout = EArray3DLayout::Linear)
+      : ghostLayers(inGhostLayers), padRows(inPadRows), layout(inLayout)
+    {
+    }
+
+    explicit FArray3DPolicy(EArray3DLayout inLayout) : ghostLayers(0), padRows(true), layout(inLayout) {}
+};
+
 template <typename T>
-class TArray3D
+class TArray3D : public TArray3DExpression<TArray3D<T>>
 {
 public:
     using ValueType = T;
 
+    // Alignment of the storage and of every row when rows are padded
+    static constexpr int32 Alignment = 64;
+
     DECLARE_DELEGATE_RetVal_ThreeParams(ValueType, SetterDelegate, int32, int32, int32);
 
     // Default Constructor - do nothing
-    TArray3D() : m_x(0), m_y(0), m_z(0), m_size(0) {}
+    TArray3D()
+      : m_x(0), m_y(0), m_z(0), m_size(0), m_rowPitch(0), m_slicePitch(0), m_origin(0), m_bricksX(0), m_bricksY(0)
+    {
+    }
 
     // Destruct array
     virtual ~TArray3D() = default;
 
     // Constructor
-    TArray3D(int32 x, int32 y, int32 z) : m_x(x), m_y(y), m_z(z), m_size(x * y * z) { m_array.SetNum(m_size); }
+    TArray3D(int32 x, int32 y, int32 z, const FArray3DPolicy& policy = FArray3DPolicy())
+      : m_x(x), m_y(y), m_z(z), m_policy(policy)
+    {
+        resize();
+    }
 
     // Constructor
-    TArray3D(int32 x, int32 y, int32 z, ValueType initialValue) : TArray3D(x, y, z) { set(initialValue); }
+    TArray3D(int32 x, int32 y, int32 z, ValueType initialValue, const FArray3DPolicy& policy = FArray3DPolicy())
+      : TArray3D(x, y, z, policy)
+    {
+        set(initialValue);
+    }
 
-    // Array bracket operator. Returns reference to element at give index.
+    // Array bracket operator. Returns reference to element at given storage index.
     FORCEINLINE const ValueType& operator[](int32 index) const { return m_array[index]; }
 
-    // Array bracket operator. Returns reference to element at give index.
+    // Array bracket operator. Returns reference to element at given storage index.
     FORCEINLINE ValueType& operator[](int32 index) { return m_array[index]; }
 
-    // Multiplication - Single value
-    FORCEINLINE TArray3D operator*(ValueType value)
+    // Evaluates an arithmetic expression of arrays and values in a single pass, e.g. dst = src * a + other.
+    // All arrays in the expression must share dimensions and policy.
+    template <typename TExpr>
+    FORCEINLINE TArray3D& operator=(const TArray3DExpression<TExpr>& expr)
     {
-        TArray3D<ValueType> result(*this);
-        result *= value;
-        return result;
+        assign(expr.self(), [](ValueType& dst, ValueType value) { dst = value; });
+        return *this;
     }
 
     // Assignment by Multiplication  - Single value
-    FORCEINLINE void operator*=(ValueType value)
-    {
-        auto count = m_size;
-        while(count--)
-        {
-            m_array[count] = m_array[count] * value;
-        }
-    }
+    FORCEINLINE void operator*=(ValueType value) { *this = *this * value; }
 
-    // Multiplication - arrIn values
-    FORCEINLINE TArray3D operator*(const TArray3D& arrIn)
+    // Assignment by Multiplication - expression of arrays
+    template <typename TExpr>
+    FORCEINLINE void operator*=(const TArray3DExpression<TExpr>& expr)
     {
-        TArray3D<ValueType> result(*this);
-        result *= arrIn;
-        return result;
+        assign(expr.self(), [](ValueType& dst, ValueType value) { dst = dst * value; });
     }
 
-    // Assignment by Multiplication
-    FORCEINLINE void operator*=(const TArray3D& arrIn)
-    {
-        auto count = m_size;
-        while(count--)
-        {
-            m_array[count] = m_array[count] * arrIn[count];
-        }
-    }
+    // Assignment by Division  - Single value
+    FORCEINLINE void operator/=(ValueType value) { *this = *this / value; }
 
-    // Division - Single value
-    FORCEINLINE TArray3D operator/(ValueType value)
+    // Assignment by Division - expression of arrays
+    template <typename TExpr>
+    FORCEINLINE void operator/=(const TArray3DExpression<TExpr>& expr)
     {
-        TArray3D<ValueType> result(*this);
-        result /= value;
-        return result;
+        assign(expr.self(), [](ValueType& dst, ValueType value) { dst = dst / value; });
     }
 
-    // Assignment by Division  - Single value
-    FORCEINLINE void operator/=(ValueType value)
-    {
-        auto count = m_size;
-        while(count--)
-        {
-            m_array[count] = m_array[count] / value;
-        }
-    }
+    // Assignment by Addition - Single value
+    FORCEINLINE void operator+=(ValueType value) { *this = *this + value; }
 
-    // Division - arrIn values
-    FORCEINLINE TArray3D operator/(const TArray3D& arrIn)
+    // Assignment by Addition - expression of arrays
+    template <typename TExpr>
+    FORCEINLINE void operator+=(const TArray3DExpression<TExpr>& expr)
     {
-        TArray3D<ValueType> result(*this);
-        result /= arrIn;
-        return result;
+        assign(expr.self(), [](ValueType& dst, ValueType value) { dst = dst + value; });
     }
 
-    // Assignment by Division
-    FORCEINLINE void operator/=(const TArray3D& arrIn)
-    {
-        auto count = m_size;
-        while(count--)
-        {
-            m_array[count] = m_array[count] / arrIn[count];
-        }
-    }
+    // Assignment by Subtraction - Single value
+    FORCEINLINE void operator-=(ValueType value) { *this = *this - value; }
 
-    // Addition - Single value
-    FORCEINLINE TArray3D operator+(ValueType value)
+    // Assignment by Subtraction - expression of arrays
+    template <typename TExpr>
+    FORCEINLINE void operator-=(const TArray3DExpression<TExpr>& expr)
     {
-        TArray3D<ValueType> result(*this);
-        result += value;
-        return result;
+        assign(expr.self(), [](ValueType& dst, ValueType value) { dst = dst - value; });
     }
 
-    // Assignment by Addition - Single value
-    FORCEINLINE void operator+=(ValueType value)
+    // Returns the storage index from 3D coordinates
+    FORCEINLINE int32 index(int32 x, int32 y, int32 z) const
     {
-        auto count = m_size;
-        while(count--)
+        if(m_policy.layout == EArray3DLayout::Morton)
         {
-            m_array[count] = m_array[count] + value;
+            return mortonIndex(x + m_policy.ghostLayers, y + m_policy.ghostLayers, z + m_policy.ghostLayers);
         }
+        return m_origin + x + m_rowPitch * y + m_slicePitch * z;
     }
 
-    // Addition - arrIn values
-    FORCEINLINE TArray3D operator+(const TArray3D& arrIn)
+    // Returns the 3D coordinates of a storage index. Padding of the Morton layout decodes to coordinates outside
+    // of the ghost layers
+    FORCEINLINE void coordinates(int32 index, int32& x, int32& y, int32& z) const
     {
-        TArray3D<ValueType> result(*this);
-        result += arrIn;
-        return result;
-    }
-
-    // Assignment by Addition - arrIn values
-    FORCEINLINE void operator+=(const TArray3D& arrIn)
-    {
-        auto count = m_size;
-        while(count--)
+        const auto ghost = m_policy.ghostLayers;
+        if(m_policy.layout == EArray3DLayout::Morton)
         {
-            m_array[count] = m_array[count] + arrIn[count];
+            const auto brick = index / FMorton3D::BrickCells;
+            uint32 localX, localY, localZ;
+            FMorton3D::decode(index % FMorton3D::BrickCells, localX, localY, localZ);
+            x = (brick % m_bricksX) * FMorton3D::BrickSize + static_cast<int32>(localX) - ghost;
+            y = (brick / m_bricksX % m_bricksY) * FMorton3D::BrickSize + static_cast<int32>(localY) - ghost;
+            z = (brick / m_bricksX / m_bricksY) * FMorton3D::BrickSize + static_cast<int32>(localZ) - ghost;
+            return;
         }
+        x = index % m_rowPitch - ghost;
+        y = index / m_rowPitch % (m_slicePitch / m_rowPitch) - ghost;
+        z = index / m_slicePitch - ghost;
     }
 
-    // Subtraction - Single value
-    FORCEINLINE TArray3D operator-(ValueType value)
+    // Calls func(x, y, z) for every logical cell except `border` layers at each face, in storage order:
+    // row by row for the linear layout and along the Z-order curve for the Morton layout
+    template <typename TFunc>
+    FORCEINLINE void forEachCell(TFunc&& func, int32 border = 0) const
     {
-        TArray3D<ValueType> result(*this);
-        result -= value;
-        return result;
-    }
-
-    // Assignment by Subtraction - Single value
-    FORCEINLINE void operator-=(ValueType value)
-    {
-        auto count = m_size;
-        while(count--)
+        if(m_policy.layout == EArray3DLayout::Morton)
+        {
+            const auto ghost = m_policy.ghostLayers;
+            const auto bricksZ = m_array.Num() / (m_bricksX * m_bricksY * FMorton3D::BrickCells);
+            for(auto brickZ = 0; brickZ < bricksZ; ++brickZ)
+            {
+                for(auto brickY = 0; brickY < m_bricksY; ++brickY)
+                {
+                    for(auto brickX = 0; brickX < m_bricksX; ++brickX)
+                    {
+                        const auto originX = brickX * FMorton3D::BrickSize - ghost;
+                        const auto originY = brickY * FMorton3D::BrickSize - ghost;
+                        const auto originZ = brickZ * FMorton3D::BrickSize - ghost;
+                        for(uint32 local = 0; local < FMorton3D::BrickCells; ++local)
+                        {
+                            const auto x = originX + static_cast<int32>(FMorton3D::compact(local));
+                            const auto y = originY + static_cast<int32>(FMorton3D::compact(local >> 1));
+                            const auto z = originZ + static_cast<int32>(FMorton3D::compact(local >> 2));
+                            if(x >= border && y >= border && z >= border && x < m_x - border && y < m_y - border &&
+                               z < m_z - border)
+                            {
+                                func(x, y, z);
+                            }
+                        }
+                    }
+                }
+            }
+            return;
+        }
+        for(auto z = border; z < m_z - border; ++z)
         {
-            m_array[count] = m_array[count] - value;
+            for(auto y = border; y < m_y - border; ++y)
+            {
+                for(auto x = border; x < m_x - border; ++x)
+                {
+                    func(x, y, z);
+                }
+            }
         }
     }
 
-    // Subtraction - arrIn values
-    FORCEINLINE TArray3D operator-(TArray3D& arrIn)
+    // Returns the value in the array from the 3D coordinates
+    FORCEINLINE const ValueType& element(int32 x, int32 y, int32 z) const { return m_array[index(x, y, z)]; }
+
+    FORCEINLINE ValueType& element(int32 x, int32 y, int32 z) { return m_array[index(x, y, z)]; }
+
+    // Returns pointer to the element (0, y, z). Valid for x in [-ghostLayers, getX() + ghostLayers).
+    // Linear layout only
+    FORCEINLINE const ValueType* row(int32 y, int32 z) const
     {
-        TArray3D<ValueType> result(*this);
-        result -= arrIn;
-        return result;
+        checkSlow(m_policy.layout == EArray3DLayout::Linear);
+        return m_array.GetData() + index(0, y, z);
     }
 
-    // Assignment by Subtraction - arrIn values
-    FORCEINLINE void operator-=(TArray3D& arrIn)
+    FORCEINLINE ValueType* row(int32 y, int32 z)
     {
-        auto count = m_size;
-        while(count--)
-        {
-            m_array[count] = m_array[count] - arrIn[count];
-        }
+        checkSlow(m_policy.layout == EArray3DLayout::Linear);
+        return m_array.GetData() + index(0, y, z);
     }
 
-    // Returns the index in the 1D array from 3D coordinates
-    FORCEINLINE int32 index(int32 x, int32 y, int32 z) const { return x + m_x * (y + m_y * z); }
+    // Distance in elements between (x, y, z) and (x, y + 1, z)
+    FORCEINLINE int32 rowPitch() const { return m_rowPitch; }
 
-    // Returns the value in the array from the 3D coordinates
-    FORCEINLINE const ValueType& element(int32 x, int32 y, int32 z) const { return m_array[index(x, y, z)]; }
+    // Distance in elements between (x, y, z) and (x, y, z + 1)
+    FORCEINLINE int32 slicePitch() const { return m_slicePitch; }
 
-    FORCEINLINE ValueType& element(int32 x, int32 y, int32 z) { return m_array[index(x, y, z)]; }
+    FORCEINLINE const FArray3DPolicy& policy() const { return m_policy; }
 
     FORCEINLINE int32 getX() const { return m_x; }
 
     FORCEINLINE void setX(int32 x)
     {
         m_x = x;
-        m_size = m_x * m_y * m_z;
-        m_array.SetNum(m_size);
+        resize();
     }
 
     FORCEINLINE int32 getY() const { return m_y; }
@@ -212,8 +260,7 @@ public:
     FORCEINLINE void setY(int32 y)
     {
         m_y = y;
-        m_size = m_x * m_y * m_z;
-        m_array.SetNum(m_size);
+        resize();
     }
 
     FORCEINLINE int32 getZ() const { return m_z; }
@@ -221,16 +268,28 @@ public:
     FORCEINLINE void setZ(int32 z)
     {
         m_z = z;
-        m_size = m_x * m_y * m_z;
-        m_array.SetNum(m_size);
+        resize();
     }
 
+    // Number of logical cells
     FORCEINLINE int32 size() const { return m_size; }
 
+    // Number of stored elements including ghost layers and row padding
+    FORCEINLINE int32 num() const { return m_array.Num(); }
+
+    // Bytes of heap storage held by the array
+    SIZE_T allocatedSize() const { return m_array.GetAllocatedSize(); }
+
+    // Bytes of heap storage an array of the given dimensions and policy holds, without allocating it
+    static SIZE_T storageSize(int32 x, int32 y, int32 z, const FArray3DPolicy& policy = FArray3DPolicy())
+    {
+        return static_cast<SIZE_T>(storageCount(x, y, z, policy)) * sizeof(ValueType);
+    }
+
     // Set entire array to a single value
     FORCEINLINE void set(ValueType initialValue)
     {
-        auto count = m_size;
+        auto count = m_array.Num();
         while(count--)
         {
             m_array[count] = initialValue;
@@ -242,25 +301,132 @@ public:
     {
         if(!func.IsBound())
             return;
-        auto i = 0;
-        for(auto x = 0; x < m_x; ++x)
+        generate([&func](int32 x, int32 y, int32 z) { return func.Execute(x, y, z); });
+    }
+
+    // Set every cell to func(x, y, z). The functor is inlined, no delegate dispatch per cell
+    template <typename TFunc>
+    FORCEINLINE void generate(TFunc&& func)
+    {
+        for(auto z = 0; z < m_z; ++z)
         {
             for(auto y = 0; y < m_y; ++y)
             {
-                for(auto z = 0; z < m_z; ++z)
-                {
-                    m_array[i] = func.Execute(x, y, z);
-                    ++i;
-                }
+                generateRow(func, y, z);
             }
         }
     }
 
+    // Same as generate, but rows are filled in parallel on the task graph workers.
+    // func must be safe to call concurrently.
+    template <typename TFunc>
+    void parallelGenerate(TFunc&& func)
+    {
+        ParallelFor(m_y * m_z, [this, &func](int32 rowIndex) { generateRow(func, rowIndex % m_y, rowIndex / m_y); });
+    }
+
+    // Copy cells from a dense x-fastest buffer of getX() * getY() * getZ() elements
+    void copyFrom(TArrayView<const ValueType> data)
+    {
+        check(data.Num() == m_size);
+        if(m_policy.layout == EArray3DLayout::Morton)
+        {
+            parallelGenerate([this, &data](int32 x, int32 y, int32 z) { return data[x + m_x * (y + m_y * z)]; });
+            return;
+        }
+        ParallelFor(m_y * m_z, [this, &data](int32 rowIndex) {
+            const auto* source = data.GetData() + rowIndex * m_x;
+            FMemory::Memcpy(row(rowIndex % m_y, rowIndex / m_y), source, m_x * sizeof(ValueType));
+        });
+    }
+
 protected:
-    TArray<ValueType, FDefaultAllocator> m_array; // internal array
+    // Evaluates every stored element of the expression exactly once and combines it into this array
+    template <typename TExpr, typename TCombine>
+    FORCEINLINE void assign(const TExpr& expr, TCombine combine)
+    {
+        const auto count = m_array.Num();
+        check(expr.num() == INDEX_NONE || expr.num() == count);
+        for(int32 i = 0; i < count; ++i)
+        {
+            combine(m_array[i], expr[i]);
+        }
+    }
+
+    template <typename TFunc>
+    FORCEINLINE void generateRow(TFunc& func, int32 y, int32 z)
+    {
+        if(m_policy.layout == EArray3DLayout::Morton)
+        {
+            for(auto x = 0; x < m_x; ++x)
+            {
+                element(x, y, z) = func(x, y, z);
+            }
+            return;
+        }
+        auto* data = row(y, z);
+        for(auto x = 0; x < m_x; ++x)
+        {
+            data[x] = func(x, y, z);
+        }
+    }
+
+    // Storage index in the Morton layout from coordinates already shifted by the ghost layers
+    FORCEINLINE int32 mortonIndex(int32 x, int32 y, int32 z) const
+    {
+        const auto brick = (x >> FMorton3D::BrickBits) +
+                           m_bricksX * ((y >> FMorton3D::BrickBits) + m_bricksY * (z >> FMorton3D::BrickBits));
+        return brick * FMorton3D::BrickCells + FMorton3D::encodeInBrick(x, y, z);
+    }
+
+    // Recomputes pitches from the dimensions and policy and reallocates the storage
+    void resize()
+    {
+        const auto ghost = m_policy.ghostLayers;
+        const auto storageX = m_x + 2 * ghost;
+
+        m_size = m_x * m_y * m_z;
+        m_rowPitch = rowPitchOf(storageX, m_policy);
+        m_slicePitch = m_rowPitch * (m_y + 2 * ghost);
+        m_origin = ghost + m_rowPitch * ghost + m_slicePitch * ghost;
+        m_bricksX = (storageX + FMorton3D::BrickMask) / FMorton3D::BrickSize;
+        m_bricksY = (m_y + 2 * ghost + FMorton3D::BrickMask) / FMorton3D::BrickSize;
+        m_array.SetNum(storageCount(m_x, m_y, m_z, m_policy));
+    }
+
+    // Row pitch of a stored row of storageX elements
+    static int32 rowPitchOf(int32 storageX, const FArray3DPolicy& policy)
+    {
+        const auto rowAlignment = FMath::Max<int32>(1, Alignment / static_cast<int32>(sizeof(ValueType)));
+        return policy.padRows ? (storageX + rowAlignment - 1) / rowAlignment * rowAlignment : storageX;
+    }
+
+    // Elements stored for an array of the given dimensions and policy
+    static int32 storageCount(int32 x, int32 y, int32 z, const FArray3DPolicy& policy)
+    {
+        if(x * y * z <= 0)
+        {
+            return 0;
+        }
+        const auto ghost = policy.ghostLayers;
+        if(policy.layout == EArray3DLayout::Morton)
+        {
+            const auto bricks = [](int32 extent) { return (extent + FMorton3D::BrickMask) / FMorton3D::BrickSize; };
+            return bricks(x + 2 * ghost) * bricks(y + 2 * ghost) * bricks(z + 2 * ghost) * FMorton3D::BrickCells;
+        }
+        return rowPitchOf(x + 2 * ghost, policy) * (y + 2 * ghost) * (z + 2 * ghost);
+    }
+
+    TArray<ValueType, TAlignedHeapAllocator<Alignment>> m_array; // internal array
 
     int32 m_x; // X dimension of array
     int32 m_y; // Y dimension of array
     int32 m_z; // Z dimension of array
     int32 m_size; // Total size of array
+    int32 m_rowPitch; // Elements per stored row
+    int32 m_slicePitch; // Elements per stored XY slice
+    int32 m_origin; // Storage index of (0, 0, 0)
+    int32 m_bricksX; // Morton bricks per row of bricks
+    int32 m_bricksY; // Morton rows of bricks per slice of bricks
+    FArray3DPolicy m_policy; // Ghost layers and padding
 };
@@ -0,0 +1,145 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "Platform.h"
+
+template <typename T>
+class TArray3D;
+
+// Base of every lazily evaluated TArray3D expression (CRTP). Arithmetic on arrays builds a tree of these nodes
+// instead of whole-array temporaries; nothing is computed until the tree is assigned to a TArray3D, which then
+// evaluates it element by element in a single loop.
+// Every node provides ValueType, operator[](int32) over storage indices and num(), the number of stored elements
+// (INDEX_NONE for nodes that fit any shape).
+template <typename TExpr>
+struct TArray3DExpression
+{
+    FORCEINLINE const TExpr& self() const { return static_cast<const TExpr&>(*this); }
+};
+
+// Arrays are held by reference inside an expression, everything else (scalars, sub-expressions) by value
+template <typename TExpr>
+struct TArray3DOperand
+{
+    using Type = const TExpr;
+};
+
+template <typename T>
+struct TArray3DOperand<TArray3D<T>>
+{
+    using Type = const TArray3D<T>&;
+};
+
+// Single value broadcast to every element
+template <typename T>
+struct TArray3DScalar : public TArray3DExpression<TArray3DScalar<T>>
+{
+    using ValueType = T;
+
+    explicit TArray3DScalar(ValueType value) : m_value(value) {}
+
+    FORCEINLINE ValueType operator[](int32) const { return m_value; }
+
+    FORCEINLINE int32 num() const { return INDEX_NONE; }
+
+private:
+    ValueType m_value;
+};
+
+// Element-wise binary operation between two expressions
+template <typename TLhs, typename TRhs, typename TOp>
+struct TArray3DBinary : public TArray3DExpression<TArray3DBinary<TLhs, TRhs, TOp>>
+{
+    using ValueType = typename TLhs::ValueType;
+
+    TArray3DBinary(const TLhs& lhs, const TRhs& rhs) : m_lhs(lhs), m_rhs(rhs) {}
+
+    FORCEINLINE ValueType operator[](int32 index) const { return TOp::apply(m_lhs[index], m_rhs[index]); }
+
+    FORCEINLINE int32 num() const { return m_lhs.num() != INDEX_NONE ? m_lhs.num() : m_rhs.num(); }
+
+private:
+    typename TArray3DOperand<TLhs>::Type m_lhs;
+    typename TArray3DOperand<TRhs>::Type m_rhs;
+};
+
+struct FArray3DAdd
+{
+    template <typename T>
+    static FORCEINLINE T apply(const T& lhs, const T& rhs)
+    {
+        return lhs + rhs;
+    }
+};
+
+struct FArray3DSubtract
+{
+    template <typename T>
+    static FORCEINLINE T apply(const T& lhs, const T& rhs)
+    {
+        return lhs - rhs;
+    }
+};
+
+struct FArray3DMultiply
+{
+    template <typename T>
+    static FORCEINLINE T apply(const T& lhs, const T& rhs)
+    {
+        return lhs * rhs;
+    }
+};
+
+struct FArray3DDivide
+{
+    template <typename T>
+    static FORCEINLINE T apply(const T& lhs, const T& rhs)
+    {
+        return lhs / rhs;
+    }
+};
+
+// Generates expression - expression, expression - value and value - expression overloads of an operator
+#define ARRAY3D_EXPRESSION_OPERATOR(Operator, OpType)                                                                  \
+    template <typename TLhs, typename TRhs>                                                                            \
+    FORCEINLINE TArray3DBinary<TLhs, TRhs, OpType> operator Operator(const TArray3DExpression<TLhs>& lhs,             \
+                                                                      const TArray3DExpression<TRhs>& rhs)             \
+    {                                                                                                                  \
+        return {lhs.self(), rhs.self()};                                                                               \
+    }                                                                                                                  \
+                                                                                                                       \
+    template <typename TLhs>                                                                                           \
+    FORCEINLINE TArray3DBinary<TLhs, TArray3DScalar<typename TLhs::ValueType>, OpType> operator Operator(             \
+      const TArray3DExpression<TLhs>& lhs, typename TLhs::ValueType rhs)                                               \
+    {                                                                                                                  \
+        return {lhs.self(), TArray3DScalar<typename TLhs::ValueType>(rhs)};                                            \
+    }                                                                                                                  \
+                                                                                                                       \
+    template <typename TRhs>                                                                                           \
+    FORCEINLINE TArray3DBinary<TArray3DScalar<typename TRhs::ValueType>, TRhs, OpType> operator Operator(             \
+      typename TRhs::ValueType lhs, const TArray3DExpression<TRhs>& rhs)                                               \
+    {                                                                                                                  \
+        return {TArray3DScalar<typename TRhs::ValueType>(lhs), rhs.self()};                                            \
+    }
+
+ARRAY3D_EXPRESSION_OPERATOR(+, FArray3DAdd)
+ARRAY3D_EXPRESSION_OPERATOR(-, FArray3DSubtract)
+ARRAY3D_EXPRESSION_OPERATOR(*, FArray3DMultiply)
+ARRAY3D_EXPRESSION_OPERATOR(/, FArray3DDivide)
+
+#undef ARRAY3D_EXPRESSION_OPERATOR
@@ -0,0 +1,83 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "AtmoStruct.h"
+#include "EngineMinimal.h"
+#include "HAL/ThreadSafeCounter.h"
+
+// Cells a gas command changes
+enum class EAtmoGasShape : uint8
+{
+    // The cell at position
+    Cell,
+    // The 8 cells around position in cell coordinates, weighted by their distance
+    Point,
+    // Every cell of the box from position to max, evenly
+    Region
+};
+
+// Gas added to or removed from the grid, e.g. by a vent or a scrubber. The rates are per second and apply for
+// `seconds`, a command of 0 seconds adds its rates once as amounts. Negative rates remove gas and leave no cell below
+// zero
+struct FAtmoGasCommand
+{
+    EAtmoGasShape shape;
+    FVector position;
+    FIntVector max; // inclusive, regions only
+    FAtmoStruct rate;
+    float seconds;
+    int32 resize; // resize request of the grid the cells belong to, set by FFluidSimulationManager::queueGas
+};
+
+// Bounded queue of gas commands that any number of threads push to and the simulation thread drains. Pushing
+// neither locks nor allocates, the slots are allocated once by the constructor
+class FLUIDSIMULATIONMODULE_API AtmoGasQueue
+{
+public:
+    // Rounds the capacity up to a power of two
+    explicit AtmoGasQueue(int32 capacity);
+
+    // Returns false if the queue is full, the command is dropped then. Thread safe
+    bool push(const FAtmoGasCommand& command);
+
+    // Moves the queued commands, at most capacity() of them, to the end of commands. Returns the number moved.
+    // Simulation thread only
+    int32 drain(TArray<FAtmoGasCommand>& commands);
+
+    // True if no command waits to be drained. Simulation thread only
+    bool isEmpty() const;
+
+    int32 capacity() const { return m_slots.Num(); }
+
+    // Commands dropped on a full queue since it was created. Thread safe
+    int32 dropped() const { return m_dropped.GetValue(); }
+
+private:
+    struct FSlot
+    {
+        // The position a producer may claim the slot for, one more than it once the command was written
+        FThreadSafeCounter sequence;
+        FAtmoGasCommand command;
+    };
+
+    TArray<FSlot> m_slots;
+    int32 m_mask;
+    volatile int32 m_tail; // next position to push, claimed by compare and swap
+    int32 m_head;          // next position to drain
+    FThreadSafeCounter m_dropped;
+};
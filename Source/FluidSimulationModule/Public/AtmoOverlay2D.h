@@ -0,0 +1,73 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#pragma once
+
+#include "AtmoSnapshot3D.h"
+#include "EngineMinimal.h"
+
+#include "AtmoOverlay2D.generated.h"
+
+// Value an atmospherics overlay shows
+UENUM(BlueprintType)
+enum class EAtmoOverlayField : uint8
+{
+    Pressure,
+    O2,
+    N2,
+    CO2,
+    Toxin
+};
+
+// Heat map of one level of an AtmoSnapshot3D for a floor overlay. Only chunks whose revision changed are converted
+// again, and only tiles whose texels changed are handed out for upload, so the cost follows what changed rather than
+// the size of the map. capture() and the settings may be called from different threads than takeDirty().
+class FLUIDSIMULATIONMODULE_API AtmoOverlay2D
+{
+public:
+    static constexpr int32 TileSize = AtmoSnapshot3D::ChunkSize;
+
+    AtmoOverlay2D();
+
+    // Value shown, the level of the grid and the value shown at full heat
+    void settings(EAtmoOverlayField field, int32 level, float range);
+
+    // Converts the chunks that changed since the last capture
+    void capture(const AtmoSnapshot3D& snapshot);
+
+    int32 sizeX() const { return m_sizeX; }
+
+    int32 sizeY() const { return m_sizeY; }
+
+    // Hands out the tiles changed since the last call and clears them. Tiles are given as rectangles of texels,
+    // data holds TileSize x TileSize texels for every tile in the same order. Returns false if nothing changed
+    bool takeDirty(TArray<FIntRect>& tiles, TArray<FColor>& data);
+
+private:
+    FColor heat(float value) const;
+
+    mutable FCriticalSection m_lock;
+    TArray<FColor> m_texels;
+    TArray<uint32> m_revisions; // chunk revision every tile was converted from
+    TArray<bool> m_dirty;
+    EAtmoOverlayField m_field;
+    int32 m_level;
+    float m_range;
+    bool m_settingsChanged;
+    int32 m_sizeX;
+    int32 m_sizeY;
+    int32 m_tilesX;
+    int32 m_tilesY;
+};
@@ -38,7 +38,7 @@ class FLUIDSIMULATIONMODULE_API AtmoPkg3D
 {
 public:
     // Constructor - Initilizes source and destination FLuid3D objects for atmo in X, Y, Z directions
-    AtmoPkg3D(int32 x, int32 y, int32 z);
+    AtmoPkg3D(int32 x, int32 y, int32 z, const FArray3DPolicy& policy = FArray3DPolicy());
 
     // Swap the source and destination objects
     void swap();
@@ -46,16 +46,20 @@ public:
     // Reset the source and destination objects to specified value
     void reset(float value);
 
+    // Bytes held by the grids of all components
+    SIZE_T allocatedSize() const;
+
     // Accessors
     FluidPkg3D& oxigen() { return m_data[EGasType::O2]; }
     FluidPkg3D& nitrogen() { return m_data[EGasType::N2]; }
     FluidPkg3D& carbonDioxide() { return m_data[EGasType::CO2]; }
     FluidPkg3D& toxin() { return m_data[EGasType::Toxin]; }
+    FluidPkg3D& gas(EGasType::Type type) { return m_data[type]; }
+    const FluidPkg3D& gas(EGasType::Type type) const { return m_data[type]; }
 
-    const FluidProperties& properties() const { return m_prop; }
-    FluidProperties& properties() { return m_prop; }
+    // Gives every gas the same properties, gas(type).properties() changes a single one
+    void properties(const FluidProperties& value);
 
 private:
     TArray<FluidPkg3D, TFixedAllocator<EGasType::GasTypeCount>> m_data;
-    FluidProperties m_prop;
 };
@@ -0,0 +1,66 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "AtmoPkg3D.h"
+#include "AtmoStruct.h"
+#include "EngineMinimal.h"
+
+#include "AtmoReaction.generated.h"
+
+// A reaction between the gases of a cell, e.g. combustion, CO2 scrubbing or toxin decay. Every cell where the
+// reactant is above the threshold reacts: each second Rate of the excess is used up, first order like venting. A
+// co-reactant, when there is one, is used up at Ratio per unit of reactant and limits how much reacts. Every unit
+// that reacts yields Products
+USTRUCT(BlueprintType)
+struct FLUIDSIMULATIONMODULE_API FAtmoReaction
+{
+    GENERATED_BODY()
+
+public:
+    UPROPERTY(BlueprintReadWrite, EditAnywhere)
+    TEnumAsByte<EGasType::Type> Reactant;
+
+    // GasTypeCount when the reactant reacts on its own
+    UPROPERTY(BlueprintReadWrite, EditAnywhere)
+    TEnumAsByte<EGasType::Type> Coreactant;
+
+    // Partial pressure of the reactant below which a cell does not react
+    UPROPERTY(BlueprintReadWrite, EditAnywhere)
+    float Threshold;
+
+    // Fraction of the reactant above the threshold that reacts per second
+    UPROPERTY(BlueprintReadWrite, EditAnywhere)
+    float Rate;
+
+    // Co-reactant used up per unit of reactant
+    UPROPERTY(BlueprintReadWrite, EditAnywhere)
+    float Ratio;
+
+    // Gases made per unit of reactant
+    UPROPERTY(BlueprintReadWrite, EditAnywhere)
+    FAtmoStruct Products;
+
+    FAtmoReaction()
+      : Reactant(EGasType::O2)
+      , Coreactant(EGasType::GasTypeCount)
+      , Threshold(0.0f)
+      , Rate(0.0f)
+      , Ratio(1.0f)
+    {
+    }
+};
@@ -0,0 +1,39 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#pragma once
+
+#include "AtmoSnapshot3D.h"
+
+// Client side of AtmoReplicator, keeps the gas values received so far
+class FLUIDSIMULATIONMODULE_API AtmoReplica3D
+{
+public:
+    // Applies a packet built by AtmoReplicator. Returns the sequence to acknowledge, INDEX_NONE if the packet is
+    // malformed
+    int32 receive(const TArray<uint8>& packet);
+
+    // False until the first packet arrived
+    bool isValid() const { return m_values.numChunks() > 0; }
+
+    FAtmoStruct getPressure(int32 x, int32 y, int32 z) const { return m_values.getPressure(x, y, z); }
+
+    // Values received so far, chunks get a new revision whenever a packet updates them
+    const AtmoSnapshot3D& values() const { return m_values; }
+
+private:
+    AtmoSnapshot3D m_values;
+    TArray<int32> m_sequences; // packet every chunk was last updated by, so late packets do not roll it back
+};
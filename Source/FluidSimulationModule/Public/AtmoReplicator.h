@@ -0,0 +1,74 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#pragma once
+
+#include "AtmoSnapshot3D.h"
+
+// Sends the chunks of AtmoSnapshot3D captures to clients. Every client gets only the chunks whose values moved away
+// from what it acknowledged by more than a threshold, closest to its focus first.
+//
+// Packet layout: sequence, size X, Y, Z and quantum, followed by the size of the uncompressed payload and the
+// zlib compressed payload. The payload holds the number of chunks and then every chunk as its index followed by
+// its values, each stored as the difference to the same gas in the previous cell of the chunk.
+class FLUIDSIMULATIONMODULE_API AtmoReplicator
+{
+public:
+    AtmoReplicator();
+
+    float threshold() const { return m_threshold; }
+
+    // Pressure units a value has to change by before its chunk is sent again
+    void threshold(float value) { m_threshold = value; }
+
+    int32 maxPacketBytes() const { return m_maxPacketBytes; }
+
+    // Uncompressed chunk data per packet, at least one chunk is always sent
+    void maxPacketBytes(int32 value) { m_maxPacketBytes = value; }
+
+    // Builds the next packet for a client. Returns false if the client is up to date
+    bool buildPacket(uint32 client, const AtmoSnapshot3D& snapshot, const FIntVector& focus, TArray<uint8>& packet);
+
+    // The client received the packet with the given sequence
+    void acknowledge(uint32 client, int32 sequence);
+
+    void removeClient(uint32 client);
+
+private:
+    struct FSentPacket
+    {
+        int32 sequence;
+        TArray<int32> chunks;
+        TArray<uint32> revisions;
+        TArray<uint16> values;
+    };
+
+    struct FClient
+    {
+        AtmoSnapshot3D acknowledged; // values the client is known to have
+        TArray<uint32> revisions; // snapshot revision every acknowledged chunk was compared against
+        TArray<int32> ackedSequences; // packet every chunk was last acknowledged with
+        TArray<int32> sentSequences; // packet a chunk is in flight with, INDEX_NONE if none
+        TArray<int32> waiting; // packets a changed chunk was left out of
+        TArray<FSentPacket> inFlight;
+        int32 sequence;
+    };
+
+    void resetClient(FClient& client, const AtmoSnapshot3D& snapshot) const;
+
+    TMap<uint32, FClient> m_clients;
+    float m_threshold;
+    int32 m_maxPacketBytes;
+};
@@ -0,0 +1,84 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+#pragma once
+
+#include "AtmoPkg3D.h"
+#include "AtmoStruct.h"
+#include "FluidRegionMap3D.h"
+
+// Quantized copy of the gas values of a simulation, cut into chunks of FluidRegionMap3D::RegionSize x RegionSize
+// columns over the full height. The values of a chunk are stored next to each other, cell by cell with all gases of
+// a cell together, so a chunk can be sent as one block. Every chunk carries a revision that changes whenever one of
+// its values does.
+class FLUIDSIMULATIONMODULE_API AtmoSnapshot3D
+{
+public:
+    static constexpr int32 ChunkSize = FluidRegionMap3D::RegionSize;
+
+    AtmoSnapshot3D();
+
+    AtmoSnapshot3D(int32 xSize, int32 ySize, int32 zSize, float quantum);
+
+    // Quantizes the current gas values. Chunks that did not change keep the revision they had in previous
+    void capture(AtmoPkg3D& pressure, const AtmoSnapshot3D* previous);
+
+    // Pressure units of one quantization step
+    float quantum() const { return m_quantum; }
+
+    int32 sizeX() const { return m_sizeX; }
+
+    int32 sizeY() const { return m_sizeY; }
+
+    int32 sizeZ() const { return m_sizeZ; }
+
+    int32 chunksX() const { return m_chunksX; }
+
+    int32 chunksY() const { return m_chunksY; }
+
+    int32 numChunks() const { return m_chunksX * m_chunksY; }
+
+    // Values of one chunk, cells outside of the grid are 0
+    int32 chunkValues() const { return ChunkSize * ChunkSize * m_sizeZ * EGasType::GasTypeCount; }
+
+    const uint16* chunk(int32 index) const { return m_values.GetData() + index * chunkValues(); }
+
+    uint16* chunk(int32 index) { return m_values.GetData() + index * chunkValues(); }
+
+    uint32 revision(int32 index) const { return m_revisions[index]; }
+
+    // Gives a chunk a new revision after its values were written through chunk()
+    void touch(int32 index) { ++m_revisions[index]; }
+
+    // Position of the value of a gas in a cell within its chunk
+    int32 chunkOffset(int32 x, int32 y, int32 z, EGasType::Type gas) const
+    {
+        return (((z * ChunkSize) + y % ChunkSize) * ChunkSize + x % ChunkSize) * EGasType::GasTypeCount + gas;
+    }
+
+    int32 chunkIndex(int32 x, int32 y) const { return x / ChunkSize + (y / ChunkSize) * m_chunksX; }
+
+    FAtmoStruct getPressure(int32 x, int32 y, int32 z) const;
+
+private:
+    TArray<uint16> m_values;
+    TArray<uint32> m_revisions;
+    float m_quantum;
+    int32 m_sizeX;
+    int32 m_sizeY;
+    int32 m_sizeZ;
+    int32 m_chunksX;
+    int32 m_chunksY;
+};
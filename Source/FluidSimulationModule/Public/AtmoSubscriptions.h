@@ -0,0 +1,91 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "AtmoOverlay2D.h"
+#include "EngineMinimal.h"
+
+#include "AtmoSubscriptions.generated.h"
+
+class FluidSimulation3D;
+
+// Side of the threshold an atmospherics subscription triggers on
+UENUM(BlueprintType)
+enum class EAtmoThresholdComparison : uint8
+{
+    Below,
+    Above
+};
+
+// Condition on the mean value of a box of cells
+struct FAtmoSubscription
+{
+    FIntVector min;
+    FIntVector max; // inclusive
+    EAtmoOverlayField field;
+    EAtmoThresholdComparison comparison;
+    float threshold;
+    // Distance past the threshold the value has to move back before the subscription clears again
+    float hysteresis;
+};
+
+// Crossing of a subscription's threshold, triggered when the condition started to hold and cleared when it stopped
+struct FAtmoThresholdEvent
+{
+    int32 subscription;
+    bool triggered;
+    float value;
+};
+
+// Conditions on the gases that are checked in one pass after every tick, so that sensors get an event when their
+// condition changes instead of polling the grid. add(), remove() and takeEvents() may be called from any thread.
+class FLUIDSIMULATIONMODULE_API AtmoSubscriptions
+{
+public:
+    AtmoSubscriptions();
+
+    // Returns the handle of the subscription. Its state is reported by the next evaluate() if the condition holds
+    int32 add(const FAtmoSubscription& subscription);
+
+    void remove(int32 handle);
+
+    // Moves every box by offset, after the grid was resized around the cells they watch
+    void move(const FIntVector& offset);
+
+    // True if subscriptions were added since the last evaluate()
+    bool hasPending() const;
+
+    // Checks every subscription against the grid and queues an event for the ones that crossed their threshold
+    void evaluate(FluidSimulation3D& sim);
+
+    // Hands out the events queued since the last call. Returns false if there were none
+    bool takeEvents(TArray<FAtmoThresholdEvent>& events);
+
+private:
+    struct FEntry
+    {
+        int32 handle;
+        FAtmoSubscription subscription;
+        bool triggered;
+    };
+
+    mutable FCriticalSection m_lock;
+    TArray<FEntry> m_entries;
+    TArray<FAtmoThresholdEvent> m_events;
+    int32 m_nextHandle;
+    bool m_pending;
+};
@@ -25,8 +25,11 @@ public:
     // Default constructor for zero sized array
     Fluid3D() = default;
 
-    // Constructor - Sets size of array
-    Fluid3D(int32 x, int32 y, int32 z);
+    // Constructor - Sets size and storage policy of array
+    Fluid3D(int32 x, int32 y, int32 z, const FArray3DPolicy& policy = FArray3DPolicy());
+
+    // Allow assignment of lazily evaluated array expressions
+    using TArray3D::operator=;
 
     // When a point is advected it will land in Add fractions of value to the 4 neighboring grid
     // points of the floating point coordinates
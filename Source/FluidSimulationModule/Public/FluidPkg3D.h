@@ -27,7 +27,7 @@ class FLUIDSIMULATIONMODULE_API FluidPkg3D
 public:
     FluidPkg3D();
     // Constructor - Initilizes source and destination FLuid3D objects
-    FluidPkg3D(int32 xSize, int32 ySize, int32 zSize);
+    FluidPkg3D(int32 xSize, int32 ySize, int32 zSize, const FArray3DPolicy& policy = FArray3DPolicy());
 
     // Swap the source and destination objects
     void swap();
@@ -35,9 +35,15 @@ public:
     // Reset the source and destination objects to specified value
     void reset(float value);
 
+    // Bytes held by both buffers
+    SIZE_T allocatedSize() const { return m_data[0].allocatedSize() + m_data[1].allocatedSize(); }
+
     // Accessors
     const Fluid3D& source() const { return m_data[m_sourceBuffer]; }
+    // For sweeps that update every cell in place from its own values only
+    Fluid3D& source() { return m_data[m_sourceBuffer]; }
     Fluid3D& destination() { return m_data[(m_sourceBuffer + 1) % 2]; }
+    const FluidProperties& properties() const { return m_prop; }
     FluidProperties& properties() { return m_prop; }
 
 private:
@@ -25,5 +25,8 @@ struct FLUIDSIMULATIONMODULE_API FluidProperties
 
     float decay;
 
-    FluidProperties() : diffusion(0.0f), advection(0.0f), decay(0.0f) {}
+    // Diffusion iterations per update, 0 runs as many as the simulation's diffusionIterations(), which also caps it
+    int32 iterations;
+
+    FluidProperties() : diffusion(0.0f), advection(0.0f), decay(0.0f), iterations(0) {}
 };
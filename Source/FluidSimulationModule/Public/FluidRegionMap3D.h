@@ -0,0 +1,215 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "Array.h"
+#include "Platform.h"
+
+// Level of detail a region of the simulation runs at
+enum class ERegionDetail : uint8
+{
+    // Every cell is simulated
+    Full,
+    // Cells are averaged into blocks and only diffuse between blocks
+    Coarse
+};
+
+// Splits the simulation into columns of RegionSize x RegionSize cells over the full height and tracks
+// the level of detail and the update period each of them runs at.
+// Regions updated every period ticks run in a pass of their own, see beginPass(). The regions of the pass are
+// active, everything else only exchanges flux with them over the borders.
+class FLUIDSIMULATIONMODULE_API FluidRegionMap3D
+{
+public:
+    static constexpr int32 RegionSize = 16;
+    // Update periods are 1, 2, 4 and 8 ticks
+    static constexpr int32 Periods = 4;
+    static constexpr int32 MaxPeriod = 1 << (Periods - 1);
+
+    FluidRegionMap3D();
+
+    FluidRegionMap3D(int32 xSize, int32 ySize, int32 zSize);
+
+    // Sets the detail of every region from the distance to the closest focus point in the XY plane.
+    // Regions within radius cells run at full detail, a region is coarsened once it is RegionSize cells further
+    // away so that a player walking along a border does not switch it every tick. A radius <= 0 disables it.
+    void updateDetail(const TArray<FIntVector>& focus, int32 radius);
+
+    // Sets the update period of every region from the distance to the closest focus point in the XY plane.
+    // Regions within radius cells update every tick, the period doubles with every further radius up to MaxPeriod.
+    // A radius <= 0 updates everything every tick. The new schedule starts once all periods line up again.
+    void updateSchedule(const TArray<FIntVector>& focus, int32 radius);
+
+    // Advances the schedule by one tick, applying a pending schedule right after all periods were updated
+    void endTick();
+
+    // True if regions with the given period update in the current tick
+    bool isDue(int32 period) const { return m_tick % period == 0; }
+
+    // Activates the regions updated every period ticks. Returns false if there are none
+    bool beginPass(int32 period);
+
+    // Activates every region
+    void endPass();
+
+    ERegionDetail detail(int32 region) const { return m_detail[region]; }
+
+    int32 period(int32 region) const { return m_period[region]; }
+
+    // True if the cell (x, y) belongs to an active region at full detail, false for cells outside of the map
+    bool isSimulated(int32 x, int32 y) const
+    {
+        if(x < 0 || x >= m_sizeX || y < 0 || y >= m_sizeY)
+        {
+            return false;
+        }
+        const auto region = x / RegionSize + (y / RegionSize) * m_regionsX;
+        return m_active[region] && m_detail[region] == ERegionDetail::Full;
+    }
+
+    // True if the cell (x, y) belongs to an active region of any detail
+    bool isActive(int32 x, int32 y) const { return m_active[x / RegionSize + (y / RegionSize) * m_regionsX]; }
+
+    // True if every region is active and at full detail
+    bool isUniform() const { return m_coarseRegions == 0 && m_inactiveRegions == 0; }
+
+    int32 num() const { return m_detail.Num(); }
+
+    int32 coarseRegions() const { return m_coarseRegions; }
+
+    int32 activeCoarseRegions() const { return m_activeCoarseRegions; }
+
+    // Number of cells simulated at full detail in the current pass
+    int32 simulatedCells() const;
+
+    // Number of regions updated every period ticks
+    int32 regionsWithPeriod(int32 period) const;
+
+    // Calls func(x, y, z) for every cell of active full detail regions within [lowBorder, size - highBorder)
+    template <typename TFunc>
+    void forEachSimulatedCell(TFunc&& func, int32 lowBorder, int32 highBorder) const
+    {
+        if(isUniform())
+        {
+            forEachCell(func, lowBorder, lowBorder, m_sizeX - highBorder, m_sizeY - highBorder, lowBorder,
+                        m_sizeZ - highBorder);
+            return;
+        }
+        for(auto region = 0; region < m_detail.Num(); ++region)
+        {
+            if(!m_active[region] || m_detail[region] != ERegionDetail::Full)
+            {
+                continue;
+            }
+            int32 x0, y0, x1, y1;
+            bounds(region, x0, y0, x1, y1);
+            forEachCell(func,
+                        FMath::Max(x0, lowBorder),
+                        FMath::Max(y0, lowBorder),
+                        FMath::Min(x1, m_sizeX - highBorder),
+                        FMath::Min(y1, m_sizeY - highBorder),
+                        lowBorder,
+                        m_sizeZ - highBorder);
+        }
+    }
+
+    // Calls func(x, y, z) for the outermost cells of the regions which are not simulated, but touch one that is
+    template <typename TFunc>
+    void forEachBorderCell(TFunc&& func) const
+    {
+        for(auto region = 0; region < m_detail.Num(); ++region)
+        {
+            int32 x0, y0, x1, y1;
+            bounds(region, x0, y0, x1, y1);
+            if(isSimulated(x0, y0) ||
+               (!isSimulated(x0 - 1, y0) && !isSimulated(x1, y0) && !isSimulated(x0, y0 - 1) &&
+                !isSimulated(x0, y1)))
+            {
+                continue;
+            }
+            for(auto z = 0; z < m_sizeZ; ++z)
+            {
+                for(auto y = y0; y < y1; ++y)
+                {
+                    const auto step = (y == y0 || y == y1 - 1) ? 1 : x1 - x0 - 1;
+                    for(auto x = x0; x < x1; x += FMath::Max(step, 1))
+                    {
+                        func(x, y, z);
+                    }
+                }
+            }
+        }
+    }
+
+    // Calls func(x0, y0, x1, y1) with the cell bounds [x0, x1) x [y0, y1) of every region at the given detail
+    template <typename TFunc>
+    void forEachRegion(ERegionDetail detail, TFunc&& func) const
+    {
+        for(auto region = 0; region < m_detail.Num(); ++region)
+        {
+            if(m_detail[region] == detail)
+            {
+                int32 x0, y0, x1, y1;
+                bounds(region, x0, y0, x1, y1);
+                func(x0, y0, x1, y1);
+            }
+        }
+    }
+
+private:
+    void bounds(int32 region, int32& x0, int32& y0, int32& x1, int32& y1) const
+    {
+        x0 = (region % m_regionsX) * RegionSize;
+        y0 = (region / m_regionsX) * RegionSize;
+        x1 = FMath::Min(x0 + RegionSize, m_sizeX);
+        y1 = FMath::Min(y0 + RegionSize, m_sizeY);
+    }
+
+    // Chebyshev distance in the XY plane from the region to the closest focus point
+    int32 distance(int32 region, const TArray<FIntVector>& focus) const;
+
+    void updateCounts();
+
+    template <typename TFunc>
+    static void forEachCell(TFunc& func, int32 x0, int32 y0, int32 x1, int32 y1, int32 z0, int32 z1)
+    {
+        for(auto z = z0; z < z1; ++z)
+        {
+            for(auto y = y0; y < y1; ++y)
+            {
+                for(auto x = x0; x < x1; ++x)
+                {
+                    func(x, y, z);
+                }
+            }
+        }
+    }
+
+private:
+    TArray<ERegionDetail> m_detail;
+    TArray<uint8> m_period;
+    TArray<uint8> m_pendingPeriod;
+    TArray<bool> m_active;
+    int32 m_regionsX;
+    int32 m_coarseRegions;
+    int32 m_inactiveRegions;
+    int32 m_activeCoarseRegions;
+    int32 m_tick;
+    int32 m_sizeX;
+    int32 m_sizeY;
+    int32 m_sizeZ;
+};
@@ -25,6 +25,8 @@
 #pragma once
 
 #include "AtmoPkg3D.h"
+#include "AtmoReaction.h"
+#include "FluidRegionMap3D.h"
 #include "VelPkg3D.h"
 
 enum class EFlowDirection : uint32
@@ -37,16 +39,79 @@ enum class EFlowDirection : uint32
     XPlus = 0x10,
     XMinus = 0x20,
     Self = 0x40,
+    // The cell is open space. It blocks flow like a solid, its neighbours vent into it through vacuum faces
+    Vacuum = 0x80,
+    // The face opens to space. Gas vents through it unless the face is blocked as well
+    VacuumZPlus = 0x100,
+    VacuumZMinus = 0x200,
+    VacuumYPlus = 0x400,
+    VacuumYMinus = 0x800,
+    VacuumXPlus = 0x1000,
+    VacuumXMinus = 0x2000,
+    VacuumFaces = 0x3F00,
     Max = 0xFFFFFFFF
 };
 ENUM_CLASS_FLAGS(EFlowDirection)
 
+// Returns the vacuum flag of a face direction
+FORCEINLINE EFlowDirection vacuumFace(EFlowDirection face)
+{
+    return static_cast<EFlowDirection>(static_cast<uint32>(face) << 8);
+}
+
+enum class EAdvectionScheme : uint8
+{
+    // Forward plus reverse advection by Mick West. Mass conserving, but each step is clamped to 1.5 cells
+    Conservative,
+    // Semi-Lagrangian prediction with a MacCormack error correction. Second order accurate, so it keeps detail at
+    // larger time steps. Gases are rescaled afterwards to keep their total mass
+    MacCormack
+};
+
+// Bytes held by the grids of a simulation
+struct FAtmosMemoryUsage
+{
+    SIZE_T solids;
+    SIZE_T velocity; // both buffers of every component
+    SIZE_T gases; // both buffers of every gas
+    SIZE_T curl;
+    SIZE_T totalPressure;
+    SIZE_T advectionScratch;
+    SIZE_T diffusionScratch; // plane ring of blocked diffusion
+    SIZE_T levelOfDetail; // coarse block grids
+    SIZE_T peakTransient; // largest scratch allocated and freed again within an update
+
+    FAtmosMemoryUsage()
+      : solids(0)
+      , velocity(0)
+      , gases(0)
+      , curl(0)
+      , totalPressure(0)
+      , advectionScratch(0)
+      , diffusionScratch(0)
+      , levelOfDetail(0)
+      , peakTransient(0)
+    {
+    }
+
+    // Grids held between updates plus the transient peak
+    SIZE_T total() const
+    {
+        return solids + velocity + gases + curl + totalPressure + advectionScratch + diffusionScratch + levelOfDetail +
+               peakTransient;
+    }
+};
+
 // Defines how fluid objects can interact with each other in order to create a fluid simulation
 class FLUIDSIMULATIONMODULE_API FluidSimulation3D
 {
 public:
-    // Constructor - Set size of array and timestep
-    FluidSimulation3D(int32 xSize, int32 ySize, int32 zSize, float dt);
+    // Constructor - Set size of array, timestep and storage policy of every grid
+    FluidSimulation3D(int32 xSize,
+                      int32 ySize,
+                      int32 zSize,
+                      float dt,
+                      const FArray3DPolicy& policy = FArray3DPolicy());
 
     // Updates all fluid objects across a single timestep
     void update();
@@ -63,6 +128,10 @@ public:
     // Resets the fluid simulation to the default state
     void reset();
 
+    // Copies gases, velocity, solids and breaches of the cells simulated in both grids from another simulation,
+    // where cell (x, y, z) of the other one is cell (x, y, z) + offset of this one. Other cells keep their values
+    void copyFrom(const FluidSimulation3D& other, const FIntVector& offset);
+
     // Fluid object accessors
     VelPkg3D& velocity() { return m_velocity; }
     AtmoPkg3D& pressure() { return m_pressure; }
@@ -85,6 +154,146 @@ public:
 
     void dt(float value) { m_dt = value; }
 
+    EAdvectionScheme advectionScheme() const { return m_advectionScheme; }
+
+    void advectionScheme(EAdvectionScheme value);
+
+    // Runs the scattering advection kernels on all cores
+    bool parallelAdvection() const { return m_parallelAdvection; }
+
+    void parallelAdvection(bool value) { m_parallelAdvection = value; }
+
+    // Runs diffusion, forces and semi-Lagrangian advection with the ISPC kernels while every region is at full
+    // detail in the linear layout. Has no effect unless the module was built with them, off by default
+    bool ispcKernels() const { return m_ispcKernels; }
+
+    void ispcKernels(bool value) { m_ispcKernels = value; }
+
+    // Bitwise reproducible updates whatever the number of worker threads and whether parallelAdvection is on: the
+    // scattering kernels always run in the fixed slab order and the ISPC kernels, whose instruction set depends on
+    // the CPU, are not used
+    bool deterministic() const { return m_deterministic; }
+
+    void deterministic(bool value) { m_deterministic = value; }
+
+    // Advances several diffusion iterations per pass over a grid at full detail, see diffusionBlocked()
+    bool diffusionBlocking() const { return m_diffusionBlocking; }
+
+    // Allocates the plane ring of blocked diffusion once, or frees it
+    void diffusionBlocking(bool value);
+
+    // Gas reactions of every cell, applied in the total pressure sweep at the end of every pass. They run in order,
+    // each one sees the gases the ones before it left
+    const TArray<FAtmoReaction>& reactions() const { return m_reactions; }
+
+    void reactions(const TArray<FAtmoReaction>& value);
+
+    // Largest velocity component after the last update
+    float maxVelocity() const { return m_maxVelocity; }
+
+    // Largest time step that keeps advection within `cfl` cells per step and explicit diffusion stable
+    float stableTimeStep(float cfl) const;
+
+    // Cells around the focus points (usually players or events) are simulated at full detail and every tick.
+    // Regions further than the detail radius run on a grid coarsened by the coarse factor, regions further than
+    // the schedule radius update every 2nd, 4th or 8th tick
+    void focus(const TArray<FIntVector>& points);
+
+    int32 detailRadius() const { return m_detailRadius; }
+
+    // Radius in cells, <= 0 simulates everything at full detail
+    void detailRadius(int32 value) { m_detailRadius = value; }
+
+    int32 scheduleRadius() const { return m_scheduleRadius; }
+
+    // Radius in cells, <= 0 updates everything every tick
+    void scheduleRadius(int32 value) { m_scheduleRadius = value; }
+
+    int32 coarseFactor() const { return m_coarseFactor; }
+
+    // Edge length of a coarse block in cells, 2 or 4
+    void coarseFactor(int32 value);
+
+    const FluidRegionMap3D& regions() const { return m_regions; }
+
+    // Opens the face of a cell to space, e.g. when the hull next to it is destroyed. The room behind the face
+    // becomes a breach zone that vents as one well mixed volume instead of waiting for diffusion to reach the hole
+    void breach(int32 x, int32 y, int32 z, EFlowDirection face);
+
+    // Closes a face opened by breach() with a wall
+    void seal(int32 x, int32 y, int32 z, EFlowDirection face);
+
+    // Turns a cell into open space or back, neighbours vent into a vacuum cell
+    void vacuum(int32 x, int32 y, int32 z, bool value);
+
+    // Finds the breach zones again, needed after solids were edited directly
+    void updateBreachZones();
+
+    float ventRate() const { return m_ventRate; }
+
+    // Fraction of a cell's gas that leaves through one vacuum face per second
+    void ventRate(float value) { m_ventRate = value; }
+
+    // Gas removed by venting since the simulation was created
+    float vented() const { return m_vented; }
+
+    // Adds gas to a cell, negative amounts remove it and leave no cell below zero. Returns the change of the cell
+    float addGas(int32 x, int32 y, int32 z, EGasType::Type type, float amount);
+
+    // Adds gas spread over the 8 cells around a point in cell coordinates, negative amounts remove it and leave no
+    // cell below zero
+    void distributeGas(const FVector& point, EGasType::Type type, float amount);
+
+    // Adds gas spread evenly over the cells of a box inside the border, max inclusive. Negative amounts remove it
+    // and leave no cell below zero
+    void distributeGas(const FIntVector& min, const FIntVector& max, EGasType::Type type, float amount);
+
+    // Largest change of a cell's partial pressure in the last diffusion iteration or venting of the last update
+    float maxPressureDelta() const { return m_maxPressureDelta; }
+
+    float steadyVelocity() const { return m_steadyVelocity; }
+
+    // The flow is at rest while no velocity component exceeds this
+    void steadyVelocity(float value) { m_steadyVelocity = value; }
+
+    float steadyPressure() const { return m_steadyPressure; }
+
+    // The pressure is at rest while no partial pressure changes by more than this per update
+    void steadyPressure(float value) { m_steadyPressure = value; }
+
+    int32 steadyTicks() const { return m_steadyTicks; }
+
+    // Updates the grid has to be at rest for before it counts as steady, at least the longest update period
+    void steadyTicks(int32 value) { m_steadyTicks = value; }
+
+    // True once nothing changed for steadyTicks() updates, further updates would not change the grid either
+    bool isSteady() const { return m_quietTicks >= m_steadyTicks; }
+
+    // Starts counting quiet updates again, call after writing to the grids from outside
+    void wake()
+    {
+        m_quietTicks = 0;
+        m_totalPressureValid = false;
+    }
+
+    // Starts counting quiet updates again after writes that kept totalPressure() up to date
+    void keepAwake() { m_quietTicks = 0; }
+
+    // Sum of all gases of every cell as of the end of the last update
+    const Fluid3D& totalPressure() const { return m_totalPressure; }
+
+    // Bytes held by the grids, the transient peak is the largest seen since the simulation was created
+    FAtmosMemoryUsage memoryUsage() const;
+
+    // Bytes a simulation with these settings will hold, without creating it. The transient peak is the one a
+    // single update needs
+    static FAtmosMemoryUsage estimateMemory(int32 xSize,
+                                            int32 ySize,
+                                            int32 zSize,
+                                            const FArray3DPolicy& policy,
+                                            EAdvectionScheme scheme,
+                                            int32 coarseFactor);
+
     int32 height() const { return m_sizeZ; }
 
     int32 width() const { return m_sizeY; }
@@ -92,19 +301,82 @@ public:
     int32 depth() const { return m_sizeX; }
 
 private:
+    // Rows away from its cell a scattering advection kernel may write to, collide() clamps the trace to 1.5 cells
+    // and the interpolation adds one more
+    static constexpr int32 ScatterReach = 2;
+    // Rows of a slab, wide enough that the writes of every other slab do not overlap
+    static constexpr int32 ScatterSlabRows = 2 * ScatterReach;
+    // Most iterations a blocked diffusion pass advances at once, and the cache its intermediate planes should fit
+    static constexpr int32 MaxDiffusionDepth = 8;
+    static constexpr SIZE_T DiffusionCacheBytes = 4 * 1024 * 1024;
+
+    // FAtmoReaction over one time step, laid out like the Reaction of the ISPC kernels
+    struct FReactionTerm
+    {
+        int32 reactant;
+        int32 coreactant; // GasTypeCount without one
+        float threshold;
+        float fraction; // of the excess that reacts during the step
+        float ratio;
+        float inverseRatio; // most reactant per unit of co-reactant
+        float products[EGasType::GasTypeCount];
+    };
+
     // Solids
     TArray3D<EFlowDirection> m_solids;
     // Fluid objects
     Fluid3D m_curl;
+    Fluid3D m_advectionScratch; // allocated only for advection schemes that need it
+    mutable TArray<float> m_diffusionPlanes; // ring of diffusionBlocked(), allocated only while blocking is enabled
+    Fluid3D m_totalPressure; // sum of all gases, written after the last gas pass of every update pass
+    bool m_totalPressureValid; // false after the gases were written from outside, the next update sums every cell
+    TArray<FAtmoReaction> m_reactions;
     VelPkg3D m_velocity;
     AtmoPkg3D m_pressure; // equivalent to density
 
+    // Level of detail
+    FluidRegionMap3D m_regions;
+    TArray3D<float> m_coarseCells; // simulated cells of every coarse block, 0 if the block is kept as is
+    TArray3D<FVector> m_coarseFaces; // open fraction of the +X, +Y, +Z faces of every coarse block
+    TArray3D<float> m_coarseMass; // scratch, summed value of every coarse block
+    TArray3D<float> m_coarseFlux; // scratch, value exchanged by every coarse block
+    TArray<float> m_passTime; // time since the regions of every update period were updated
+
+    // Venting
+    struct FBreachZone
+    {
+        TArray<int32> cells; // storage indices of the cells in the zone
+        int32 ventFaces; // faces open to space of the whole zone
+    };
+    TArray<FIntVector> m_breaches; // cells a breach zone starts from
+    TArray<FBreachZone> m_breachZones;
+    TSet<int32> m_breachCells; // storage indices of all cells in breach zones
+    TArray<TPair<int32, float>> m_venting; // scratch, storage index and rate of every venting cell
+
     // Fluid properties
     int32 m_diffusionIter; // diffusion cycles per call to Update()
     float m_vorticity; // level of vorticity confinement to apply
     float m_pressureAccel; // Pressure accelleration.  Values >0.5 are more realistic, values too large lead to chaotic
                            // waves
     float m_dt; // time step
+    float m_maxVelocity; // largest velocity component, reduced at the end of every update
+    EAdvectionScheme m_advectionScheme;
+    bool m_parallelAdvection; // scatter in slabs of rows on all cores
+    bool m_ispcKernels; // prefer the ISPC kernels where they apply
+    bool m_deterministic; // same results on any number of threads
+    bool m_diffusionBlocking; // temporally blocked diffusion where it applies
+    int32 m_detailRadius; // distance in cells from the focus points simulated at full detail
+    int32 m_scheduleRadius; // distance in cells from the focus points updated every tick
+    int32 m_coarseFactor; // edge length of a coarse block
+    int32 m_maxBreachZone; // cells a breach zone may have, larger ones vent through their faces only
+    float m_ventRate; // fraction of a cell's gas that leaves through one vacuum face per second
+    float m_vented; // gas removed by venting
+    float m_maxPressureDelta; // largest partial pressure change of the last update
+    float m_steadyVelocity; // velocity below which the flow is at rest
+    float m_steadyPressure; // pressure change below which the pressure is at rest
+    int32 m_steadyTicks; // quiet updates before the grid is steady
+    int32 m_quietTicks; // updates in a row below both thresholds
+    mutable SIZE_T m_peakTransientBytes; // largest scratch allocated by a single advection call
     const int32 m_sizeX; // width of simulation
     const int32 m_sizeY; // height of simulation
     const int32 m_sizeZ; // depth of the simulation
@@ -123,29 +395,112 @@ private:
     // the values to be > 0.  Used for self-advecting velocity as velocity can be < 0.
     void reverseSignedAdvection(VelPkg3D& v, float scale) const;
 
+    // Semi-Lagrangian advection pulls every cell's value from the point the velocity field traces back to
+    void semiLagrangianAdvection(const Fluid3D& in, Fluid3D& out, float force) const;
+
+    // MacCormack advection runs a semi-Lagrangian step forwards and backwards and corrects the forward result
+    // by half of the round trip error. The result is clamped to the values it was interpolated from
+    void macCormackAdvection(const Fluid3D& in, Fluid3D& out, float scale);
+    // Scales out so that it holds as much as in did
+    void restoreMass(const Fluid3D& in, Fluid3D& out) const;
+
+    // Finds where the value of a cell comes from after advecting it by `force` along the velocity field.
+    // Returns false if the cell does not move
+    bool traceCell(int32 x, int32 y, int32 z, float force, float& newX, float& newY, float& newZ) const;
+
+    // Scales advection to the grid size. Smaller grids mean larger cells, so the scale should be smaller
+    float advectionScale() const;
+
+    // Finds the largest velocity component
+    void updateMaxVelocity();
+
+    // Sums the gases of the cells changed in the current pass, or of every cell if the sums are not valid. With
+    // react, the cells of the pass run the reactions first, in the same sweep
+    void updateTotalPressure(bool react);
+
+    // Reactions over the time step of the current pass
+    TArray<FReactionTerm> reactionTerms() const;
+
+    // True if the ISPC kernels apply to the current pass
+    bool useIspc() const;
+
+    // Like wake() after gas was written to one cell, but sums only that cell again instead of the whole grid
+    void gasWritten(int32 x, int32 y, int32 z);
+
+    // Calls func(x, y, z) for every cell that is advected or accelerated at full detail
+    template <typename TFunc>
+    void forEachSimulatedCell(const Fluid3D& grid, TFunc&& func) const;
+
+    // Calls func(x, y, z) for the same cells as forEachSimulatedCell, for kernels that write to the cells up to
+    // ScatterReach rows away. In parallel, slabs of rows are run in two rounds of every other slab, so no two threads
+    // write to the same cell
+    template <typename TFunc>
+    void forEachScatterCell(const Fluid3D& grid, TFunc&& func) const;
+
     // Smooth out the velocity and pressure fields by applying a diffusion filter
-    void diffusionStable(const Fluid3D& in, Fluid3D& out, float scale) const;
+    // Returns the largest change of a cell
+    float diffusionStable(const Fluid3D& in, Fluid3D& out, float scale) const;
+
+    // Diffusion iterations per update of a field with these properties
+    int32 diffusionIterationsOf(const FluidProperties& properties) const;
+
+    // Iterations the next diffusion pass of a field can advance at once, out of the remaining ones
+    int32 diffusionDepth(int32 remaining) const;
+
+    // Runs `steps` iterations of diffusionStable() in one pass over the grid. A wavefront moves along Z, every
+    // iteration lags a plane behind the previous one and keeps its last three planes in a ring, so the grid streams
+    // through memory once instead of once per iteration. Every cell sums its neighbours in the same order as
+    // diffusionStable(), the result is the same to the bit. Returns the largest change of the last iteration
+    float diffusionBlocked(const Fluid3D& in, Fluid3D& out, float scale, int32 steps) const;
 
-    // Checks for boundaries and walls when diffuse gas
-    float transferPressure(const Fluid3D& in, int32 x, int32 y, int32 z, float force) const;
+    // diffusionStable() or diffusionBlocked(), whichever `steps` needs
+    float diffuse(const Fluid3D& in, Fluid3D& out, float scale, int32 steps) const;
+
+    // Iterations a blocked diffusion pass advances at most on a grid of this size
+    static int32 maxDiffusionDepth(int32 xSize, int32 ySize);
+
+    // Bytes of the intermediate planes of a blocked diffusion pass
+    static SIZE_T diffusionPlanesSize(int32 xSize, int32 ySize, int32 steps);
+
+    // Applies to the border cells of coarse regions the opposite of the diffusion flux full detail cells took
+    // from them, which keeps mass conserved across the detail levels
+    void diffuseRegionBorders(const Fluid3D& in, Fluid3D& out, float force) const;
+
+    // Finds the coarse blocks that can be averaged and how open the faces between them are
+    void classifyCoarseBlocks();
+
+    // Averages every coarse block and diffuses between neighbouring blocks, returns the largest change of a cell
+    float coarseDiffusion(Fluid3D& data, float force);
+
+    // Removes the gas that flows into space during this step
+    void updateVacuum();
+
+    // Number of faces of a cell gas vents through
+    int32 ventFaces(int32 x, int32 y, int32 z) const;
+
+    // Checks for boundaries and walls when diffuse gas, value(x, y, z) reads the field being diffused
+    template <typename TValue>
+    float transferPressure(const TValue& value, int32 x, int32 y, int32 z, float force) const;
 
     // Checks is specific direction is blocked for transfer
     bool isBlocked(int32 x, int32 y, int32 z, EFlowDirection dir) const;
 
+    // Bit n is set if advection from (x, y, z) may move gas into corner n of the cube at (x1A, y1A, z1A), in the
+    // order A to H. Corners in blocked cells, vacuum included, or behind a blocked face of the cell are not
+    uint32 openTargets(int32 x, int32 y, int32 z, int32 x1A, int32 y1A, int32 z1A) const;
+
     // Checks if destination point during advection is out of bounds and pulls point in if needed
     bool collide(int32 thisX, int32 thisY, int32 thisZ, float& newX, float& newY, float& newZ) const;
 
-    // Alters velocity to move areas of high pressure to low pressure to emulate incompressibility and mass
-    // conservation. Allows mass to circulate and not compress into a single cell
-    void pressureAcceleration(float scale);
-
-    // Exponentially Decays value towards zero to emulate natural friction on the forces
-    void exponentialDecay(Fluid3D& data, float decay) const;
+    // Writes the source velocity scaled by decay into the destination, and alters it to move areas of high pressure
+    // to low pressure to emulate incompressibility and mass conservation. Allows mass to circulate and not compress
+    // into a single cell. Every cell gathers the forces of its faces, so it is a single pass
+    void accelerate(float decay, float force);
 
-    // Cosmetic patch that accellerates the velocity field in a direction tangential to the curve defined by the
-    // surrounding points in ordert to produce vorticities in the fluid
+    // Cosmetic patch that accellerates the destination velocity in a direction tangential to the curve defined by
+    // the surrounding points in ordert to produce vorticities in the fluid
     void vorticityConfinement(float scale);
 
-    // Returns the vortex strength (curl) at the specified cell.
-    float curl(int32 x, int32 y, int32 z) const;
+    // Returns the vortex strength (curl) of the velocity at the specified cell.
+    static float curl(const Fluid3D& vx, const Fluid3D& vy, const Fluid3D& vz, int32 x, int32 y, int32 z);
 };
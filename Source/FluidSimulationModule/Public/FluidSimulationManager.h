@@ -17,14 +17,212 @@
 #pragma once
 
 #include "FluidSimulation3D.h"
+#include "AtmoGasQueue.h"
+#include "AtmoOverlay2D.h"
+#include "AtmoSnapshot3D.h"
 #include "AtmoStruct.h"
+#include "AtmoSubscriptions.h"
+
+class FFluidSimulationScheduler;
+
+// Quality reductions the CPU budget governor applies, one per quality level in the configured order
+enum class EAtmosDegradation : uint8
+{
+    // Halves the diffusion iterations
+    DiffusionIterations,
+    // Skips vorticity confinement
+    Vorticity,
+    // Halves the schedule radius, so far regions update less often
+    FarUpdateRate
+};
 
 class FLUIDSIMULATIONMODULE_API FFluidSimulationManager : public FRunnable
 {
 public:
     FFluidSimulationManager();
 
-    void setSize(FVector size);
+    ~FFluidSimulationManager();
+
+    // Returns false if the grid does not fit the memory budget even in the cheapest storage mode
+    bool setSize(FVector size);
+
+    // Grows or shrinks the grid of a running simulation, e.g. when a shuttle docks. Cell (x, y, z) of the grid of
+    // the previous request becomes cell (x, y, z) + offset, cells new to the grid are seeded like on start. The new
+    // grid is built on a worker thread and swapped in between two ticks, a resize requested before that replaces
+    // the pending one and the offsets of both add up. Falls back to setSize() before start(). Returns false if the
+    // grid does not fit the memory budget
+    bool resize(FVector size, const FIntVector& offset = FIntVector::ZeroValue);
+
+    // Number of the last resize request, 0 before the first one
+    int32 requestedResize() const;
+
+    // Number of the resize request the running grid was built for. Thread safe
+    int32 appliedResize() const { return m_runningResize.GetValue(); }
+
+    // Cells passed to and read from the manager stay cells of the grid of this request, so a caller keeps mapping
+    // world locations with the layout it had until it sees appliedResize() change and switches over
+    void acknowledgeResize(int32 request);
+
+    // Memory layout of the simulation grids, takes effect on start()
+    void setLayout(EArray3DLayout layout) { m_layout = layout; }
+
+    // Pads the rows of the simulation grids for aligned SIMD access, takes effect on start()
+    void setPadRows(bool enabled) { m_padRows = enabled; }
+
+    // Bytes the simulation grids may take including the transient peak of an update, 0 is unlimited. setSize()
+    // and Init() drop the row padding, then the Morton layout, then switch to MacCormack advection until the grid
+    // fits, and refuse it if it still does not
+    void setMemoryBudget(SIZE_T bytes) { m_memoryBudget = bytes; }
+
+    // Bytes held by the simulation as of the last tick, all zero before Init(). Thread safe
+    FAtmosMemoryUsage getMemoryUsage() const;
+
+    // Advection scheme of the simulation, takes effect on start()
+    void setAdvectionScheme(EAdvectionScheme scheme) { m_advectionScheme = scheme; }
+
+    // Runs the scattering advection kernels on all cores, takes effect on start()
+    void setParallelAdvection(bool enabled) { m_parallelAdvection = enabled; }
+
+    // Prefers the ISPC kernels when the module was built with them, takes effect on start(). Off by default until
+    // every target has been checked against the C++ kernels
+    void setIspcKernels(bool enabled) { m_ispcKernels = enabled; }
+
+    // Same results on any number of threads and on every run, e.g. to check an optimisation against a recording.
+    // Every tick advances by one step interval however late it runs and the tick budget no longer lowers the
+    // quality, takes effect on start()
+    void setDeterministic(bool enabled) { m_deterministic = enabled; }
+
+    // Diffusion rate of a gas and its iterations per update, 0 runs as many as the bulk gases. Trace gases settle
+    // with fewer iterations, takes effect on start()
+    void setGasDiffusion(EGasType::Type gas, float rate, int32 iterations = 0)
+    {
+        m_gasProperties[gas].diffusion = rate;
+        m_gasProperties[gas].iterations = iterations;
+    }
+
+    // Step as rarely as the CFL condition allows instead of at a fixed rate
+    void setAdaptiveTimeStep(bool enabled) { m_adaptiveTimeStep = enabled; }
+
+    // Fraction of a cell the fastest flow may cross per step, collide() clamps at 1.5
+    void setCflNumber(float cfl) { m_cflNumber = cfl; }
+
+    // Steps an update may be split into when the stable step is shorter than the elapsed time
+    void setMaxSubSteps(int32 count) { m_maxSubSteps = count; }
+
+    // Bounds of the interval between two steps
+    void setTimeStepRange(float minStep, float maxStep)
+    {
+        m_minTimeStep = minStep;
+        m_maxTimeStep = maxStep;
+    }
+
+    // Distance in cells from the focus points kept at full detail, <= 0 disables the level of detail
+    void setDetailRadius(int32 radius) { m_detailRadius = radius; }
+
+    // Edge length of the blocks far regions are coarsened to, 2 or 4
+    void setCoarseFactor(int32 factor) { m_coarseFactor = factor; }
+
+    // Distance in cells from the focus points updated every tick, further regions update every 2nd, 4th or 8th
+    // tick. <= 0 updates everything every tick
+    void setScheduleRadius(int32 radius) { m_scheduleRadius = radius; }
+
+    // Cells around which the simulation runs at full detail, usually where the players are. Thread safe
+    void setFocus(const TArray<FIntVector>& focus);
+
+    // Keeps the region of the cell at full detail and updated every tick for a while. Thread safe
+    void addActiveEvent(const FIntVector& cell, float seconds);
+
+    // Opens a face of the cell to space, the breach stays at full detail for a while. Thread safe
+    void breach(const FIntVector& cell, EFlowDirection face);
+
+    // Closes a breached face again. Thread safe
+    void seal(const FIntVector& cell, EFlowDirection face);
+
+    // Turns a cell into open space or back. Thread safe
+    void setVacuum(const FIntVector& cell, bool value);
+
+    // Fraction of a cell's gas that leaves through one vacuum face per second, takes effect on start()
+    void setVentRate(float rate) { m_ventRate = rate; }
+
+    // Gas reactions of every cell, see FluidSimulation3D::reactions(). Applies with the next step
+    void setReactions(const TArray<FAtmoReaction>& reactions);
+
+    // Adds gas to a cell, negative amounts remove it. Thread safe
+    void addGas(const FIntVector& cell, const FAtmoStruct& gas);
+
+    // Removes up to `gas` from a cell and passes what was there to `drained` on the simulation thread. Thread safe
+    void drainGas(const FIntVector& cell, const FAtmoStruct& gas, TFunction<void(const FAtmoStruct&)>&& drained);
+
+    // Queues gas to add or remove without locking or allocating, for vents and scrubbers that run all the time.
+    // The commands are applied in one batch at the start of the next tick. Returns false if the queue is full, the
+    // command is dropped then. Thread safe
+    bool queueGas(const FAtmoGasCommand& command);
+
+    // Resumes a thread parked on a steady grid, call after writing to the simulation. Thread safe
+    void wake();
+
+    // Thresholds below which the grid counts as steady once it stayed there for `ticks` updates. The thread is
+    // parked while the grid is steady, takes effect on start()
+    void setSteadyState(float velocity, float pressure, int32 ticks)
+    {
+        m_steadyVelocity = velocity;
+        m_steadyPressure = pressure;
+        m_steadyTicks = ticks;
+    }
+
+    // True while the thread is parked on a steady grid
+    bool isIdle() const { return m_isIdle; }
+
+    // Seconds a tick may take before the governor lowers the quality, <= 0 disables the governor
+    void setTickBudget(float seconds) { m_tickBudget = seconds; }
+
+    // Reductions applied one by one while ticks overrun the budget, and undone in reverse when there is
+    // headroom. Entries may repeat. Takes effect on start()
+    void setDegradationOrder(const TArray<EAtmosDegradation>& order) { m_degradationOrder = order; }
+
+    // Number of reductions currently applied, 0 is full quality
+    int32 getQualityLevel() const { return m_qualityLevel; }
+
+    // Runs the simulation on the workers of a shared scheduler instead of a thread of its own, null for its own
+    // thread. Higher priorities tick first when several grids are due, maxRate caps the ticks per second and <= 0
+    // leaves the rate to the step interval. Takes effect on start()
+    void setScheduler(FFluidSimulationScheduler* scheduler, int32 priority = 0, float maxRate = 0.0f)
+    {
+        m_scheduler = scheduler;
+        m_schedulePriority = priority;
+        m_scheduleMaxRate = maxRate;
+    }
+
+    // Priority of the simulation thread, applies to a running thread too
+    void setThreadPriority(EThreadPriority priority);
+
+    // Cores the simulation thread may run on, takes effect on start()
+    void setThreadAffinity(uint64 mask) { m_threadAffinity = mask; }
+
+    // Seconds between two snapshots for replication, <= 0 disables them
+    void setSnapshotInterval(float seconds) { m_snapshotInterval = seconds; }
+
+    // Pressure units of one quantization step of the snapshots
+    void setSnapshotQuantum(float quantum) { m_snapshotQuantum = quantum; }
+
+    // Latest quantized snapshot of the gases, null before the first one was taken. Thread safe
+    TSharedPtr<const AtmoSnapshot3D, ESPMode::ThreadSafe> getSnapshot() const;
+
+    // Converts every snapshot into the overlay heat map on the simulation thread
+    void setOverlayEnabled(bool enabled) { m_overlayEnabled = enabled; }
+
+    // Heat map of the latest snapshot, see AtmoOverlay2D for which calls are thread safe
+    AtmoOverlay2D& getOverlay() { return m_overlay; }
+
+    // Watches a box of cells and reports when its mean crosses the threshold, checked after every tick. Returns
+    // the handle events refer to. Thread safe
+    int32 subscribe(const FAtmoSubscription& subscription);
+
+    // Thread safe
+    void unsubscribe(int32 handle) { m_subscriptions.remove(handle); }
+
+    // Crossings since the last call, false if there were none. Thread safe
+    bool takeThresholdEvents(TArray<FAtmoThresholdEvent>& events) { return m_subscriptions.takeEvents(events); }
 
     void start();
 
@@ -36,22 +234,156 @@ public:
 
     void Stop() override;
 
+    // Runs the work due on the calling thread: queued edits and, unless the grid is parked, one step. Not thread
+    // safe, called by Run() or by the scheduler hosting the simulation
+    void tick();
+
+    // When the next tick() is due in FPlatformTime::Seconds(), the largest double while parked without work
+    double nextTickTime() const;
+
+    // True if work arrived for a parked grid since the last tick. Thread safe
+    bool hasWork() const { return m_hasWork; }
+
     FAtmoStruct getPressure(int32 x, int32 y, int32 z) const;
 
+    // Sum of all gases of the cell, as of the end of the last tick
+    float getTotalPressure(int32 x, int32 y, int32 z) const;
+
     FVector getVelocity(int32 x, int32 y, int32 z) const;
 
 private:
-    EFlowDirection initializeSolid(int32 x, int32 y, int32 z) const;
+    struct FActiveEvent
+    {
+        FIntVector cell;
+        double expiry;
+    };
+
+    // Creates a simulation with the current settings and seeds its grids
+    TUniquePtr<FluidSimulation3D> createSimulation(const FIntVector& size) const;
+
+    EFlowDirection initializeSolid(const FIntVector& size, int32 x, int32 y, int32 z) const;
 
     float initializeAtmoCell(int32 x, int32 y, int32 z, uint32 type) const;
 
+    float stepInterval() const;
+
+    void applyResize();
+
+    // Cell of the grid the queued edits address for a cell passed in. Call with m_frameLock held
+    FIntVector inputCell(const FIntVector& cell) const;
+
+    // Cell of the running grid for a cell passed in. Call with m_simLock held
+    FIntVector runningCell(const FIntVector& cell) const;
+
+    void applyFocus();
+
+    void applyEdits();
+
+    // Applies the drained gas commands for the elapsed seconds and drops the ones that ran out
+    void applyGasCommands(float elapsed);
+
+    void enqueue(TFunction<void(FluidSimulation3D&)>&& edit);
+
+    // Wakes whatever runs the simulation
+    void signal();
+
+    void governQuality(double tickTime);
+
+    void applyQuality();
+
+    void captureSnapshot();
+
+    FArray3DPolicy gridPolicy() const { return FArray3DPolicy(0, m_padRows, m_layout); }
+
+    // Degrades the storage settings until the estimate fits the memory budget, false if it never does
+    bool fitMemoryBudget(const FIntVector& size);
+
+    void updateMemoryUsage();
+
 private:
     /** SimulationObject */
     TUniquePtr<FluidSimulation3D> m_sim;
+    /** Held while the simulation is replaced, the accessors for other threads take it too */
+    mutable FCriticalSection m_simLock;
     /** Thread to run the worker FRunnable on */
     TUniquePtr<FRunnableThread> m_thread;
     /** Stop this thread? Uses Thread Safe Counter */
     FThreadSafeBool m_isTaskStopped;
 
     FIntVector m_size;
+    FCriticalSection m_resizeLock;
+    TUniquePtr<FluidSimulation3D> m_resized; // built by the resize task, waiting to be swapped in
+    int32 m_resizedRequest; // resize request m_resized was built for
+    TFuture<void> m_resizeTask;
+    // Resize requests are numbered from 1, 0 is the grid start() made. Cell c of that grid is cell c + offset in
+    // the grid of every request
+    mutable FCriticalSection m_frameLock;
+    TArray<FIntVector> m_resizeOffsets; // under m_frameLock
+    FThreadSafeCounter m_gameResize; // request of the cells passed in, written under m_frameLock
+    int32 m_inputResize; // request of the queued edits, focus and subscriptions, under m_frameLock
+    FThreadSafeCounter m_runningResize; // request of m_sim, written under m_simLock
+
+    EArray3DLayout m_layout;
+    bool m_padRows;
+    EAdvectionScheme m_advectionScheme;
+    bool m_parallelAdvection;
+    bool m_ispcKernels;
+    bool m_deterministic;
+
+    bool m_adaptiveTimeStep;
+    float m_cflNumber;
+    float m_minTimeStep;
+    float m_maxTimeStep;
+    int32 m_maxSubSteps;
+
+    int32 m_detailRadius;
+    int32 m_coarseFactor;
+    int32 m_scheduleRadius;
+    FCriticalSection m_focusLock;
+    TArray<FIntVector> m_focus;
+    TArray<FActiveEvent> m_events;
+    bool m_focusChanged;
+
+    float m_ventRate;
+    mutable FCriticalSection m_editLock;
+    TArray<TFunction<void(FluidSimulation3D&)>> m_edits; // edits from other threads, applied between steps
+    TArray<FAtmoReaction> m_reactions; // under m_editLock, for simulations created later
+    AtmoGasQueue m_gasQueue;
+    TArray<FAtmoGasCommand> m_gasCommands; // drained commands that still run, simulation thread only
+
+    float m_steadyVelocity;
+    float m_steadyPressure;
+    int32 m_steadyTicks;
+    /** Signalled when the thread parked on a steady grid has work again */
+    FEvent* m_wakeEvent;
+    FThreadSafeBool m_isIdle;
+    FThreadSafeBool m_hasWork; // set by every edit, cleared at the start of every tick
+    double m_tickTime; // when the last step ended
+
+    int32 m_diffusionIterations;
+    TArray<FluidProperties, TFixedAllocator<EGasType::GasTypeCount>> m_gasProperties;
+    float m_vorticity;
+    float m_tickBudget;
+    TArray<EAtmosDegradation> m_degradationOrder;
+    int32 m_qualityLevel;
+    int32 m_headroomTicks; // ticks in a row well within the budget
+    EThreadPriority m_threadPriority;
+    uint64 m_threadAffinity;
+
+    float m_snapshotInterval;
+    float m_snapshotQuantum;
+    double m_snapshotTime; // when the last snapshot was taken
+    mutable FCriticalSection m_snapshotLock;
+    TSharedPtr<const AtmoSnapshot3D, ESPMode::ThreadSafe> m_snapshot;
+    FThreadSafeBool m_overlayEnabled;
+    AtmoOverlay2D m_overlay;
+    AtmoSubscriptions m_subscriptions;
+
+    SIZE_T m_memoryBudget;
+    mutable FCriticalSection m_memoryLock;
+    FAtmosMemoryUsage m_memoryUsage;
+
+    FFluidSimulationScheduler* m_scheduler;
+    int32 m_schedulePriority;
+    float m_scheduleMaxRate;
 };
@@ -0,0 +1,117 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "AtmoStruct.h"
+#include "EngineMinimal.h"
+
+class FFluidSimulationManager;
+
+// Runs any number of simulations, e.g. the station, its shuttles and outposts, on a fixed pool of worker threads
+// instead of a thread per grid. Every free worker takes the due simulation with the highest priority, so the
+// number of atmospherics threads is bounded however many grids a map has. Docking ports couple two grids by
+// exchanging gas between a cell of each. All calls are thread safe
+class FLUIDSIMULATIONMODULE_API FFluidSimulationScheduler
+{
+public:
+    FFluidSimulationScheduler();
+
+    ~FFluidSimulationScheduler();
+
+    // Scheduler shared by every grid of the module
+    static FFluidSimulationScheduler& get();
+
+    // Worker threads, started with the first simulation and stopped after the last one is removed. Applies the
+    // next time they start
+    void setWorkerCount(int32 count);
+
+    // Hosts a started simulation, see FFluidSimulationManager::setScheduler(). Its Init() runs on a worker
+    void add(FFluidSimulationManager* manager, int32 priority, float maxRate);
+
+    // Stops hosting a simulation and disconnects its ports, waits for a tick in progress
+    void remove(FFluidSimulationManager* manager);
+
+    // Connects a cell of one simulation with a cell of another. Every second, `rate` of the difference of each
+    // gas flows to the side with less. Returns the handle of the port
+    int32 connect(FFluidSimulationManager* managerA,
+                  const FIntVector& cellA,
+                  FFluidSimulationManager* managerB,
+                  const FIntVector& cellB,
+                  float rate);
+
+    void disconnect(int32 port);
+
+    // Lets a waiting worker look for due simulations again, called when a parked simulation gets work
+    void wake();
+
+private:
+    class FWorker;
+
+    struct FEntry
+    {
+        FFluidSimulationManager* manager;
+        int32 priority;
+        double minInterval; // seconds between two ticks at the capped rate, 0 if uncapped
+        double lastTick; // when the last tick started
+        bool initialized;
+        bool running;
+    };
+
+    struct FPort
+    {
+        int32 handle;
+        FFluidSimulationManager* managers[2];
+        FIntVector cells[2];
+        FAtmoStruct samples[2]; // gases of each cell as of its grid's last tick
+        bool sampled[2];
+        float rate;
+        double exchangeTime; // when gas was last exchanged
+    };
+
+    // Marks the most urgent due simulation as running and returns it, null if none is due. Lowers wait to the
+    // seconds until the next one is, initialized is false if the simulation still has to be initialized
+    FFluidSimulationManager* acquire(double& wait, bool& initialized);
+
+    // Runs the work of a simulation returned by acquire() on the calling worker
+    void run(FFluidSimulationManager* manager, bool initialized);
+
+    // Samples the ports of a simulation that just ticked and exchanges gas through them
+    void exchange(FFluidSimulationManager* manager);
+
+    void startWorkers();
+
+    void stopWorkers();
+
+    // Gas drained from one side of a port, added to the other side by the next exchange
+    struct FCredit
+    {
+        FFluidSimulationManager* manager;
+        FIntVector cell;
+        FAtmoStruct gas;
+    };
+
+    FCriticalSection m_lock;
+    TArray<FEntry> m_entries;
+    TArray<FPort> m_ports;
+    FCriticalSection m_creditLock; // taken last, the simulation threads add credits while holding their own locks
+    TArray<FCredit> m_credits;
+    FCriticalSection m_workerLock; // taken before m_lock when both are needed
+    TArray<TUniquePtr<FWorker>> m_workers;
+    FEvent* m_workEvent; // signalled when a simulation may have become due
+    int32 m_workerCount;
+    int32 m_nextPort;
+};
@@ -0,0 +1,75 @@
+// The MIT License (MIT)
+// Copyright (c) 2018 RxCompile
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+// documentation files (the "Software"), to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions
+// of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+// WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+// OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "Platform.h"
+
+// Z-order (Morton) curve helpers. Interleaving the bits of x, y and z keeps cells that are close in 3D close in
+// memory, so a 2x2x2 cube of cells usually lands in one or two cache lines.
+struct FMorton3D
+{
+    // TArray3D stores Morton ordered bricks of BrickSize^3 cells, bricks themselves are laid out x-fastest.
+    // Bricks bound the padding a pure Morton curve would need on flat, non power of two grids.
+    static constexpr int32 BrickBits = 2;
+    static constexpr int32 BrickSize = 1 << BrickBits;
+    static constexpr int32 BrickMask = BrickSize - 1;
+    static constexpr int32 BrickCells = BrickSize * BrickSize * BrickSize;
+
+    // Inserts two zero bits between each of the low 10 bits of value
+    static FORCEINLINE uint32 spread(uint32 value)
+    {
+        value &= 0x000003ff;
+        value = (value | (value << 16)) & 0x030000ff;
+        value = (value | (value << 8)) & 0x0300f00f;
+        value = (value | (value << 4)) & 0x030c30c3;
+        value = (value | (value << 2)) & 0x09249249;
+        return value;
+    }
+
+    // Inverse of spread
+    static FORCEINLINE uint32 compact(uint32 value)
+    {
+        value &= 0x09249249;
+        value = (value | (value >> 2)) & 0x030c30c3;
+        value = (value | (value >> 4)) & 0x0300f00f;
+        value = (value | (value >> 8)) & 0x030000ff;
+        value = (value | (value >> 16)) & 0x000003ff;
+        return value;
+    }
+
+    // Morton code of coordinates in [0, 1024)
+    static FORCEINLINE uint32 encode(uint32 x, uint32 y, uint32 z)
+    {
+        return spread(x) | spread(y) << 1 | spread(z) << 2;
+    }
+
+    static FORCEINLINE void decode(uint32 code, uint32& x, uint32& y, uint32& z)
+    {
+        x = compact(code);
+        y = compact(code >> 1);
+        z = compact(code >> 2);
+    }
+
+    // Morton code of a cell inside its brick, only the low BrickBits of every coordinate are used
+    static FORCEINLINE uint32 encodeInBrick(uint32 x, uint32 y, uint32 z)
+    {
+        return spreadInBrick(x) | spreadInBrick(y) << 1 | spreadInBrick(z) << 2;
+    }
+
+private:
+    static FORCEINLINE uint32 spreadInBrick(uint32 value) { return (value & 1) | (value & 2) << 2; }
+};
@@ -27,7 +27,7 @@ class FLUIDSIMULATIONMODULE_API VelPkg3D
 public:
     VelPkg3D();
     // Constructor - Initilizes source and destination FLuid3D objects for velocity in X, Y, Z directions
-    VelPkg3D(int32 xSize, int32 ySize, int32 zSize);
+    VelPkg3D(int32 xSize, int32 ySize, int32 zSize, const FArray3DPolicy& policy = FArray3DPolicy());
 
     // Swap the source and destination objects for velocity
     void swap();
@@ -35,6 +35,9 @@ public:
     // Reset the source and destination objects to specified value
     void reset(float value);
 
+    // Bytes held by the grids of all components
+    SIZE_T allocatedSize() const;
+
     // Accessors
     const Fluid3D& sourceX() const { return m_data[0].source(); }
     const Fluid3D& sourceY() const { return m_data[1].source(); }
@@ -44,6 +47,7 @@ public:
     Fluid3D& destinationY() { return m_data[1].destination(); }
     Fluid3D& destinationZ() { return m_data[2].destination(); }
 
+    const FluidProperties& properties() const { return m_prop; }
     FluidProperties& properties() { return m_prop; }
 
 private:
@@ -17,6 +17,8 @@
 #include "SS13RemakePlayerController.h"
 #include "AI/Navigation/NavigationSystem.h"
 #include "Engine/World.h"
+#include "EngineUtils.h"
+#include "WorldGrid.h"
 
 ASS13RemakePlayerController::ASS13RemakePlayerController() : bMoveToMouseCursor(false)
 {
@@ -35,6 +37,43 @@ void ASS13RemakePlayerController::PlayerTick(float deltaTime)
     }
 }
 
+void ASS13RemakePlayerController::EndPlay(const EEndPlayReason::Type endPlayReason)
+{
+    if(HasAuthority())
+    {
+        for(TActorIterator<AWorldGrid> it(GetWorld()); it; ++it)
+        {
+            it->removeAtmosClient(this);
+        }
+    }
+    Super::EndPlay(endPlayReason);
+}
+
+void ASS13RemakePlayerController::ClientReceiveAtmos_Implementation(AWorldGrid* grid, const TArray<uint8>& packet)
+{
+    if(grid == nullptr)
+        return;
+
+    const auto sequence = grid->receiveAtmos(packet);
+    if(sequence != INDEX_NONE)
+    {
+        ServerAcknowledgeAtmos(grid, sequence);
+    }
+}
+
+bool ASS13RemakePlayerController::ServerAcknowledgeAtmos_Validate(AWorldGrid* grid, int32 sequence)
+{
+    return sequence > 0;
+}
+
+void ASS13RemakePlayerController::ServerAcknowledgeAtmos_Implementation(AWorldGrid* grid, int32 sequence)
+{
+    if(grid != nullptr)
+    {
+        grid->acknowledgeAtmos(this, sequence);
+    }
+}
+
 void ASS13RemakePlayerController::SetupInputComponent()
 {
     // set up gameplay key bindings
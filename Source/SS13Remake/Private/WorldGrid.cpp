@@ -15,10 +15,29 @@
 // OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include "WorldGrid.h"
+#include "Engine/Texture2D.h"
+#include "Engine/World.h"
+#include "FluidSimulationScheduler.h"
+#include "GameFramework/Pawn.h"
+#include "GameFramework/PlayerController.h"
+#include "SS13RemakePlayerController.h"
+#include "TextureResource.h"
 #include "UniquePtr.h"
 
 // Sets default values
 AWorldGrid::AWorldGrid()
+  : AtmosReplicationInterval(0.25f)
+  , AtmosReplicationThreshold(0.5f)
+  , AtmosMemoryBudgetMB(0)
+  , AtmosSharedScheduler(false)
+  , AtmosSchedulePriority(0)
+  , AtmosMaxTickRate(0.0f)
+  , ShowAtmosOverlay(false)
+  , AtmosOverlayField(EAtmoOverlayField::Pressure)
+  , AtmosOverlayLevel(1)
+  , AtmosOverlayRange(500.0f)
+  , AtmosOverlayTexture(nullptr)
+  , m_atmosReplicationTime(0.0f)
 {
     PrimaryActorTick.bCanEverTick = true;
     m_atmosphericsManager = MakeUnique<FFluidSimulationManager>();
@@ -48,7 +67,17 @@ void AWorldGrid::OnConstruction(const FTransform& transform)
 void AWorldGrid::BeginPlay()
 {
     Super::BeginPlay();
-    m_atmosphericsManager->setSize(Size);
+    // Clients get the atmospherics from the server
+    if(GetNetMode() == NM_Client)
+        return;
+    m_atmosphericsManager->setMemoryBudget(static_cast<SIZE_T>(FMath::Max(AtmosMemoryBudgetMB, 0)) * 1024 * 1024);
+    if(!m_atmosphericsManager->setSize(Size))
+        return;
+    m_atmosphericsManager->setSnapshotInterval(AtmosReplicationInterval);
+    m_atmosphericsManager->setReactions(AtmosReactions);
+    if(AtmosSharedScheduler)
+        m_atmosphericsManager->setScheduler(
+          &FFluidSimulationScheduler::get(), AtmosSchedulePriority, FMath::Max(AtmosMaxTickRate, 0.0f));
     m_atmosphericsManager->start();
 }
 
@@ -56,6 +85,286 @@ void AWorldGrid::BeginPlay()
 void AWorldGrid::Tick(float deltaTime)
 {
     Super::Tick(deltaTime);
+    updateAtmosOverlay();
+    if(GetNetMode() == NM_Client)
+        return;
+
+    applyAtmosResizes();
+
+    // Atmospherics run at full detail only around the players
+    TArray<FIntVector> focus;
+    for(auto it = GetWorld()->GetPlayerControllerIterator(); it; ++it)
+    {
+        const auto* controller = it->Get();
+        if(controller == nullptr || controller->GetPawn() == nullptr)
+            continue;
+        const auto index = getCellIndexFromWorldLocation(controller->GetPawn()->GetActorLocation());
+        if(index != FIntVector::NoneValue)
+            focus.Add(index);
+    }
+    m_atmosphericsManager->setFocus(focus);
+    dispatchAtmosEvents();
+
+    m_atmosReplicationTime += deltaTime;
+    if(m_atmosReplicationTime >= AtmosReplicationInterval)
+    {
+        m_atmosReplicationTime = 0.0f;
+        replicateAtmos();
+    }
+}
+
+void AWorldGrid::replicateAtmos()
+{
+    const auto snapshot = m_atmosphericsManager->getSnapshot();
+    if(!snapshot.IsValid())
+        return;
+
+    // Every remote player gets the tiles that changed since its last acknowledgement, the ones around it first
+    m_atmosReplicator.threshold(AtmosReplicationThreshold);
+    TArray<uint8> packet;
+    for(auto it = GetWorld()->GetPlayerControllerIterator(); it; ++it)
+    {
+        auto* controller = Cast<ASS13RemakePlayerController>(it->Get());
+        if(controller == nullptr || controller->IsLocalController())
+            continue;
+        auto focus = FIntVector(0);
+        if(controller->GetPawn() != nullptr)
+        {
+            const auto index = getCellIndexFromWorldLocation(controller->GetPawn()->GetActorLocation());
+            if(index != FIntVector::NoneValue)
+                focus = index;
+        }
+        if(m_atmosReplicator.buildPacket(controller->GetUniqueID(), *snapshot, focus, packet))
+            controller->ClientReceiveAtmos(this, packet);
+    }
+}
+
+void AWorldGrid::dispatchAtmosEvents()
+{
+    TArray<FAtmoThresholdEvent> events;
+    if(!m_atmosphericsManager->takeThresholdEvents(events))
+        return;
+    for(const auto& event : events)
+        OnAtmosThreshold.Broadcast(event.subscription, event.triggered, event.value);
+}
+
+int32 AWorldGrid::SubscribeAtmos(const FVector& minLocation,
+                                 const FVector& maxLocation,
+                                 EAtmoOverlayField field,
+                                 EAtmoThresholdComparison comparison,
+                                 float threshold,
+                                 float hysteresis)
+{
+    if(GetNetMode() == NM_Client)
+        return INDEX_NONE;
+    const auto first = getCellIndexFromWorldLocation(minLocation);
+    const auto last = getCellIndexFromWorldLocation(maxLocation);
+    if(first == FIntVector::NoneValue || last == FIntVector::NoneValue)
+        return INDEX_NONE;
+
+    FAtmoSubscription subscription;
+    subscription.min = FIntVector(
+      FMath::Min(first.X, last.X), FMath::Min(first.Y, last.Y), FMath::Min(first.Z, last.Z));
+    subscription.max = FIntVector(
+      FMath::Max(first.X, last.X), FMath::Max(first.Y, last.Y), FMath::Max(first.Z, last.Z));
+    subscription.field = field;
+    subscription.comparison = comparison;
+    subscription.threshold = threshold;
+    subscription.hysteresis = FMath::Max(hysteresis, 0.0f);
+    return m_atmosphericsManager->subscribe(subscription);
+}
+
+void AWorldGrid::UnsubscribeAtmos(int32 subscription)
+{
+    m_atmosphericsManager->unsubscribe(subscription);
+}
+
+void AWorldGrid::SetAtmosReactions(const TArray<FAtmoReaction>& reactions)
+{
+    AtmosReactions = reactions;
+    m_atmosphericsManager->setReactions(reactions);
+}
+
+bool AWorldGrid::AddAtmosGas(const FVector& location, const FAtmoStruct& rate, float seconds)
+{
+    if(GetNetMode() == NM_Client)
+        return false;
+    FAtmoGasCommand command;
+    if(!getCellPositionFromWorldLocation(location, command.position))
+        return false;
+
+    command.shape = EAtmoGasShape::Point;
+    command.max = FIntVector::ZeroValue;
+    command.rate = rate;
+    command.seconds = seconds;
+    return m_atmosphericsManager->queueGas(command);
+}
+
+bool AWorldGrid::AddAtmosGasToRegion(const FVector& minLocation,
+                                     const FVector& maxLocation,
+                                     const FAtmoStruct& rate,
+                                     float seconds)
+{
+    if(GetNetMode() == NM_Client)
+        return false;
+    const auto first = getCellIndexFromWorldLocation(minLocation);
+    const auto last = getCellIndexFromWorldLocation(maxLocation);
+    if(first == FIntVector::NoneValue || last == FIntVector::NoneValue)
+        return false;
+
+    FAtmoGasCommand command;
+    command.shape = EAtmoGasShape::Region;
+    command.position = FVector(
+      FMath::Min(first.X, last.X), FMath::Min(first.Y, last.Y), FMath::Min(first.Z, last.Z));
+    command.max = FIntVector(
+      FMath::Max(first.X, last.X), FMath::Max(first.Y, last.Y), FMath::Max(first.Z, last.Z));
+    command.rate = rate;
+    command.seconds = seconds;
+    return m_atmosphericsManager->queueGas(command);
+}
+
+bool AWorldGrid::ResizeGrid(const FVector& newSize, const FVector& cellOffset)
+{
+    if(GetNetMode() == NM_Client)
+        return false;
+    const auto offset = FIntVector(
+      FMath::RoundToInt(cellOffset.X), FMath::RoundToInt(cellOffset.Y), FMath::RoundToInt(cellOffset.Z));
+    const auto started = m_atmosphericsManager->isStarted();
+    if(!m_atmosphericsManager->resize(newSize, offset))
+        return false;
+
+    // The grid is centred on the actor, move it so that every tile stays where it was
+    const auto& size = m_pendingResizes.Num() > 0 ? m_pendingResizes.Last().size : Size;
+    const auto shift = (newSize - size) * CellExtent / 2.0f - FVector(offset) * CellExtent * 2.0f;
+    if(started)
+    {
+        m_pendingResizes.Add({m_atmosphericsManager->requestedResize(), newSize, shift});
+        return true;
+    }
+    Size = newSize;
+    SetActorLocation(GetActorLocation() + shift);
+    OnConstruction(GetActorTransform());
+    return true;
+}
+
+void AWorldGrid::applyAtmosResizes()
+{
+    // The manager keeps reading cells of the old grid until it is told that locations map to the new one
+    const auto applied = m_atmosphericsManager->appliedResize();
+    auto shift = FVector::ZeroVector;
+    auto count = 0;
+    for(; count < m_pendingResizes.Num() && m_pendingResizes[count].request <= applied; ++count)
+    {
+        Size = m_pendingResizes[count].size;
+        shift += m_pendingResizes[count].shift;
+    }
+    if(count == 0)
+        return;
+
+    m_pendingResizes.RemoveAt(0, count);
+    SetActorLocation(GetActorLocation() + shift);
+    OnConstruction(GetActorTransform());
+    m_atmosphericsManager->acknowledgeResize(applied);
+}
+
+int32 AWorldGrid::ConnectAtmos(AWorldGrid* other, const FVector& location, const FVector& otherLocation, float rate)
+{
+    if(GetNetMode() == NM_Client || !other || other == this || !AtmosSharedScheduler || !other->AtmosSharedScheduler)
+        return INDEX_NONE;
+    const auto cell = getCellIndexFromWorldLocation(location);
+    const auto otherCell = other->getCellIndexFromWorldLocation(otherLocation);
+    if(cell == FIntVector::NoneValue || otherCell == FIntVector::NoneValue)
+        return INDEX_NONE;
+    return FFluidSimulationScheduler::get().connect(
+      m_atmosphericsManager.Get(), cell, other->m_atmosphericsManager.Get(), otherCell, FMath::Max(rate, 0.0f));
+}
+
+void AWorldGrid::DisconnectAtmos(int32 port)
+{
+    FFluidSimulationScheduler::get().disconnect(port);
+}
+
+int32 AWorldGrid::receiveAtmos(const TArray<uint8>& packet)
+{
+    const auto sequence = m_atmosReplica.receive(packet);
+    if(sequence != INDEX_NONE && ShowAtmosOverlay)
+        m_atmosOverlay.capture(m_atmosReplica.values());
+    return sequence;
+}
+
+void AWorldGrid::updateAtmosOverlay()
+{
+    // The server converts on the simulation thread, clients whenever a packet arrives
+    const auto isClient = GetNetMode() == NM_Client;
+    if(!isClient)
+        m_atmosphericsManager->setOverlayEnabled(ShowAtmosOverlay);
+    if(!ShowAtmosOverlay)
+        return;
+
+    auto& overlay = isClient ? m_atmosOverlay : m_atmosphericsManager->getOverlay();
+    overlay.settings(AtmosOverlayField, AtmosOverlayLevel, AtmosOverlayRange);
+
+    TArray<FIntRect> tiles;
+    TArray<FColor> texels;
+    if(!overlay.takeDirty(tiles, texels))
+        return;
+
+    if(AtmosOverlayTexture == nullptr || AtmosOverlayTexture->GetSizeX() != overlay.sizeX() ||
+       AtmosOverlayTexture->GetSizeY() != overlay.sizeY())
+    {
+        AtmosOverlayTexture = UTexture2D::CreateTransient(overlay.sizeX(), overlay.sizeY());
+        AtmosOverlayTexture->AddressX = TA_Clamp;
+        AtmosOverlayTexture->AddressY = TA_Clamp;
+        AtmosOverlayTexture->Filter = TF_Nearest;
+        AtmosOverlayTexture->SRGB = false;
+        AtmosOverlayTexture->UpdateResource();
+    }
+    uploadAtmosOverlay(MoveTemp(tiles), MoveTemp(texels));
+}
+
+void AWorldGrid::uploadAtmosOverlay(TArray<FIntRect>&& tiles, TArray<FColor>&& texels)
+{
+    if(AtmosOverlayTexture == nullptr || AtmosOverlayTexture->Resource == nullptr)
+        return;
+
+    // Every tile is uploaded from its own TileSize x TileSize block of texels, see AtmoOverlay2D::takeDirty
+    struct FOverlayUpdate
+    {
+        FTexture2DResource* resource;
+        TArray<FUpdateTextureRegion2D> regions;
+        TArray<FColor> texels;
+    };
+    auto* update = new FOverlayUpdate;
+    update->resource = static_cast<FTexture2DResource*>(AtmosOverlayTexture->Resource);
+    for(const auto& tile : tiles)
+    {
+        update->regions.Emplace(tile.Min.X, tile.Min.Y, 0, 0, tile.Width(), tile.Height());
+    }
+    update->texels = MoveTemp(texels);
+
+    ENQUEUE_UNIQUE_RENDER_COMMAND_ONEPARAMETER(UpdateAtmosOverlay, FOverlayUpdate*, update, update, {
+        const auto tileTexels = AtmoOverlay2D::TileSize * AtmoOverlay2D::TileSize;
+        const auto pitch = AtmoOverlay2D::TileSize * sizeof(FColor);
+        for(auto i = 0; i < update->regions.Num(); ++i)
+        {
+            RHIUpdateTexture2D(update->resource->GetTexture2DRHI(),
+                               0,
+                               update->regions[i],
+                               pitch,
+                               reinterpret_cast<const uint8*>(update->texels.GetData() + i * tileTexels));
+        }
+        delete update;
+    });
+}
+
+void AWorldGrid::acknowledgeAtmos(const APlayerController* controller, int32 sequence)
+{
+    m_atmosReplicator.acknowledge(controller->GetUniqueID(), sequence);
+}
+
+void AWorldGrid::removeAtmosClient(const APlayerController* controller)
+{
+    m_atmosReplicator.removeClient(controller->GetUniqueID());
 }
 
 FAtmoStruct AWorldGrid::GetAtmosphericsReport(const FVector& location) const
@@ -64,11 +373,25 @@ FAtmoStruct AWorldGrid::GetAtmosphericsReport(const FVector& location) const
     if(index == FIntVector::NoneValue)
         return {};
     if(!m_atmosphericsManager->isStarted())
-        return {};
+        return m_atmosReplica.getPressure(index.X, index.Y, index.Z);
 
     return m_atmosphericsManager->getPressure(index.X, index.Y, index.Z);
 }
 
+float AWorldGrid::GetTotalPressure(const FVector& location) const
+{
+    const auto index = getCellIndexFromWorldLocation(location);
+    if(index == FIntVector::NoneValue)
+        return 0.0f;
+    if(!m_atmosphericsManager->isStarted())
+    {
+        const auto atmo = m_atmosReplica.getPressure(index.X, index.Y, index.Z);
+        return atmo.O2 + atmo.N2 + atmo.CO2 + atmo.Toxin;
+    }
+
+    return m_atmosphericsManager->getTotalPressure(index.X, index.Y, index.Z);
+}
+
 bool AWorldGrid::GetFloorBlockConstructionLocation(const FVector& hitLocation,
                                                    FVector& floorCenter,
                                                    FVector& floorExtent) const
@@ -130,16 +453,25 @@ bool AWorldGrid::GetWallBlockConstructionLocation(const FVector& hitLocation,
 }
 
 FIntVector AWorldGrid::getCellIndexFromWorldLocation(const FVector& location) const
+{
+    FVector index;
+    if(!getCellPositionFromWorldLocation(location, index))
+        return FIntVector::NoneValue;
+
+    return {FMath::RoundToInt(index.X), FMath::RoundToInt(index.Y), FMath::RoundToInt(index.Z)};
+}
+
+bool AWorldGrid::getCellPositionFromWorldLocation(const FVector& location, FVector& index) const
 {
     const auto halfSize = Size * CellExtent / 2.0f + CellExtent;
     const auto worldCellSize = CellExtent * 2.0f;
-    const auto index = (location - this->GetActorLocation() + halfSize) / worldCellSize;
+    index = (location - this->GetActorLocation() + halfSize) / worldCellSize;
     if(index.X < 0 || index.X >= Size.X)
-        return FIntVector::NoneValue;
+        return false;
     if(index.Y < 0 || index.Y >= Size.Y)
-        return FIntVector::NoneValue;
+        return false;
     if(index.Z < 0 || index.Z >= Size.Z)
-        return FIntVector::NoneValue;
+        return false;
 
-    return {FMath::RoundToInt(index.X), FMath::RoundToInt(index.Y), FMath::RoundToInt(index.Z)};
+    return true;
 }
@@ -20,6 +20,8 @@
 
 #include "SS13RemakePlayerController.generated.h"
 
+class AWorldGrid;
+
 UCLASS()
 class ASS13RemakePlayerController : public APlayerController
 {
@@ -28,6 +30,14 @@ class ASS13RemakePlayerController : public APlayerController
 public:
     ASS13RemakePlayerController();
 
+    // Atmospherics packet from the server's grid. Grids are placed in the level, so both sides resolve the same one
+    UFUNCTION(Client, Unreliable)
+    void ClientReceiveAtmos(AWorldGrid* grid, const TArray<uint8>& packet);
+
+    // The client applied the atmospherics packet of the grid with the given sequence
+    UFUNCTION(Server, Unreliable, WithValidation)
+    void ServerAcknowledgeAtmos(AWorldGrid* grid, int32 sequence);
+
 protected:
     /** True if the controlled character should navigate to the mouse cursor. */
     bool bMoveToMouseCursor;
@@ -35,6 +45,8 @@ protected:
     // Begin PlayerController interface
     void PlayerTick(float deltaTime) override;
 
+    void EndPlay(const EEndPlayReason::Type endPlayReason) override;
+
     void SetupInputComponent() override;
     // End PlayerController interface
 
@@ -16,6 +16,10 @@
 
 #pragma once
 
+#include "AtmoOverlay2D.h"
+#include "AtmoReaction.h"
+#include "AtmoReplica3D.h"
+#include "AtmoReplicator.h"
 #include "AtmoStruct.h"
 #include "EngineMinimal.h"
 #include "FluidSimulationManager.h"
@@ -32,6 +36,14 @@ enum class EWallDirection : uint8
     West
 };
 
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_ThreeParams(FAtmosThresholdSignature,
+                                               int32,
+                                               Subscription,
+                                               bool,
+                                               Triggered,
+                                               float,
+                                               Value);
+
 UCLASS()
 class SS13REMAKE_API AWorldGrid : public AActor
 {
@@ -61,6 +73,59 @@ public:
     UPROPERTY(Category = "Grid", BlueprintReadWrite, EditAnywhere)
     float WallThickness;
 
+    // Seconds between two atmospherics packets to every client
+    UPROPERTY(Category = "Atmospherics", BlueprintReadWrite, EditAnywhere)
+    float AtmosReplicationInterval;
+
+    // Pressure change of a tile before it is sent to clients again
+    UPROPERTY(Category = "Atmospherics", BlueprintReadWrite, EditAnywhere)
+    float AtmosReplicationThreshold;
+
+    // Megabytes the atmospherics grids may take, 0 is unlimited. Over budget the grids use cheaper storage or the
+    // atmospherics do not start
+    UPROPERTY(Category = "Atmospherics", BlueprintReadWrite, EditAnywhere)
+    int32 AtmosMemoryBudgetMB;
+
+    // Runs the atmospherics on the worker pool shared by every grid instead of a thread of their own. Set it on
+    // small grids like shuttles and outposts, or on any grid that docks to another
+    UPROPERTY(Category = "Atmospherics", BlueprintReadWrite, EditAnywhere)
+    bool AtmosSharedScheduler;
+
+    // On the shared pool, grids with a higher priority are ticked first when they are due at the same time
+    UPROPERTY(Category = "Atmospherics", BlueprintReadWrite, EditAnywhere)
+    int32 AtmosSchedulePriority;
+
+    // On the shared pool, most ticks per second of the atmospherics, 0 is unlimited
+    UPROPERTY(Category = "Atmospherics", BlueprintReadWrite, EditAnywhere)
+    float AtmosMaxTickRate;
+
+    // Gas reactions of every tile, e.g. combustion, scrubbing or toxin decay. SetAtmosReactions changes them in play
+    UPROPERTY(Category = "Atmospherics", BlueprintReadOnly, EditAnywhere)
+    TArray<FAtmoReaction> AtmosReactions;
+
+    // Keeps AtmosOverlayTexture up to date
+    UPROPERTY(Category = "Atmospherics", BlueprintReadWrite, EditAnywhere)
+    bool ShowAtmosOverlay;
+
+    UPROPERTY(Category = "Atmospherics", BlueprintReadWrite, EditAnywhere)
+    EAtmoOverlayField AtmosOverlayField;
+
+    // Level of the grid the overlay shows
+    UPROPERTY(Category = "Atmospherics", BlueprintReadWrite, EditAnywhere)
+    int32 AtmosOverlayLevel;
+
+    // Value shown at full heat
+    UPROPERTY(Category = "Atmospherics", BlueprintReadWrite, EditAnywhere)
+    float AtmosOverlayRange;
+
+    // Heat map with one texel per tile, only changed tiles are uploaded
+    UPROPERTY(Category = "Atmospherics", BlueprintReadOnly, Transient)
+    UTexture2D* AtmosOverlayTexture;
+
+    // Server side, a subscription crossed its threshold. Value is the mean over its cells
+    UPROPERTY(Category = "Atmospherics", BlueprintAssignable)
+    FAtmosThresholdSignature OnAtmosThreshold;
+
     UPROPERTY(BlueprintReadOnly)
     UBoxComponent* GroundCollisionComponent;
 
@@ -70,6 +135,55 @@ public:
     UFUNCTION(Category = "Grid", BlueprintCallable, BlueprintPure)
     FAtmoStruct GetAtmosphericsReport(const FVector& location) const;
 
+    UFUNCTION(Category = "Grid", BlueprintCallable, BlueprintPure)
+    float GetTotalPressure(const FVector& location) const;
+
+    // Watches the cells between the two locations, OnAtmosThreshold fires when their mean passes the threshold
+    // and again when it is back past threshold and hysteresis. Returns the subscription, INDEX_NONE on clients or
+    // outside of the grid
+    UFUNCTION(Category = "Atmospherics", BlueprintCallable)
+    int32 SubscribeAtmos(const FVector& minLocation,
+                         const FVector& maxLocation,
+                         EAtmoOverlayField field,
+                         EAtmoThresholdComparison comparison,
+                         float threshold,
+                         float hysteresis);
+
+    UFUNCTION(Category = "Atmospherics", BlueprintCallable)
+    void UnsubscribeAtmos(int32 subscription);
+
+    UFUNCTION(Category = "Atmospherics", BlueprintCallable)
+    void SetAtmosReactions(const TArray<FAtmoReaction>& reactions);
+
+    // Adds `rate` of gas per second to the tiles around location for `seconds`, 0 seconds adds the rate once as an
+    // amount. Negative rates remove gas, e.g. for scrubbers. Neither locks nor allocates, so vents may call it every
+    // frame. Returns false on clients, outside of the grid or when too many commands wait for the simulation
+    UFUNCTION(Category = "Atmospherics", BlueprintCallable)
+    bool AddAtmosGas(const FVector& location, const FAtmoStruct& rate, float seconds);
+
+    // Same as AddAtmosGas, spread evenly over the tiles between the two locations
+    UFUNCTION(Category = "Atmospherics", BlueprintCallable)
+    bool AddAtmosGasToRegion(const FVector& minLocation,
+                             const FVector& maxLocation,
+                             const FAtmoStruct& rate,
+                             float seconds);
+
+    // Grows or shrinks the grid during play, e.g. when a shuttle docks. The tile at index (x, y, z) becomes tile
+    // (x, y, z) + cellOffset and keeps its place in the world and its atmospherics. The new size applies once the
+    // atmospherics switched to the new grid, offsets of resizes requested before that add up. Returns false on
+    // clients or when the atmospherics do not fit their memory budget
+    UFUNCTION(Category = "Grid", BlueprintCallable)
+    bool ResizeGrid(const FVector& newSize, const FVector& cellOffset);
+
+    // Docks the atmospherics of two grids on the shared pool: gas flows between the tile at location and the tile of
+    // other at otherLocation, `rate` of their difference every second. Returns the port, INDEX_NONE on clients,
+    // outside of either grid or when a grid is not on the shared pool. Disconnect before resizing either grid
+    UFUNCTION(Category = "Atmospherics", BlueprintCallable)
+    int32 ConnectAtmos(AWorldGrid* other, const FVector& location, const FVector& otherLocation, float rate);
+
+    UFUNCTION(Category = "Atmospherics", BlueprintCallable)
+    void DisconnectAtmos(int32 port);
+
     UFUNCTION(Category = "Grid", BlueprintCallable, BlueprintPure)
     bool GetFloorBlockConstructionLocation(const FVector& hitLocation,
                                            FVector& floorCenter,
@@ -81,8 +195,44 @@ public:
                                           FVector& wallExtent,
                                           EWallDirection& wallDirection) const;
 
+    // Applies atmospherics sent by the server. Returns the sequence to acknowledge, INDEX_NONE if there is none
+    int32 receiveAtmos(const TArray<uint8>& packet);
+
+    void acknowledgeAtmos(const APlayerController* controller, int32 sequence);
+
+    void removeAtmosClient(const APlayerController* controller);
+
 private:
     FIntVector getCellIndexFromWorldLocation(const FVector& location) const;
 
+    // Index of the tile at location in fractions of a tile, tile centres are whole. False outside of the grid
+    bool getCellPositionFromWorldLocation(const FVector& location, FVector& index) const;
+
+    void replicateAtmos();
+
+    // Switches Size and the location to the resizes the atmospherics swapped in since the last call
+    void applyAtmosResizes();
+
+    void dispatchAtmosEvents();
+
+    void updateAtmosOverlay();
+
+    void uploadAtmosOverlay(TArray<FIntRect>&& tiles, TArray<FColor>&& texels);
+
     TUniquePtr<FFluidSimulationManager> m_atmosphericsManager;
+    struct FPendingResize
+    {
+        int32 request; // see FFluidSimulationManager::requestedResize()
+        FVector size;
+        FVector shift; // actor movement relative to the resize before
+    };
+    // Resizes the atmospherics are still building, locations map to the old grid until they are swapped in
+    TArray<FPendingResize> m_pendingResizes;
+    // Server side, chunks every client still needs
+    AtmoReplicator m_atmosReplicator;
+    float m_atmosReplicationTime;
+    // Client side, atmospherics received from the server
+    AtmoReplica3D m_atmosReplica;
+    // Client side, heat map of the replica
+    AtmoOverlay2D m_atmosOverlay;
 };